@@ -0,0 +1,458 @@
+#include <atomic>
+#include <algorithm>
+
+#include "base64.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define BASE64_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// the kernels are built for their instruction sets whatever the compiler's target is,
+// and only run once the CPU is known to have them.
+#if defined(__GNUC__) || defined(__clang__)
+#define BASE64_TARGET(x) __attribute__((target(x)))
+#else
+#define BASE64_TARGET(x)
+#endif
+
+namespace base64
+{
+   static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+   // char -> sextet, -1 for anything that isn't base64.
+   static const signed char kDecode[256] = {
+      -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+      -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,-1,-1,63, 52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-1,-1,-1,
+      -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14, 15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,
+      -1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40, 41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1,
+      -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+      -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+      -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+      -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+   };
+
+   // A kernel encodes whole blocks of src (never reading past len) and returns the bytes it
+   // consumed, a multiple of 3. Decoding, it stops at the first block holding anything but
+   // the 64 base64 chars and returns the chars consumed, a multiple of 4. dst needs 4 bytes
+   // of slack past what's decoded.
+   typedef size_t(*encodefn)(const unsigned char * src, size_t len, char * dst);
+   typedef size_t(*decodefn)(const unsigned char * src, size_t len, unsigned char * dst);
+
+   // -------------------------------------------------------------------------------
+
+   static size_t _encodescalar(const unsigned char * src, size_t len, char * dst)
+   {
+      size_t i = 0;
+      for (; i + 3 <= len; i += 3, dst += 4)
+      {
+         uint32_t v = ((uint32_t)src[i] << 16) | ((uint32_t)src[i + 1] << 8) | src[i + 2];
+         dst[0] = kAlphabet[v >> 18];
+         dst[1] = kAlphabet[(v >> 12) & 63];
+         dst[2] = kAlphabet[(v >> 6) & 63];
+         dst[3] = kAlphabet[v & 63];
+      }
+      return i;
+   }
+
+   static size_t _decodescalar(const unsigned char * src, size_t len, unsigned char * dst)
+   {
+      size_t i = 0;
+      for (; i + 4 <= len; i += 4, dst += 3)
+      {
+         int a = kDecode[src[i]], b = kDecode[src[i + 1]], c = kDecode[src[i + 2]], d = kDecode[src[i + 3]];
+         if ((a | b | c | d) < 0)
+            break;
+         uint32_t v = ((uint32_t)a << 18) | ((uint32_t)b << 12) | ((uint32_t)c << 6) | (uint32_t)d;
+         dst[0] = (unsigned char)(v >> 16);
+         dst[1] = (unsigned char)(v >> 8);
+         dst[2] = (unsigned char)v;
+      }
+      return i;
+   }
+
+#ifdef BASE64_X86
+   // 12 bytes in the low 12 of each 16 -> 16 sextets, one per byte (W. Mula's multiply-shift).
+   BASE64_TARGET("ssse3") static inline __m128i _split128(__m128i in)
+   {
+      in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+      const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+      const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+      const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+      const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+      return _mm_or_si128(t1, t3);
+   }
+
+   // sextets -> chars: one shuffle picks each sextet's offset by its range.
+   BASE64_TARGET("ssse3") static inline __m128i _tochars128(__m128i sextets)
+   {
+      const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+         '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+      __m128i range = _mm_subs_epu8(sextets, _mm_set1_epi8(51)); // 0..51 -> 0, 52..63 -> 1..12.
+      const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), sextets); // A-Z -> 13.
+      range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+      return _mm_add_epi8(sextets, _mm_shuffle_epi8(offsets, range));
+   }
+
+   // chars -> sextets, and a mask of the bytes that were base64 chars.
+   BASE64_TARGET("ssse3") static inline __m128i _tosextets128(__m128i c, int & valid)
+   {
+      const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), c));
+      const __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), c));
+      const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+      const __m128i plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+      const __m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+
+      valid = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(_mm_or_si128(digit, plus), slash)));
+
+      __m128i shift = _mm_and_si128(upper, _mm_set1_epi8(-65));
+      shift = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(-71)));
+      shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(4)));
+      shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(19)));
+      shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(16)));
+      return _mm_add_epi8(c, shift);
+   }
+
+   // 16 sextets -> 12 bytes in the low 12.
+   BASE64_TARGET("ssse3") static inline __m128i _join128(__m128i sextets)
+   {
+      const __m128i pairs = _mm_maddubs_epi16(sextets, _mm_set1_epi32(0x01400140));
+      const __m128i quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+      return _mm_shuffle_epi8(quads, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+   }
+
+   BASE64_TARGET("ssse3") static size_t _encodessse3(const unsigned char * src, size_t len, char * dst)
+   {
+      size_t i = 0;
+      for (; i + 16 <= len; i += 12, dst += 16)
+      {
+         __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+         _mm_storeu_si128((__m128i *)dst, _tochars128(_split128(in)));
+      }
+      return i;
+   }
+
+   BASE64_TARGET("ssse3") static size_t _decodessse3(const unsigned char * src, size_t len, unsigned char * dst)
+   {
+      size_t i = 0;
+      for (; i + 16 <= len; i += 16, dst += 12)
+      {
+         int valid;
+         __m128i sextets = _tosextets128(_mm_loadu_si128((const __m128i *)(src + i)), valid);
+         if (valid != 0xffff)
+            break;
+         _mm_storeu_si128((__m128i *)dst, _join128(sextets));
+      }
+      return i;
+   }
+
+   // the same, a 128 bit lane at a time.
+   BASE64_TARGET("avx2") static size_t _encodeavx2(const unsigned char * src, size_t len, char * dst)
+   {
+      const __m256i split = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+         10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+      const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+         '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+         'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+         '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+      size_t i = 0;
+      for (; i + 28 <= len; i += 24, dst += 32)
+      {
+         __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + i))),
+            _mm_loadu_si128((const __m128i *)(src + i + 12)), 1);
+         in = _mm256_shuffle_epi8(in, split);
+         const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+         const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+         const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+         const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+         const __m256i sextets = _mm256_or_si256(t1, t3);
+
+         __m256i range = _mm256_subs_epu8(sextets, _mm256_set1_epi8(51));
+         const __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), sextets);
+         range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+         _mm256_storeu_si256((__m256i *)dst, _mm256_add_epi8(sextets, _mm256_shuffle_epi8(offsets, range)));
+      }
+      return i;
+   }
+
+   BASE64_TARGET("avx2") static size_t _decodeavx2(const unsigned char * src, size_t len, unsigned char * dst)
+   {
+      const __m256i join = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+         2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+      size_t i = 0;
+      for (; i + 32 <= len; i += 32, dst += 24)
+      {
+         const __m256i c = _mm256_loadu_si256((const __m256i *)(src + i));
+         const __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), c));
+         const __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), c));
+         const __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+         const __m256i plus = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('+'));
+         const __m256i slash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/'));
+
+         const __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(_mm256_or_si256(digit, plus), slash));
+         if (_mm256_movemask_epi8(valid) != -1)
+            break;
+
+         __m256i shift = _mm256_and_si256(upper, _mm256_set1_epi8(-65));
+         shift = _mm256_or_si256(shift, _mm256_and_si256(lower, _mm256_set1_epi8(-71)));
+         shift = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(4)));
+         shift = _mm256_or_si256(shift, _mm256_and_si256(plus, _mm256_set1_epi8(19)));
+         shift = _mm256_or_si256(shift, _mm256_and_si256(slash, _mm256_set1_epi8(16)));
+         const __m256i sextets = _mm256_add_epi8(c, shift);
+
+         const __m256i pairs = _mm256_maddubs_epi16(sextets, _mm256_set1_epi32(0x01400140));
+         const __m256i quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+         const __m256i out = _mm256_shuffle_epi8(quads, join);
+         _mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(out));
+         _mm_storeu_si128((__m128i *)(dst + 12), _mm256_extracti128_si256(out, 1));
+      }
+      return i;
+   }
+#endif
+
+   // -------------------------------------------------------------------------------
+
+   static bool _supported(kernel k)
+   {
+      if (k == kScalar)
+         return true;
+#if defined(BASE64_X86) && (defined(__GNUC__) || defined(__clang__))
+      __builtin_cpu_init();
+      return (k == kAVX2) ? __builtin_cpu_supports("avx2") != 0 : __builtin_cpu_supports("ssse3") != 0;
+#elif defined(BASE64_X86) && defined(_MSC_VER)
+      int info[4];
+      __cpuid(info, 0);
+      int maxleaf = info[0];
+      __cpuid(info, 1);
+      if (k == kSSSE3)
+         return (info[2] & (1 << 9)) != 0;
+      bool osavx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6; // OSXSAVE, AVX, and the OS saves the ymm registers.
+      if (!osavx || maxleaf < 7)
+         return false;
+      __cpuidex(info, 7, 0);
+      return (info[1] & (1 << 5)) != 0;
+#else
+      return false;
+#endif
+   }
+
+   struct kernels
+   {
+      kernel k;
+      encodefn encode;
+      decodefn decode;
+   };
+
+   static const kernels sKernels[] = {
+      { kScalar, _encodescalar, _decodescalar },
+#ifdef BASE64_X86
+      { kSSSE3, _encodessse3, _decodessse3 },
+      { kAVX2, _encodeavx2, _decodeavx2 },
+#endif
+   };
+
+   kernel best()
+   {
+      static const kernel sBest = _supported(kAVX2) ? kAVX2 : (_supported(kSSSE3) ? kSSSE3 : kScalar);
+      return sBest;
+   }
+
+   static std::atomic<const kernels *> sActive(NULL);
+
+   static const kernels & _active()
+   {
+      const kernels * k = sActive.load(std::memory_order_relaxed);
+      if (k == NULL)
+      {
+         k = &sKernels[best()];
+         sActive.store(k, std::memory_order_relaxed);
+      }
+      return *k;
+   }
+
+   kernel current()
+   {
+      return _active().k;
+   }
+
+   bool use(kernel k)
+   {
+      if (!_supported(k))
+         return false;
+      sActive.store(&sKernels[k]);
+      return true;
+   }
+
+   const char * name(kernel k)
+   {
+      switch (k)
+      {
+      case kAVX2: return "AVX2";
+      case kSSSE3: return "SSSE3";
+      default: return "scalar";
+      }
+   }
+
+   // -------------------------------------------------------------------------------
+
+   size_t encodedlength(size_t len, bool pad)
+   {
+      return pad ? (len + 2) / 3 * 4 : len / 3 * 4 + (len % 3 == 0 ? 0 : len % 3 + 1);
+   }
+
+   // whole groups of 3 only.
+   static void _encodegroups(const unsigned char * src, size_t len, char * dst)
+   {
+      size_t done = _active().encode(src, len, dst);
+      _encodescalar(src + done, len - done, dst + done / 3 * 4);
+   }
+
+   // the last 1 or 2 bytes.
+   static size_t _encodetail(const unsigned char * src, size_t len, char * dst, bool pad)
+   {
+      uint32_t v = ((uint32_t)src[0] << 16) | (len == 2 ? (uint32_t)src[1] << 8 : 0);
+      dst[0] = kAlphabet[v >> 18];
+      dst[1] = kAlphabet[(v >> 12) & 63];
+      if (len == 2)
+         dst[2] = kAlphabet[(v >> 6) & 63];
+      if (!pad)
+         return len + 1;
+      if (len == 1)
+         dst[2] = '=';
+      dst[3] = '=';
+      return 4;
+   }
+
+   std::string encode(const char * data, size_t len, bool pad)
+   {
+      const unsigned char * src = (const unsigned char *)data;
+      std::string out(encodedlength(len, pad), '\0');
+      size_t whole = len / 3 * 3;
+      _encodegroups(src, whole, &out[0]);
+      if (whole < len)
+         _encodetail(src + whole, len - whole, &out[whole / 3 * 4], pad);
+      return out;
+   }
+
+   std::string encode(const std::string & s, bool pad)
+   {
+      return encode(s.data(), s.length(), pad);
+   }
+
+   std::string decode(const char * data, size_t len)
+   {
+      std::string out;
+      decoder d;
+      d.update(data, len, out);
+      d.finish(out);
+      return out;
+   }
+
+   std::string decode(const std::string & s)
+   {
+      return decode(s.data(), s.length());
+   }
+
+   // -------------------------------------------------------------------------------
+
+   void encoder::update(const char * data, size_t len, std::string & out)
+   {
+      const unsigned char * src = (const unsigned char *)data;
+      if (mCarried > 0)
+      {
+         unsigned char group[3] = { mCarry[0], mCarry[1], 0 };
+         while (mCarried < 3 && len > 0)
+         {
+            group[mCarried++] = *src++;
+            --len;
+         }
+         if (mCarried < 3)
+         {
+            mCarry[0] = group[0];
+            mCarry[1] = group[1];
+            return;
+         }
+         char chars[4];
+         _encodescalar(group, 3, chars);
+         out.append(chars, 4);
+         mCarried = 0;
+      }
+
+      size_t whole = len / 3 * 3;
+      size_t start = out.size();
+      out.resize(start + whole / 3 * 4);
+      _encodegroups(src, whole, &out[start]);
+
+      for (size_t i = whole; i < len; ++i)
+         mCarry[mCarried++] = src[i];
+   }
+
+   void encoder::finish(std::string & out)
+   {
+      if (mCarried > 0)
+      {
+         char chars[4];
+         out.append(chars, _encodetail(mCarry, mCarried, chars, mPad));
+      }
+      mCarried = 0;
+   }
+
+   void decoder::update(const char * data, size_t len, std::string & out)
+   {
+      const unsigned char * src = (const unsigned char *)data;
+      size_t start = out.size();
+      out.resize(start + (len + 3) / 4 * 3 + 4); // at most, with the kernels' slack.
+      unsigned char * dst = (unsigned char *)&out[start];
+      size_t written = 0;
+
+      size_t i = 0;
+      while (i < len)
+      {
+         if (mCount == 0)
+         { // the kernel runs until it finds something it can't handle, e.g. a line break.
+            size_t done = _active().decode(src + i, len - i, dst + written);
+            i += done;
+            written += done / 4 * 3;
+         }
+
+         // then a block a char at a time, skipping what isn't base64, and on to a whole quantum.
+         size_t stop = std::min(len, i + 32);
+         for (; i < len && (i < stop || mCount != 0); ++i)
+         {
+            int v = kDecode[src[i]];
+            if (v < 0)
+               continue;
+            mBits = (mBits << 6) | (uint32_t)v;
+            if (++mCount == 4)
+            {
+               dst[written++] = (unsigned char)(mBits >> 16);
+               dst[written++] = (unsigned char)(mBits >> 8);
+               dst[written++] = (unsigned char)mBits;
+               mBits = 0;
+               mCount = 0;
+            }
+         }
+      }
+      out.resize(start + written);
+   }
+
+   void decoder::finish(std::string & out)
+   {
+      // 2 sextets hold a byte, 3 hold two. A lone sextet is a truncated stream, dropped.
+      if (mCount >= 2)
+      {
+         uint32_t v = mBits << (6 * (4 - mCount));
+         out += (char)(v >> 16);
+         if (mCount == 3)
+            out += (char)(v >> 8);
+      }
+      mBits = 0;
+      mCount = 0;
+   }
+
+} // namespace
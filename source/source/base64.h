@@ -0,0 +1,67 @@
+#ifndef __BASE64_H
+#define __BASE64_H
+
+#include <string>
+#include <cstdint>
+
+// Table driven base64 (RFC 4648, + and /), with SSSE3 and AVX2 kernels that are used when
+// the CPU has them (checked once, at run time) and a scalar fallback otherwise.
+//
+// Decoding skips whitespace, padding and anything else outside the alphabet, so it reads
+// both padded and unpadded text, split over lines or not.
+namespace base64
+{
+   enum kernel
+   {
+      kScalar,
+      kSSSE3,
+      kAVX2
+   };
+
+   std::string encode(const char * data, size_t len, bool pad);
+   std::string encode(const std::string & s, bool pad = true);
+   std::string decode(const char * data, size_t len);
+   std::string decode(const std::string & s);
+
+   // chars encode writes for len bytes.
+   size_t encodedlength(size_t len, bool pad = true);
+
+   // the kernel in use, and the best one the CPU supports.
+   kernel current();
+   kernel best();
+   const char * name(kernel k);
+
+   // use kernel k (for tests and benchmarks). False, with no change, if the CPU can't run it.
+   bool use(kernel k);
+
+   // encode a stream in pieces of any size: output is appended to out.
+   class encoder
+   {
+   public:
+      encoder(bool pad = true) : mPad(pad), mCarried(0) {}
+
+      void update(const char * data, size_t len, std::string & out);
+      void finish(std::string & out); // the last (padded) quantum. Ready for a new stream after.
+
+   private:
+      bool mPad;
+      size_t mCarried;
+      unsigned char mCarry[2]; // bytes short of a whole 3 byte group.
+   };
+
+   // decode a stream in pieces of any size: output is appended to out.
+   class decoder
+   {
+   public:
+      decoder() : mBits(0), mCount(0) {}
+
+      void update(const char * data, size_t len, std::string & out);
+      void finish(std::string & out); // the last partial quantum. Ready for a new stream after.
+
+   private:
+      uint32_t mBits;
+      int mCount; // sextets in mBits.
+   };
+}
+
+#endif
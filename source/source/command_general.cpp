@@ -1,4 +1,14 @@
 #include <sys/stat.h>
+#include <ctime>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#include <cereal/archives/json.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
 
 #include "command_general.h"
 #include "globallogger.h"
@@ -8,28 +18,193 @@
 #include "utils_docker.h"
 #include "drunner_setup.h"
 #include "exceptions.h"
+#include "gitcache.h"
+#include "service_index.h"
+
+namespace utils_docker
+{
+   // a container as drunner list --status --json shows it.
+   template <class Archive> void save(Archive & ar, const dockercontainer & c)
+   {
+      ar(cereal::make_nvp("name", c.name), cereal::make_nvp("state", c.state), cereal::make_nvp("image", c.image));
+   }
+}
 
 namespace command_general
 {
 
+   // a service with the state of its containers, for drunner list --status.
+   class servicestatus
+   {
+   public:
+      servicestatus(const serviceinfo & i, bool status) : info(i), mStatus(status) {}
+
+      // running, stopped, partial (some running) or none (no containers).
+      std::string state() const
+      {
+         size_t running = 0;
+         for (const auto & c : containers)
+            if (c.running())
+               ++running;
+         if (containers.size() == 0)
+            return "none";
+         return (running == containers.size()) ? "running" : (running == 0 ? "stopped" : "partial");
+      }
+
+      serviceinfo info;
+      std::vector<utils_docker::dockercontainer> containers;
+
+      template <class Archive> void save(Archive & ar) const
+      {
+         ar(cereal::make_nvp("service", info.servicename), cereal::make_nvp("image", info.imagename),
+            cereal::make_nvp("domains", info.domains), cereal::make_nvp("volumes", info.volumes),
+            cereal::make_nvp("lastbackup", info.lastbackup), cereal::make_nvp("lastbackupsize", info.lastbackupsize));
+         if (mStatus)
+            ar(cereal::make_nvp("state", state()), cereal::make_nvp("containers", containers));
+      }
+
+   private:
+      bool mStatus;
+   };
+
+   // how much of the container's name is the service's name, 0 if none. A service owns the containers
+   // it proxies and those named after it (its name bounded by the ends of the container's name or by - _ .).
+   static size_t _claim(const serviceinfo & s, const std::string & container)
+   {
+      if (std::find(s.containers.begin(), s.containers.end(), container) != s.containers.end())
+         return std::string::npos;
+
+      const std::string seps("-_.");
+      size_t n = s.servicename.length();
+      for (size_t pos = container.find(s.servicename); n > 0 && pos != std::string::npos; pos = container.find(s.servicename, pos + 1))
+         if ((pos == 0 || seps.find(container[pos - 1]) != std::string::npos) &&
+            (pos + n == container.length() || seps.find(container[pos + n]) != std::string::npos))
+            return n;
+      return 0;
+   }
+
+   // each container goes to the service with the strongest claim on it.
+   static void _assign(std::vector<servicestatus> & services, const std::vector<utils_docker::dockercontainer> & containers)
+   {
+      for (const auto & c : containers)
+      {
+         servicestatus * best = NULL;
+         size_t bestclaim = 0;
+         for (auto & s : services)
+         {
+            size_t claim = _claim(s.info, c.name);
+            if (claim > bestclaim)
+            {
+               best = &s;
+               bestclaim = claim;
+            }
+         }
+         if (best != NULL)
+            best->containers.push_back(c);
+      }
+   }
+
+   static std::string _backupstr(const serviceinfo & s)
+   {
+      if (s.lastbackup == 0)
+         return "never";
+
+      char buf[32];
+      struct tm tm;
+      time_t t = (time_t)s.lastbackup;
+#ifdef _WIN32
+      localtime_s(&tm, &t);
+#else
+      localtime_r(&t, &tm);
+#endif
+      strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", &tm);
+
+      std::ostringstream os;
+      os << buf << " (" << std::fixed << std::setprecision(1) << (double)s.lastbackupsize / 1048576.0 << " MB)";
+      return os.str();
+   }
+
+   static std::string _join(const std::vector<std::string> & v)
+   {
+      std::string s;
+      for (const auto & x : v)
+         s += (s.length() > 0 ? "," : "") + x;
+      return s.length() > 0 ? s : "-";
+   }
+
    cResult showservices()
    {
-      std::vector<std::string> services;
-      utils::getAllServices(services);
-      if (services.size()>0)
+      const params & p(*GlobalContext::getParams());
+      bool status = p.isFlagSet("status");
+      bool json = p.isFlagSet("json");
+
+      // one docker inspect for the containers of every service, run while the index is read.
+      std::vector<utils_docker::dockercontainer> containers;
+      std::future<cResult> query;
+      if (status)
+         query = std::async(std::launch::async, [&containers]() { return utils_docker::getContainers(containers); });
+
+      std::vector<serviceinfo> index;
+      cResult r = serviceindex::getAll(index);
+      if (status)
       {
-         logmsg(kLINFO,"Installed dServices:");
-         for (auto const & entry : services)
-            logmsg(kLINFO,"  "+entry);
-      } else
+         cResult qr = query.get();
+         if (qr.error())
+            return qr;
+      }
+      if (r.error())
+         return r;
+
+      std::vector<servicestatus> services;
+      for (const auto & s : index)
+         services.push_back(servicestatus(s, status));
+      if (status)
+         _assign(services, containers);
+
+      if (json)
+      {
+         {
+            cereal::JSONOutputArchive archive(std::cout);
+            archive(cereal::make_nvp("services", services));
+         }
+         std::cout << std::endl;
+         return kRSuccess;
+      }
+
+      if (services.size() == 0)
          return cError("No dServices are installed.");
 
+      size_t ws = 7, wi = 5, wd = 7;
+      for (const auto & s : services)
+      {
+         ws = std::max(ws, s.info.servicename.length());
+         wi = std::max(wi, s.info.imagename.length());
+         wd = std::max(wd, _join(s.info.domains).length());
+      }
+      std::ostringstream table;
+      table << std::left << std::setw(ws + 2) << "SERVICE" << std::setw(wi + 2) << "IMAGE";
+      if (status)
+         table << std::setw(9) << "STATE";
+      table << std::setw(wd + 2) << "DOMAINS" << "LAST BACKUP" << std::endl;
+      for (const auto & s : services)
+      {
+         table << std::left << std::setw(ws + 2) << s.info.servicename << std::setw(wi + 2) << (s.info.imagename.length() > 0 ? s.info.imagename : "-");
+         if (status)
+            table << std::setw(9) << s.state();
+         table << std::setw(wd + 2) << _join(s.info.domains) << _backupstr(s.info) << std::endl;
+      }
+      logmsg(kLINFO, "\n" + table.str());
       return kRSuccess;
    }
 
 
    cResult clean()
    {
+      int days = GlobalContext::getSettings()->getGitCacheExpiry();
+
+      if (GlobalContext::getParams()->isFlagSet("gitcache"))
+         return gitcache::clean(days);
+
       std::string op;
       utils_docker::pullImage("spotify/docker-gc");
 
@@ -38,6 +213,10 @@ namespace command_general
       if (utils::runcommand_stream(cl, kORaw, "", {},NULL) != 0)
          return cError("Unable to run spotify/docker-gc to clean docker images.");
 
+      cResult r = gitcache::clean(days);
+      if (r.error())
+         return r;
+
       logmsg(kLINFO,"Cleaning is complete.");
       return kRSuccess;
    }
@@ -1,5 +1,6 @@
 #include <Poco/UnicodeConverter.h>
 #include <Poco/File.h>
+#include <mutex>
 
 #include "drunner_paths.h"
 #include "utils.h"
@@ -17,7 +18,33 @@
 #include <unistd.h>
 #endif
 
+// the root set by setRoot or DRUNNER_ROOT, empty if none. Never destroyed, as the logger
+// wants paths while the statics are.
+static std::mutex & _rootmutex()
+{
+   static std::mutex * m = new std::mutex;
+   return *m;
+}
+
+static std::string & _rootoverride()
+{
+   static std::string * root = new std::string(utils::getenv("DRUNNER_ROOT"));
+   return *root;
+}
+
+void drunnerPaths::setRoot(Poco::Path root)
+{
+   std::lock_guard<std::mutex> lock(_rootmutex());
+   _rootoverride() = root.toString();
+}
+
 Poco::Path drunnerPaths::getPath_Root() {
+   {
+      std::lock_guard<std::mutex> lock(_rootmutex());
+      if (_rootoverride().length() > 0)
+         return Poco::Path(_rootoverride()).makeDirectory();
+   }
+
    Poco::Path drunnerdir = Poco::Path::home();
    drunnerdir.makeDirectory();
    poco_assert(drunnerdir.isDirectory());
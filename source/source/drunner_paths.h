@@ -5,7 +5,8 @@
 
 namespace drunnerPaths
 {
-   Poco::Path getPath_Root();       // the path of the drunner root (for all config). %APPDATA%/drunner [win] or $HOME/.drunner [lin]
+   Poco::Path getPath_Root();       // the path of the drunner root (for all config). %APPDATA%/drunner [win] or $HOME/.drunner [lin], or $DRUNNER_ROOT if set.
+   void setRoot(Poco::Path root);   // use root instead from now on, e.g. a scratch root for unit tests. An empty path goes back to the default.
    Poco::Path getPath_Exe();        // the path of the drunner execuatble. can be anywhere
    Poco::Path getPath_Exe_Target(); // the target path of the drunner executable. On Linux this is the same as getPath_Exe (we don't move it). On Windows it's .drunner/bin (we do move it). 
 
@@ -1,4 +1,5 @@
 #include <fstream>
+#include <cstdlib>
 #include <Poco/Path.h>
 
 #include "drunner_settings.h"
@@ -17,7 +18,7 @@ drunnerSettings::drunnerSettings() : persistvariables("drunner", drunnerPaths::g
 {
    mReadOkay = false;
 
-   if (!utils::fileexists(mPath))
+   if (!exists())
       logdbg("The dRunner settings file does not exist: " + mPath.toString());
    else
    {
@@ -46,11 +47,58 @@ std::string drunnerSettings::getdrunnerInstallURL()
 #endif
 }
 
+size_t drunnerSettings::getLuaMemLimit() const
+{
+   int mb = atoi(getVal("LUAMEMLIMIT").c_str());
+   if (mb <= 0)
+      return 0;
+   return (size_t)mb * 1024 * 1024;
+}
+
+int drunnerSettings::getGitCacheTTL() const
+{
+   int ttl = atoi(getVal("GITCACHETTL").c_str());
+   return (ttl < 0) ? 0 : ttl;
+}
+
+int drunnerSettings::getGitCacheExpiry() const
+{
+   int days = atoi(getVal("GITCACHEEXPIRY").c_str());
+   return (days < 1) ? 1 : days;
+}
+
+int drunnerSettings::getUpdateWorkers() const
+{
+   int n = atoi(getVal("UPDATEWORKERS").c_str());
+   return (n < 1) ? 1 : n;
+}
+
+uint64_t drunnerSettings::getLogMaxSize() const
+{
+   int mb = atoi(getVal("LOGMAXSIZE").c_str());
+   return (mb < 0) ? 0 : (uint64_t)mb * 1024 * 1024;
+}
+
+int drunnerSettings::getLogMaxAge() const
+{
+   int days = atoi(getVal("LOGMAXAGE").c_str());
+   return (days < 0) ? 0 : days;
+}
+
 const std::vector<envDef> drunnerSettings::_getConfig()
 {
    std::vector<envDef> config;
    config.push_back(envDef("INSTALLTIME", utils::getTime(), "Time installed.",ENV_PERSISTS ));
    config.push_back(envDef("PULLIMAGES", "true", "Set to false to never pull docker images",ENV_PERSISTS | ENV_USERSETTABLE));
-   config.push_back(envDef("PROXY", "caddy", "The proxy to use {caddy,none}.",ENV_PERSISTS | ENV_USERSETTABLE));
+   config.push_back(envDef("PROXY", "caddy", "The proxy to use {caddy,nginx,none}.",ENV_PERSISTS | ENV_USERSETTABLE));
+   config.push_back(envDef("LUAMEMLIMIT", "64", "Memory limit in MB for each service.lua interpreter (0 for no limit).", ENV_PERSISTS | ENV_USERSETTABLE));
+   config.push_back(envDef("GITCACHETTL", "300", "Seconds a resolved git tag is trusted before asking the remote again (0 to always ask).", ENV_PERSISTS | ENV_USERSETTABLE));
+   config.push_back(envDef("GITCACHESHARED", "true", "Set to false to give each git cache entry its own object store.", ENV_PERSISTS | ENV_USERSETTABLE));
+   config.push_back(envDef("GITCACHEEXPIRY", "30", "Days a git cache entry can go unused before drunner clean removes it.", ENV_PERSISTS | ENV_USERSETTABLE));
+   config.push_back(envDef("PROXYUSEDNS", "false", "Set to true for the proxy to reach services by container name rather than IP address.", ENV_PERSISTS | ENV_USERSETTABLE));
+   config.push_back(envDef("LOGJSON", "false", "Set to true to also log to Logs/log.jsonl, one JSON object per message.", ENV_PERSISTS | ENV_USERSETTABLE));
+   config.push_back(envDef("LOGMAXSIZE", "100", "Megabytes of compressed log archives to keep in Logs, oldest are deleted first. 0 for no limit.", ENV_PERSISTS | ENV_USERSETTABLE));
+   config.push_back(envDef("LOGMAXAGE", "30", "Days to keep log archives. 0 for no limit.", ENV_PERSISTS | ENV_USERSETTABLE));
+   config.push_back(envDef("UPDATEWORKERS", "4", "Number of services updateall updates in parallel.", ENV_PERSISTS | ENV_USERSETTABLE));
    return config;
 }
@@ -1,6 +1,8 @@
 #ifndef __drunnerSettings_H
 #define __drunnerSettings_H
 
+#include <cstdint>
+
 #include "variables.h"
 
 class drunnerSettings : public persistvariables
@@ -12,6 +14,15 @@ public:
    std::string getdrunnerInstallTime()const { return getVal("INSTALLTIME"); }
    bool getPullImages() const               { return getBool("PULLIMAGES"); }
    std::string getProxy() const { return getVal("PROXY"); }
+   bool getProxyUseDNS() const { return getBool("PROXYUSEDNS"); }
+   size_t getLuaMemLimit() const; // in bytes, 0 for no limit.
+   int getGitCacheTTL() const; // seconds.
+   bool getGitCacheShared() const { return getBool("GITCACHESHARED"); }
+   int getGitCacheExpiry() const; // days.
+   int getUpdateWorkers() const; // services updateall updates at once.
+   bool getLogJSON() const { return getBool("LOGJSON"); }
+   uint64_t getLogMaxSize() const; // bytes of log archives to keep, 0 for no limit.
+   int getLogMaxAge() const; // days, 0 for no limit.
 
    bool mReadOkay;
 
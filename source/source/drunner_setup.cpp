@@ -12,6 +12,7 @@
 #include "dassert.h"
 #include "buildnum.h"
 #include "proxy.h"
+#include "persistence.h"
 
 #include <Poco/Process.h>
 #include <Poco/Path.h>
@@ -251,7 +252,12 @@ namespace drunnerSetup
       if (!utils::fileexists(target))
          fatal("Couldn't download drunner-install.");
 
-      // exec to switch to that process.
+      // exec to switch to that process - nothing of ours survives it, so write out pending settings and the log first.
+      cResult pr = persistence::flush();
+      if (pr.error())
+         logmsg(kLWARN, "Couldn't write settings: " + pr.what());
+      logstop();
+
       const char    *my_argv[64] = { target.c_str(), NULL };
       execve(my_argv[0], (char **)my_argv, NULL);
 
@@ -67,6 +67,8 @@ enum eCommand {
    c_configure,
    c_registry,
    c_proxy,
+   c_search,
+   c_logs,
 };
 
 
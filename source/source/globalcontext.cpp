@@ -1,3 +1,6 @@
+#include <mutex>
+#include <atomic>
+
 #include "globalcontext.h"
 #include "globallogger.h"
 #include "utils.h"
@@ -9,6 +12,9 @@ std::shared_ptr<const drunnerSettings> GlobalContext::s_settings = 0;
 std::shared_ptr<const plugins> GlobalContext::s_plugins = 0;
 //bool GlobalContext::s_ForceDeveloperMode = false;
 
+static std::once_flag s_settingsonce, s_pluginsonce;
+static std::atomic<bool> s_settingsloaded(false);
+
 GlobalContext::GlobalContext()
 {
 }
@@ -18,11 +24,7 @@ void GlobalContext::init(int argc, char * const * argv)
    // parse the command line parameters.
    s_params = std::make_shared<const params>(argc,argv);
 
-   // create the plugins
-   s_plugins = std::make_shared<const plugins>();
-
-   // load the dRunner settings from the config file.
-   s_settings = std::make_shared<const drunnerSettings>();
+   // the plugins and the dRunner settings are created on first use (getPlugins, getSettings).
 }
 
 void GlobalContext::init(const std::vector<std::string>& args)
@@ -42,12 +44,19 @@ bool GlobalContext::hasParams()
 }
 bool GlobalContext::hasSettings()
 {
-   return s_settings.get() != NULL;
+   return hasParams();
 }
 
 bool GlobalContext::hasPlugins()
 {
-   return s_plugins.get() != NULL;
+   return hasParams();
+}
+
+std::shared_ptr<const drunnerSettings> GlobalContext::loadedSettings()
+{
+   if (!s_settingsloaded)
+      return std::shared_ptr<const drunnerSettings>();
+   return s_settings;
 }
 
 //bool GlobalContext::isDeveloperMode()
@@ -66,6 +75,13 @@ bool GlobalContext::hasPlugins()
 //   s_ForceDeveloperMode = true;
 //}
 
+void GlobalContext::reloadSettings()
+{
+   std::call_once(s_settingsonce, []() {}); // getSettings won't load them now.
+   s_settings = std::make_shared<const drunnerSettings>();
+   s_settingsloaded = true;
+}
+
 std::shared_ptr<const params> GlobalContext::getParams()
 {
    if (!hasParams())
@@ -75,14 +91,22 @@ std::shared_ptr<const params> GlobalContext::getParams()
 std::shared_ptr<const drunnerSettings> GlobalContext::getSettings()
 {
    if (!hasSettings())
-      fatal("Attempted to retrieve settings from GlobalContext when settings have not been read.");
+      fatal("Attempted to retrieve settings from GlobalContext when not yet initialised.");
+
+   // load the dRunner settings from the config file.
+   std::call_once(s_settingsonce, []() {
+      s_settings = std::make_shared<const drunnerSettings>();
+      s_settingsloaded = true;
+   });
    return s_settings;
 }
 
 std::shared_ptr<const plugins> GlobalContext::getPlugins()
 {
    if (!hasPlugins())
-      fatal("Attempted to retrieve plugins from GlobalContext when it doesn't exist yet.");
+      fatal("Attempted to retrieve plugins from GlobalContext when not yet initialised.");
+
+   std::call_once(s_pluginsonce, []() { s_plugins = std::make_shared<const plugins>(); });
    return s_plugins;
 }
 
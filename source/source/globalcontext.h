@@ -18,11 +18,19 @@ public:
    static std::shared_ptr<const plugins> getPlugins();
 
    static bool hasParams();
-   static bool hasSettings();
+   static bool hasSettings(); // true once params are parsed - getSettings will load them on demand.
    static bool hasPlugins();
 
+   // the settings if something has already loaded them, otherwise null. Never loads them.
+   static std::shared_ptr<const drunnerSettings> loadedSettings();
+
+   // read the settings again, e.g. when the file has changed. Not thread safe.
+   static void reloadSettings();
+
    static void init(int argc, char * const * argv); // array of const strings.
    static void init(const std::vector<std::string> & args);
+   // Only the params are parsed by init; the settings and plugins are created on first use,
+   // so launch scripts that never need them don't pay to load them.
 
    GlobalContext();
 
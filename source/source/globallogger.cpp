@@ -3,7 +3,17 @@
 #include <sstream>
 #include <fstream>
 #include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
 #include <Poco/String.h>
+#include <Poco/LocalDateTime.h>
+#include <Poco/DateTimeFormatter.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #ifdef _WIN32
 #include <intrin.h>
@@ -18,29 +28,38 @@
 #include "termcolor.h"
 #include "timez.h"
 #include "drunner_paths.h"
+#include "logarchive.h"
+#include "persistence.h"
 
 class FileStreamer
 {
 public:      
-   FileStreamer() : mLogFailedMsgSent(false)
+   FileStreamer(std::string filename, bool indexed) : mFileName(filename), mIndexed(indexed), mFile(NULL), mLogFailedMsgSent(false), mSize(0)
    {
-      mMainlogFile = drunnerPaths::getPath_Logs().setFileName("log.txt");
-   }
-   ~FileStreamer()
-   {
-
    }
 
-   void Log(std::string s)
+   ~FileStreamer()
    {
-
+      Close();
    }
 
+   // opens the log file, or reopens it if it's no longer the file at mainlogfile - another
+   // drunner has rotated it, and it's an archive that's about to be compressed and deleted.
    bool CheckLogFileOpen(std::string mainlogfile)
    {
-      if (!mCurrentStream.is_open())
-         mCurrentStream.open(mainlogfile, std::ios_base::app);
-      if (!mCurrentStream.is_open())
+      if (mFile != NULL && !_isCurrent(mainlogfile))
+         Close();
+
+      if (mFile == NULL)
+      {
+         mFile = fopen(mainlogfile.c_str(), "ab");
+         if (mFile != NULL)
+         {
+            struct stat st;
+            mSize = (fstat(fileno(mFile), &st) == 0 ? (size_t)st.st_size : 0);
+         }
+      }
+      if (mFile == NULL)
       {
          if (!mLogFailedMsgSent)
          {
@@ -59,69 +78,451 @@ public:
       return true;
    }
 
-   bool PastLimit(std::string s)
+   bool PastLimit(const std::string & s)
    {
-      return static_cast<std::string::size_type>(mCurrentStream.tellp()) + s.length() > mLimit;
+      return mSize > 0 && mSize + s.length() > mLimit;
    }
 
    void Close()
    {
-      mCurrentStream.close();
+      if (mFile != NULL)
+         fclose(mFile);
+      mFile = NULL;
    }
 
-   void Append(std::string s)
+   void Append(const std::string & s)
    {
-      mCurrentStream << s;
+      fwrite(s.data(), 1, s.length(), mFile);
+      mSize += s.length();
    }
 
+   void Flush()
+   {
+      if (mFile != NULL)
+         fflush(mFile);
+   }
+
+   // where the file ends, after a Flush. Appends by other drunners are included.
+   uint64_t Tell()
+   {
+      long pos = ftell(mFile);
+      return (pos > 0 ? (uint64_t)pos : 0);
+   }
+
+   const std::string mFileName; // in the logs directory.
+   const bool mIndexed; // each block written gets a line in the sidecar index.
+
 private:
-   Poco::Path mMainlogFile;
-   std::ofstream mCurrentStream;
+   // true if our stream is still the file at path. Picks up the size other drunners have grown it to.
+   bool _isCurrent(const std::string & path)
+   {
+      struct stat named, ours;
+      if (stat(path.c_str(), &named) != 0 || fstat(fileno(mFile), &ours) != 0)
+         return false;
+#ifndef _WIN32 // no inode numbers, but nor can an open file be renamed.
+      if (named.st_dev != ours.st_dev || named.st_ino != ours.st_ino)
+         return false;
+#endif
+      mSize = (size_t)named.st_size;
+      return true;
+   }
+
+   FILE * mFile;
    bool mLogFailedMsgSent;
+   size_t mSize; // of the current log file.
    const size_t mLimit = 1024 * 1024 * 5;
 };
 
-FileStreamer g_FileStreamer;
+// The settings the logger itself uses. From the settings if something has loaded them, else
+// read straight from the settings file (once) - commands that never load the settings, like
+// a launch script's servicecmd, still honour them. The logger never loads the settings
+// itself, as they log as they load.
+class logconfig
+{
+public:
+   logconfig() : json(false), maxbytes(100 * 1024 * 1024), maxage(30) {}
 
+   bool json;
+   uint64_t maxbytes;
+   int maxage;
+};
 
-void FileRotationLogSink(std::string s)
+static logconfig _logconfig()
 {
-   Poco::Path mainlogfile = drunnerPaths::getPath_Logs().setFileName("log.txt");
+   logconfig c;
+   std::shared_ptr<const drunnerSettings> settings = GlobalContext::loadedSettings();
+   if (settings)
+   {
+      c.json = settings->getLogJSON();
+      c.maxbytes = settings->getLogMaxSize();
+      c.maxage = settings->getLogMaxAge();
+      return c;
+   }
+
+   static std::once_flag sOnce;
+   static logconfig sPeeked;
+   std::call_once(sOnce, []() {
+      keyVals kv;
+      if (!persistence::loadjson(drunnerPaths::getPath_drunnerSettings_json(), kv).success())
+         return; // the defaults.
+      if (kv.hasKey("LOGJSON"))
+         sPeeked.json = kv.getBool("LOGJSON");
+      if (kv.hasKey("LOGMAXSIZE"))
+         sPeeked.maxbytes = (uint64_t)std::max(0, atoi(kv.getVal("LOGMAXSIZE").c_str())) * 1024 * 1024;
+      if (kv.hasKey("LOGMAXAGE"))
+         sPeeked.maxage = std::max(0, atoi(kv.getVal("LOGMAXAGE").c_str()));
+   });
+   return sPeeked;
+}
+
+// Compresses rotated logs and enforces the archive limits, on its own thread so logging
+// never waits for it. Rotating again while it runs just has it go round once more.
+// logflush() waits for it. Nothing is started once exit() is destroying the statics it
+// would use, an archive rotated then is compressed at the next rotation.
+class logarchiver
+{
+public:
+   logarchiver() : mRunning(false), mAgain(false), mExiting(false) {}
+
+   ~logarchiver()
+   {
+      wait();
+   }
 
-   if (!g_FileStreamer.CheckLogFileOpen(mainlogfile.toString()))
+   void start()
+   {
+      logconfig c = _logconfig();
+      uint64_t maxbytes = c.maxbytes;
+      int maxage = c.maxage;
+
+      std::lock_guard<std::mutex> lock(mMutex);
+      if (mExiting)
+         return;
+      if (mRunning)
+      {
+         mAgain = true;
+         return;
+      }
+      if (mThread.joinable())
+         mThread.join();
+      mRunning = true;
+      mThread = std::thread([this, maxbytes, maxage]() {
+         Poco::Path logs = drunnerPaths::getPath_Logs();
+         std::unique_lock<std::mutex> lock(mMutex);
+         do
+         {
+            mAgain = false;
+            lock.unlock();
+            logarchive::tidy(logs, maxbytes, maxage);
+            lock.lock();
+         } while (mAgain);
+         mRunning = false;
+      });
+   }
+
+   void wait()
+   {
+      std::thread t;
+      {
+         std::lock_guard<std::mutex> lock(mMutex);
+         t.swap(mThread); // the thread needs the lock to finish.
+      }
+      if (t.joinable())
+         t.join();
+   }
+
+   void exiting()
+   {
+      {
+         std::lock_guard<std::mutex> lock(mMutex);
+         mExiting = true;
+      }
+      wait();
+   }
+
+private:
+   std::mutex mMutex;
+   std::thread mThread;
+   bool mRunning, mAgain, mExiting;
+};
+
+static logarchiver g_Archiver; // before the sink, which stops it as it's destroyed.
+
+FileStreamer g_FileStreamer("log.txt", true);
+FileStreamer g_JSONStreamer("log.jsonl", false); // one JSON object per logmsg, for log shippers (LOGJSON setting).
+
+
+// append s to the stream's log file, rotating it first if it's full. For an indexed
+// stream b describes s, and gets its offset filled in.
+// Concurrent drunners share the log file: appends take a shared lock on it and rotation an
+// exclusive one, so nothing is written to a file as it's rotated, nor indexed against the wrong one.
+void FileRotationLogSink(FileStreamer & fs, const std::string & s, logarchive::block * b = NULL)
+{
+   Poco::Path mainlogfile = drunnerPaths::getPath_Logs().setFileName(fs.mFileName);
+
+   if (!fs.CheckLogFileOpen(mainlogfile.toString()))
+      return; // can't log to file.
+
+   if (fs.PastLimit(s))
+   {
+      persistence::filelock lock(mainlogfile);
+      // another drunner may have rotated it while we waited.
+      if (fs.CheckLogFileOpen(mainlogfile.toString()) && fs.PastLimit(s))
+      {
+         fs.Close();
+
+         // names sort by time. Rotating twice in a second gives 2016_10_19__14_30_00_n2_log.txt, after the first.
+         std::string stamp = timeutils::getDateTimeStr();
+         Poco::Path archive = drunnerPaths::getPath_Logs().setFileName(stamp + "_" + fs.mFileName);
+         for (int n = 2; utils::fileexists(archive) || utils::fileexists(archive.toString() + ".gz"); ++n)
+            archive.setFileName(stamp + "_n" + std::to_string(n) + "_" + fs.mFileName);
+
+         if (0 != std::rename(mainlogfile.toString().c_str(), archive.toString().c_str()))
+         {
+            std::cerr << "Could not archive log file from" << std::endl << mainlogfile.toString() << std::endl << "to" << std::endl << archive.toString() << std::endl;
+            exit(1);
+         }
+         if (fs.mIndexed)
+            std::rename(logarchive::indexpath(mainlogfile).toString().c_str(), logarchive::indexpath(archive).toString().c_str());
+         g_Archiver.start();
+      }
+   }
+
+   persistence::filelock lock(mainlogfile, true);
+   if (!fs.CheckLogFileOpen(mainlogfile.toString()))
       return; // can't log to file.
 
-   if (g_FileStreamer.PastLimit(s))
+   fs.Append( s );
+
+   if (fs.mIndexed && b != NULL)
+   {
+      fs.Flush();
+      b->offset = fs.Tell() - s.length();
+      b->length = s.length();
+      logarchive::appendindex(mainlogfile, *b);
+   }
+}
+
+// ----------------------------------------------------------------------------------------------------
+
+// Log file writes are queued on a lock-free multi-producer queue and written in order, in
+// batches, by a background thread. It wakes every 100 ms, or straight away for warnings and
+// errors. logflush() writes everything queued on the calling thread, and is called before
+// eExit is thrown and when the sink is destroyed at exit. The console is still written
+// synchronously, so it stays in step with the output of the commands we run.
+// Each batch is written to log.txt as indexed blocks of up to ~64 KB, one service per block.
+class asyncfilesink
+{
+public:
+   asyncfilesink() : mHead(&mStub), mTail(&mStub), mRunning(false), mStop(false)
+   {
+      mStub.next = NULL;
+   }
+
+   ~asyncfilesink()
    {
-      g_FileStreamer.Close();
-      
-      Poco::Path archive = drunnerPaths::getPath_Logs().setFileName(timeutils::getDateTimeStr() + "_log.txt");
+      stop();
+      g_Archiver.exiting();
+      flush();
+   }
 
-      if (0 != std::rename(mainlogfile.toString().c_str(), archive.toString().c_str()))
+   void push(std::string text, std::string json, eLogLevel level, const std::string & service)
+   {
+      if (!mRunning.load(std::memory_order_acquire))
+         _start();
+
+      node * n = new node;
+      n->text.swap(text);
+      n->json.swap(json);
+      n->level = level;
+      n->when = time(NULL);
+      n->service = service;
+      _push(n);
+
+      if (level >= kLWARN)
+         mWake.notify_one();
+   }
+
+   // write everything queued so far. Only one thread drains at a time.
+   void flush()
+   {
+      std::lock_guard<std::recursive_mutex> lock(mDrainMutex);
+      std::vector<std::pair<logarchive::block, std::string> > blocks; // and their text.
+      std::string json;
+      while (true)
       {
-         std::cerr << "Could not archive log file from" << std::endl << mainlogfile.toString() << std::endl << "to" << std::endl << archive.toString() << std::endl;
-         exit(1);
+         node * n;
+         while ((n = _pop()) != NULL)
+         {
+            if (n->text.length() > 0)
+            {
+               if (blocks.size() == 0 || blocks.back().first.service != n->service || blocks.back().second.length() >= 64 * 1024)
+               {
+                  blocks.push_back(std::make_pair(logarchive::block(), std::string()));
+                  blocks.back().first.first = n->when;
+                  blocks.back().first.service = n->service;
+               }
+               logarchive::block & b(blocks.back().first);
+               b.last = n->when;
+               b.levels |= (1 << n->level);
+               blocks.back().second += n->text;
+            }
+            json += n->json;
+            delete n;
+         }
+         if (mTail == &mStub && mHead.load(std::memory_order_acquire) == &mStub)
+            break; // empty.
+         std::this_thread::yield(); // a producer is part way through a push.
+      }
+
+      for (auto & b : blocks)
+         FileRotationLogSink(g_FileStreamer, b.second, &b.first);
+      if (blocks.size() > 0)
+         g_FileStreamer.Flush();
+      if (json.length() > 0)
+      {
+         FileRotationLogSink(g_JSONStreamer, json);
+         g_JSONStreamer.Flush();
+      }
+   }
+
+   // stop the background thread, e.g. before fork(). The next push starts it again.
+   void stop()
+   {
+      std::lock_guard<std::mutex> lock(mStartMutex);
+      if (mRunning)
+      {
+         {
+            std::lock_guard<std::mutex> lock(mWakeMutex);
+            mStop = true;
+         }
+         mWake.notify_one();
+         mThread.join();
+         mStop = false;
+         mRunning = false;
+      }
+   }
+
+private:
+   class node
+   {
+   public:
+      std::atomic<node *> next;
+      std::string text, json;
+      eLogLevel level;
+      time_t when;
+      std::string service;
+   };
+
+   // Vyukov's intrusive MPSC queue: producers only swap the head, the consumer owns the tail.
+   void _push(node * n)
+   {
+      n->next.store(NULL, std::memory_order_relaxed);
+      node * prev = mHead.exchange(n, std::memory_order_acq_rel);
+      prev->next.store(n, std::memory_order_release);
+   }
+
+   node * _pop()
+   {
+      node * tail = mTail;
+      node * next = tail->next.load(std::memory_order_acquire);
+      if (tail == &mStub)
+      {
+         if (next == NULL)
+            return NULL;
+         mTail = next;
+         tail = next;
+         next = next->next.load(std::memory_order_acquire);
+      }
+      if (next != NULL)
+      {
+         mTail = next;
+         return tail;
+      }
+      if (tail != mHead.load(std::memory_order_acquire))
+         return NULL;
+      _push(&mStub);
+      next = tail->next.load(std::memory_order_acquire);
+      if (next != NULL)
+      {
+         mTail = next;
+         return tail;
+      }
+      return NULL;
+   }
+
+   void _start()
+   {
+      std::lock_guard<std::mutex> lock(mStartMutex);
+      if (!mRunning)
+      {
+         mThread = std::thread(&asyncfilesink::_run, this);
+         mRunning = true;
+      }
+   }
+
+   void _run()
+   {
+      std::unique_lock<std::mutex> lock(mWakeMutex);
+      while (!mStop)
+      {
+         mWake.wait_for(lock, std::chrono::milliseconds(100));
+         lock.unlock();
+         flush();
+         lock.lock();
       }
-      
-      // open new logfile
-      if (!g_FileStreamer.CheckLogFileOpen(mainlogfile.toString()))
-         return; // can't log to file.
    }
 
-   g_FileStreamer.Append( s );
+   std::atomic<node *> mHead;
+   node * mTail;
+   node mStub;
+
+   std::mutex mStartMutex;
+   std::atomic<bool> mRunning;
+   std::thread mThread;
+   std::mutex mWakeMutex;
+   std::condition_variable mWake;
+   bool mStop;
+   std::recursive_mutex mDrainMutex;
+};
+
+static asyncfilesink g_AsyncSink; // after the streamers, so destroyed (and flushed) first.
+
+void logflush()
+{
+   g_AsyncSink.flush();
+   g_Archiver.wait();
+   g_AsyncSink.flush(); // anything the archiver logged.
+}
+
+void logstop()
+{
+   logflush();
+   g_AsyncSink.stop();
+}
+
+void logreopen()
+{
+   g_FileStreamer.Close();
+   g_JSONStreamer.Close();
 }
 
+// set before any threads are started, so isn't locked.
+static std::string g_Service;
 
+void logservice(const std::string & servicename)
+{
+   g_Service = servicename;
+}
 
 eLogLevel getMinLevel()
 {
-   static bool hasWarned = false;
+   static std::atomic<bool> hasWarned(false);
 
    if (!GlobalContext::hasParams())
    {
-      if (!hasWarned)
+      if (!hasWarned.exchange(true))
       {
-         hasWarned = true;
          logmsg(kLWARN, "Logging not yet initialised, issue during initialisation.");
       }
       return kLINFO;
@@ -129,6 +530,11 @@ eLogLevel getMinLevel()
    return GlobalContext::getParams()->getLogLevel();
 }
 
+bool logenabled(eLogLevel level)
+{
+   return level >= getMinLevel();
+}
+
 std::string levelname(eLogLevel level)
 {
    switch (level)
@@ -141,48 +547,121 @@ std::string levelname(eLogLevel level)
    }
 }
 
-void logverbatim(eLogLevel level, std::string s)
+static bool _jsonEnabled()
 {
-   if (level < getMinLevel())
-      return;
+   return _logconfig().json;
+}
+
+static std::string _jsonescape(const std::string & s)
+{
+   std::string o;
+   o.reserve(s.length() + 8);
+   for (unsigned char c : s)
+      switch (c)
+      {
+      case '"': o += "\\\""; break;
+      case '\\': o += "\\\\"; break;
+      case '\n': o += "\\n"; break;
+      case '\r': break;
+      case '\t': o += "\\t"; break;
+      default:
+         if (c < 0x20)
+         {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            o += buf;
+         }
+         else
+            o += (char)c;
+      }
+   return o;
+}
 
-   FileRotationLogSink(s);
+// the log timestamps, formatted at most once a second per thread.
+class timestampcache
+{
+public:
+   timestampcache() : mSecond(0) {}
 
+   void refresh()
+   {
+      time_t now = time(NULL);
+      if (now == mSecond)
+         return;
+      mSecond = now;
+      Poco::LocalDateTime dt;
+      mHeader = Poco::DateTimeFormatter::format(dt, "%Y-%m-%d %H:%M");
+      mISO = Poco::DateTimeFormatter::format(dt, "%Y-%m-%dT%H:%M:%S%z");
+   }
+
+   time_t mSecond;
+   std::string mHeader, mISO;
+};
+static thread_local timestampcache t_Timestamps;
+
+// logging may come from worker threads (e.g. registry refreshes). Recursive as the sink can log.
+// Held only for the console write: nothing that waits on another thread (logflush) runs under
+// it, as those threads (the archiver, the file sink) log too.
+static std::recursive_mutex g_LogMutex;
+
+static void _log(eLogLevel level, std::string s, std::string json)
+{
+   g_AsyncSink.push(s, json, level, g_Service);
 
-   // we use stdout for normal messages, stderr for warn and error.
-   switch (level)
    {
-      case kLDEBUG: std::cout << termcolor::cyan << s << termcolor::reset; break;
-      case kLINFO:  std::cout << termcolor::blue << s << termcolor::reset; break;
+      std::lock_guard<std::recursive_mutex> lock(g_LogMutex);
+
+      // we use stdout for normal messages, stderr for warn and error.
+      switch (level)
+      {
+         case kLDEBUG: std::cout << termcolor::cyan << s << termcolor::reset; break;
+         case kLINFO:  std::cout << termcolor::blue << s << termcolor::reset; break;
 
 #ifdef _WIN32
-      case kLWARN:  std::cerr << termcolor::red <<  s << termcolor::reset; break;
+         case kLWARN:  std::cerr << termcolor::red <<  s << termcolor::reset; break;
 #else
-      case kLWARN:  std::cerr << termcolor::yellow << s << termcolor::reset; break;
+         case kLWARN:  std::cerr << termcolor::yellow << s << termcolor::reset; break;
 #endif
 
-         case kLERROR:
-            std::cerr << termcolor::red << s << termcolor::reset;
+         case kLERROR: std::cerr << termcolor::red << s << termcolor::reset; break;
+         default:      std::cerr << termcolor::green <<  s << termcolor::reset; break;
+      }
+   }
+
+   if (level == kLERROR)
+   {
+      logflush(); // nothing is lost on the way out.
 
 #ifdef _DEBUG
    #ifdef _WIN32
-            __debugbreak();
+      __debugbreak();
    #else
-            __builtin_trap();
+      __builtin_trap();
    #endif
 #endif
 
-         throw eExit();
-         break;
-      default:      std::cerr << termcolor::green <<  s << termcolor::reset; break;
+      throw eExit();
    }
 }
 
+void logverbatim(eLogLevel level, std::string s)
+{
+   if (level < getMinLevel())
+      return;
+   _log(level, s, "");
+}
+
 std::string getheader(eLogLevel level)
 {
-   std::ostringstream ost;
-   ost << "|" << levelname(level) << "|" << timeutils::getLogTimeStamp() << "| ";
-   return ost.str();
+   t_Timestamps.refresh();
+   std::string h;
+   h.reserve(32);
+   h += "|";
+   h += levelname(level);
+   h += "|";
+   h += t_Timestamps.mHeader;
+   h += "| ";
+   return h;
 }
 
 
@@ -191,12 +670,32 @@ void logmsg(eLogLevel level, std::string s)
    if (level < getMinLevel())
       return;
 
+   // header on every line, \r dropped, in one pass.
    std::string info = getheader(level);
-   std::string s2=utils::replacestring(s,"\n","\n"+info);
-   //boost::erase_all(s2, "\r");
-   s2.erase(std::remove(s2.begin(), s2.end(), '\r'), s2.end());
+   std::string s2;
+   s2.reserve(info.length() + s.length() + 1);
+   s2 += info;
+   size_t start = 0;
+   while (start < s.length())
+   {
+      size_t pos = s.find_first_of("\r\n", start);
+      if (pos == std::string::npos)
+      {
+         s2.append(s, start, std::string::npos);
+         break;
+      }
+      s2.append(s, start, pos - start);
+      if (s[pos] == '\n')
+         s2 += "\n" + info;
+      start = pos + 1;
+   }
+   s2 += "\n";
+
+   std::string json;
+   if (_jsonEnabled())
+      json = "{\"time\":\"" + t_Timestamps.mISO + "\",\"level\":\"" + Poco::trim(levelname(level)) + "\",\"msg\":\"" + _jsonescape(s) + "\"}\n";
 
-   logverbatim(level,info+s2+"\n");
+   _log(level, s2, json);
 }
 
 void logdbg(std::string s)
@@ -5,6 +5,11 @@
 #include "params.h"
 #include <string>
 #include <memory>
+#include <sstream>
+#include <cstring>
+#include <type_traits>
+
+#include <Poco/Path.h>
 
 void logmsg(eLogLevel level, std::string s);
 void logverbatim(eLogLevel level, std::string s);
@@ -14,5 +19,63 @@ void logdbg_trim(std::string s);
 void fatal(std::string s);
 
 std::string getheader(eLogLevel level);
+void logflush(); // write out anything queued for the log files, and finish compressing any rotated.
+void logstop(); // logflush, then stop the logger's thread until the next message (so the process can fork).
+void logreopen(); // in a forked child, after logstop: close the parent's log files so they're opened afresh.
+void logservice(const std::string & servicename); // what's logged from here on is for this service (drunner logs --service).
+bool logenabled(eLogLevel level); // false if a message at this level would be thrown away.
+
+// Logging that costs nothing when the level is filtered out, as the message isn't built:
+//    drunner_logmsg(kLDEBUG, "Deleted " + f.path());
+//    drunner_log(kLDEBUG, "Copied {} to {}", src, dest);  // {} count checked at compile time.
+#define drunner_logmsg(LEVEL,MESSAGE) (logenabled(LEVEL) ? logmsg(LEVEL, MESSAGE) : (void)0)
+#define drunner_log(LEVEL,FORMAT,...) do { \
+   static_assert(logformat::placeholders(FORMAT) == decltype(logformat::argcount(__VA_ARGS__))::value, \
+      "drunner_log: the number of {} in the format doesn't match the arguments."); \
+   if (logenabled(LEVEL)) logmsg(LEVEL, logformat::format(FORMAT, __VA_ARGS__)); } while (0)
+
+namespace logformat
+{
+   constexpr size_t placeholders(const char * s)
+   {
+      return *s == 0 ? 0 : (s[0] == '{' && s[1] == '}') ? 1 + placeholders(s + 2) : placeholders(s + 1);
+   }
+
+   template <class... T> std::integral_constant<size_t, sizeof...(T)> argcount(const T &...); // for decltype only.
+
+   inline void append(std::string & s, const std::string & a) { s += a; }
+   inline void append(std::string & s, const char * a) { s += a; }
+   inline void append(std::string & s, char a) { s += a; }
+   inline void append(std::string & s, const Poco::Path & a) { s += a.toString(); }
+   template <class T> typename std::enable_if<std::is_arithmetic<T>::value>::type append(std::string & s, T a) { s += std::to_string(a); }
+   template <class T> typename std::enable_if<!std::is_arithmetic<T>::value>::type append(std::string & s, const T & a)
+   {
+      std::ostringstream oss;
+      oss << a;
+      s += oss.str();
+   }
+
+   inline void formatinto(std::string & out, const char * fmt) { out += fmt; }
+   template <class T, class... R> void formatinto(std::string & out, const char * fmt, const T & a, const R &... rest)
+   {
+      const char * p = strstr(fmt, "{}");
+      if (p == NULL)
+      {
+         out += fmt;
+         return;
+      }
+      out.append(fmt, p - fmt);
+      append(out, a);
+      formatinto(out, p + 2, rest...);
+   }
+
+   // replaces each {} in fmt with the next argument.
+   template <class... T> std::string format(const char * fmt, const T &... args)
+   {
+      std::string s;
+      formatinto(s, fmt, args...);
+      return s;
+   }
+}
 
 #endif
@@ -0,0 +1,476 @@
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <map>
+#include <cstdio>
+
+#include <Poco/File.h>
+#include <Poco/String.h>
+#include <Poco/DirectoryIterator.h>
+#include <Poco/DeflatingStream.h>
+#include <Poco/InflatingStream.h>
+#include <Poco/StreamCopier.h>
+
+#include "logarchive.h"
+#include "persistence.h"
+#include "globallogger.h"
+#include "globalcontext.h"
+#include "drunner_paths.h"
+#include "params.h"
+
+namespace logarchive
+{
+   static const uint64_t kMemberSize = 64 * 1024; // uncompressed bytes per gzip member, about.
+   static const std::string kLogName = "log.txt";
+
+   static bool _endswith(const std::string & s, const std::string & end)
+   {
+      return s.length() >= end.length() && s.compare(s.length() - end.length(), end.length(), end) == 0;
+   }
+
+   // a rotated log, e.g. 2016_10_19__14_30_00_log.txt (or log.jsonl), not yet compressed.
+   static bool _isarchive(const std::string & name)
+   {
+      return (_endswith(name, "_log.txt") || _endswith(name, "_log.jsonl"));
+   }
+
+   static std::string _gzip(const char * p, size_t n)
+   {
+      std::ostringstream oss;
+      Poco::DeflatingOutputStream z(oss, Poco::DeflatingStreamBuf::STREAM_GZIP);
+      z.write(p, n);
+      z.close();
+      return oss.str();
+   }
+
+   // written to a temporary file and renamed into place.
+   static cResult _writefile(const Poco::Path & path, const std::string & contents)
+   {
+      std::string tmp = path.toString() + ".tmp";
+      {
+         std::ofstream os(tmp, std::ios_base::binary | std::ios_base::trunc);
+         if (!os.write(contents.data(), contents.length()))
+            return cError("Couldn't write " + tmp);
+      }
+      if (0 != std::rename(tmp.c_str(), path.toString().c_str()))
+         return cError("Couldn't rename " + tmp + " to " + path.toString());
+      return kRSuccess;
+   }
+
+   static bool _gunzip(const std::string & member, std::string & out)
+   {
+      out.clear();
+      try
+      {
+         std::istringstream iss(member);
+         Poco::InflatingInputStream z(iss, Poco::InflatingStreamBuf::STREAM_GZIP);
+         Poco::StreamCopier::copyToString(z, out);
+      }
+      catch (const Poco::Exception &)
+      {
+         return false;
+      }
+      return true;
+   }
+
+   // -------------------------------------------------------------------------------
+
+   std::string block::line() const
+   {
+      std::ostringstream oss;
+      oss << (long long)first << "\t" << (long long)last << "\t" << levels << "\t" << offset << "\t" << length
+         << "\t" << zoffset << "\t" << zlength << "\t" << service;
+      return oss.str();
+   }
+
+   bool block::parse(const std::string & line, block & b)
+   {
+      std::istringstream iss(line);
+      long long first, last;
+      if (!(iss >> first >> last >> b.levels >> b.offset >> b.length >> b.zoffset >> b.zlength))
+         return false;
+      b.first = (time_t)first;
+      b.last = (time_t)last;
+      b.service.clear();
+      if (iss.get() == '\t')
+         std::getline(iss, b.service);
+      return true;
+   }
+
+   Poco::Path indexpath(const Poco::Path & logfile)
+   {
+      return Poco::Path(logfile).setFileName(logfile.getFileName() + ".idx");
+   }
+
+   void appendindex(const Poco::Path & logfile, const block & b)
+   {
+      std::ofstream os(indexpath(logfile).toString(), std::ios_base::app);
+      os << b.line() + "\n"; // one write, so lines from concurrent drunners don't interleave.
+   }
+
+   std::vector<block> readindex(const Poco::Path & logfile)
+   {
+      std::vector<block> blocks;
+      std::ifstream is(indexpath(logfile).toString());
+      std::string line;
+      block b;
+      while (std::getline(is, line))
+         if (block::parse(line, b))
+            blocks.push_back(b);
+      return blocks;
+   }
+
+   // -------------------------------------------------------------------------------
+
+   cResult compress(const Poco::Path & logfile)
+   {
+      std::string text;
+      {
+         std::ifstream is(logfile.toString(), std::ios_base::binary);
+         if (!is)
+            return cError("Couldn't open " + logfile.toString());
+         std::ostringstream oss;
+         oss << is.rdbuf();
+         text = oss.str();
+      }
+      if (text.length() == 0)
+      {
+         try
+         {
+            Poco::File(logfile).remove();
+         }
+         catch (const Poco::Exception &) {}
+         return kRNoChange;
+      }
+
+      // the blocks in file order, dropping any that don't fit (e.g. from a crashed write).
+      std::vector<block> blocks = readindex(logfile), valid;
+      std::sort(blocks.begin(), blocks.end(), [](const block & a, const block & b) { return a.offset < b.offset; });
+      uint64_t prevend = 0;
+      for (const auto & b : blocks)
+         if (b.offset >= prevend && b.offset + b.length <= text.length())
+         {
+            valid.push_back(b);
+            prevend = b.offset + b.length;
+         }
+
+      // members end at a block boundary once they're big enough, so no block spans two.
+      std::string gz;
+      std::vector<block> zblocks;
+      size_t bi = 0;
+      uint64_t start = 0;
+      while (start < text.length())
+      {
+         uint64_t end = std::min<uint64_t>(start + kMemberSize, text.length());
+         size_t bj = bi;
+         while (bj < valid.size() && valid[bj].offset < end)
+            ++bj;
+         if (bj > bi)
+            end = std::max(end, valid[bj - 1].offset + valid[bj - 1].length);
+
+         std::string member = _gzip(text.data() + start, (size_t)(end - start));
+         for (; bi < bj; ++bi)
+         {
+            block b(valid[bi]);
+            b.offset -= start;
+            b.zoffset = gz.length();
+            b.zlength = member.length();
+            zblocks.push_back(b);
+         }
+         gz += member;
+         start = end;
+      }
+
+      Poco::Path gzpath(logfile);
+      gzpath.setFileName(logfile.getFileName() + ".gz");
+      cResult r = _writefile(gzpath, gz);
+      if (r.error())
+         return r;
+      if (zblocks.size() > 0)
+      {
+         std::string idx;
+         for (const auto & b : zblocks)
+            idx += b.line() + "\n";
+         r = _writefile(indexpath(gzpath), idx);
+         if (r.error())
+            return r;
+      }
+
+      try
+      {
+         Poco::File(logfile).remove();
+         Poco::File idx(indexpath(logfile));
+         if (idx.exists())
+            idx.remove();
+      }
+      catch (const Poco::Exception & e)
+      {
+         return cError("Couldn't remove " + logfile.toString() + ": " + e.displayText());
+      }
+
+      drunner_log(kLDEBUG, "Compressed {} from {} to {} bytes.", logfile.getFileName(), text.length(), gz.length());
+      return kRSuccess;
+   }
+
+   void tidy(const Poco::Path & logsdir, uint64_t maxbytes, int maxagedays)
+   {
+      persistence::filelock lock(Poco::Path(logsdir).setFileName("archive"));
+
+      class archive
+      {
+      public:
+         archive() : bytes(0), modified(0) {}
+         uint64_t bytes;
+         time_t modified;
+         std::vector<std::string> files;
+      };
+      std::map<std::string, archive> archives; // by uncompressed name, so oldest first.
+
+      try
+      {
+         std::vector<std::string> uncompressed;
+         for (Poco::DirectoryIterator it(logsdir), end; it != end; ++it)
+            if (it->isFile() && _isarchive(it.name()))
+               uncompressed.push_back(it.path().toString());
+         for (const auto & f : uncompressed)
+         {
+            cResult r = compress(Poco::Path(f));
+            if (r.error())
+               logmsg(kLWARN, "Couldn't compress log archive: " + r.what());
+         }
+
+         for (Poco::DirectoryIterator it(logsdir), end; it != end; ++it)
+         {
+            std::string base = it.name();
+            if (_endswith(base, ".idx"))
+               base.erase(base.length() - 4);
+            if (_endswith(base, ".gz"))
+               base.erase(base.length() - 3);
+            if (!it->isFile() || !_isarchive(base))
+               continue;
+
+            archive & a(archives[base]);
+            a.bytes += it->getSize();
+            a.modified = std::max<time_t>(a.modified, it->getLastModified().epochTime());
+            a.files.push_back(it.path().toString());
+         }
+      }
+      catch (const Poco::Exception & e)
+      {
+         logmsg(kLWARN, "Couldn't tidy the logs directory: " + e.displayText());
+         return;
+      }
+
+      uint64_t total = 0;
+      for (const auto & a : archives)
+         total += a.second.bytes;
+
+      time_t oldest = time(NULL) - (time_t)maxagedays * 24 * 3600;
+      for (const auto & a : archives)
+      {
+         bool old = (maxagedays > 0 && a.second.modified < oldest);
+         if (!old && (maxbytes == 0 || total <= maxbytes))
+            continue;
+
+         try
+         {
+            for (const auto & f : a.second.files)
+               Poco::File(f).remove();
+            total -= a.second.bytes;
+            drunner_log(kLDEBUG, "Deleted log archive {}", a.first);
+         }
+         catch (const Poco::Exception & e)
+         {
+            logmsg(kLWARN, "Couldn't delete log archive " + a.first + ": " + e.displayText());
+         }
+      }
+   }
+
+   // -------------------------------------------------------------------------------
+
+   static std::string _minute(time_t t)
+   {
+      char buf[32];
+      struct tm tm;
+#ifdef _WIN32
+      localtime_s(&tm, &t);
+#else
+      localtime_r(&t, &tm);
+#endif
+      strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", &tm);
+      return buf;
+   }
+
+   // lines look like |WARN |2016-10-19 14:30| message
+   static void _showlines(const std::string & text, const query & q, const std::string & since, std::ostream & os)
+   {
+      size_t start = 0;
+      while (start < text.length())
+      {
+         size_t nl = text.find('\n', start);
+         if (nl == std::string::npos)
+            nl = text.length();
+
+         const char * line = text.data() + start;
+         size_t len = nl - start;
+         bool show = true;
+         if (len >= 24 && line[0] == '|' && line[6] == '|' && line[23] == '|')
+         {
+            eLogLevel level = kLINFO;
+            switch (line[1])
+            {
+            case 'D': level = kLDEBUG; break;
+            case 'W': level = kLWARN; break;
+            case 'E': level = kLERROR; break;
+            default: break;
+            }
+            show = (level >= q.level && (since.length() == 0 || text.compare(start + 7, 16, since) >= 0));
+         }
+         if (show)
+         {
+            os.write(line, len);
+            os << "\n";
+         }
+         start = nl + 1;
+      }
+   }
+
+   static cResult _show(const Poco::Path & logfile, const query & q, std::ostream & os)
+   {
+      std::string since = (q.since > 0 ? _minute(q.since) : "");
+      std::ifstream is(logfile.toString(), std::ios_base::binary);
+      if (!is)
+         return kRNoChange;
+
+      std::vector<block> blocks = readindex(logfile);
+      if (blocks.size() == 0)
+      { // written before there were indexes: no services, and a compressed one can't be read in parts.
+         if (q.service.length() > 0 || _endswith(logfile.getFileName(), ".gz"))
+            return kRNoChange;
+         std::ostringstream oss;
+         oss << is.rdbuf();
+         _showlines(oss.str(), q, since, os);
+         return kRSuccess;
+      }
+
+      std::string text, member;
+      uint64_t memberat = (uint64_t)-1;
+      for (const auto & b : blocks)
+      {
+         if (b.last < q.since || !b.haslevel(q.level))
+            continue;
+         if (q.service.length() > 0 && Poco::icompare(b.service, q.service) != 0)
+            continue;
+
+         if (b.zlength > 0)
+         {
+            if (memberat != b.zoffset)
+            {
+               std::string z((size_t)b.zlength, '\0');
+               is.clear();
+               is.seekg((std::streamoff)b.zoffset);
+               if (!is.read(&z[0], z.length()) || !_gunzip(z, member))
+                  return cError("Corrupt log archive " + logfile.toString());
+               memberat = b.zoffset;
+            }
+            if (b.offset + b.length > member.length())
+               continue;
+            text.assign(member, (size_t)b.offset, (size_t)b.length);
+         }
+         else
+         {
+            text.resize((size_t)b.length);
+            is.clear();
+            is.seekg((std::streamoff)b.offset);
+            if (!is.read(&text[0], text.length()))
+               continue; // the index got ahead of the log, e.g. a crash.
+         }
+         _showlines(text, q, since, os);
+      }
+      return kRSuccess;
+   }
+
+   cResult show(const Poco::Path & logsdir, const query & q, std::ostream & os)
+   {
+      std::vector<std::string> names;
+      try
+      {
+         for (Poco::DirectoryIterator it(logsdir), end; it != end; ++it)
+            if (_endswith(it.name(), "_log.txt") || _endswith(it.name(), "_log.txt.gz"))
+               names.push_back(it.name());
+      }
+      catch (const Poco::Exception & e)
+      {
+         return cError("Couldn't read the logs directory: " + e.displayText());
+      }
+
+      // archives are named by time, then the current log. Part way through being compressed
+      // an archive has both forms, the uncompressed one is complete.
+      std::sort(names.begin(), names.end());
+      names.erase(std::remove_if(names.begin(), names.end(), [&names](const std::string & n) {
+         return _endswith(n, ".gz") && std::binary_search(names.begin(), names.end(), n.substr(0, n.length() - 3));
+      }), names.end());
+      names.push_back(kLogName);
+
+      cResult rval = kRNoChange;
+      for (const auto & n : names)
+         rval += _show(Poco::Path(logsdir).setFileName(n), q, os);
+      return rval;
+   }
+
+   bool parsesince(const std::string & s, time_t & t)
+   {
+      int n = 0;
+      char unit = 0, extra = 0;
+      if (sscanf(s.c_str(), "%d%c%c", &n, &unit, &extra) == 2 && n >= 0)
+      {
+         time_t secs = 0;
+         switch (tolower(unit))
+         {
+         case 'm': secs = 60; break;
+         case 'h': secs = 3600; break;
+         case 'd': secs = 24 * 3600; break;
+         case 'w': secs = 7 * 24 * 3600; break;
+         default: return false;
+         }
+         t = time(NULL) - n * secs;
+         return true;
+      }
+
+      struct tm tm = {};
+      int count = sscanf(s.c_str(), "%d-%d-%d %d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min);
+      if (count != 3 && count != 5)
+         return false;
+      tm.tm_year -= 1900;
+      tm.tm_mon -= 1;
+      tm.tm_isdst = -1; // local time, as logged.
+      t = mktime(&tm);
+      return t != (time_t)-1;
+   }
+
+   cResult logscommand()
+   {
+      const params & p(*GlobalContext::getParams());
+      query q;
+
+      if (p.isFlagSet("since") && !parsesince(p.getFlag("since"), q.since))
+         return cError("Couldn't understand --since " + p.getFlag("since") + ", try e.g. 2h, 7d or \"2016-10-19 14:30\".");
+
+      if (p.isFlagSet("level"))
+      {
+         std::string l = Poco::toLower(p.getFlag("level"));
+         if (l == "debug") q.level = kLDEBUG;
+         else if (l == "info") q.level = kLINFO;
+         else if (l == "warn" || l == "warning") q.level = kLWARN;
+         else if (l == "error") q.level = kLERROR;
+         else
+            return cError("Unknown --level " + l + ", use debug, info, warn or error.");
+      }
+
+      q.service = p.getFlag("service");
+
+      logflush(); // so this drunner's messages so far are in the file.
+      return show(drunnerPaths::getPath_Logs(), q, std::cout);
+   }
+
+} // namespace
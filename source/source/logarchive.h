@@ -0,0 +1,75 @@
+#ifndef __LOGARCHIVE_H
+#define __LOGARCHIVE_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <ctime>
+#include <cstdint>
+
+#include <Poco/Path.h>
+
+#include "enums.h"
+#include "cresult.h"
+
+// The log file's sidecar time index, archive compression and clean up, and drunner logs.
+//
+// Each block the logger writes to log.txt gets a line in log.txt.idx: its time range,
+// the levels in it, the service being worked on and where it is in the file. When log.txt
+// is rotated the pair is renamed with a timestamp and then, in the background, gzipped as
+// a series of independent gzip members of ~64 KB (so zcat still reads it) with the index
+// rewritten to point at them. Archives past the LOGMAXAGE and LOGMAXSIZE settings are
+// deleted, oldest first. drunner logs uses the indexes to read only the blocks it needs.
+namespace logarchive
+{
+   class block
+   {
+   public:
+      block() : first(0), last(0), levels(0), offset(0), length(0), zoffset(0), zlength(0) {}
+
+      bool haslevel(eLogLevel minlevel) const { return (levels >> minlevel) != 0; }
+      std::string line() const; // as stored in the index.
+      static bool parse(const std::string & line, block & b);
+
+      time_t first, last;  // when the first and last messages were logged.
+      int levels;          // bit (1 << level) for each eLogLevel in the block.
+      uint64_t offset, length; // of the text, in the log (or in its gzip member).
+      uint64_t zoffset, zlength; // the gzip member holding the text, zlength 0 if not compressed.
+      std::string service; // service the command was for, empty for none.
+   };
+
+   // the index for a log file, e.g. log.txt.idx.
+   Poco::Path indexpath(const Poco::Path & logfile);
+
+   void appendindex(const Poco::Path & logfile, const block & b);
+   std::vector<block> readindex(const Poco::Path & logfile);
+
+   // gzip logfile (and its index) to logfile.gz, removing the original.
+   cResult compress(const Poco::Path & logfile);
+
+   // compress the archives in the logs directory that aren't yet, then delete archives
+   // older than maxagedays and the oldest until the total is under maxbytes (0 for no limit).
+   void tidy(const Poco::Path & logsdir, uint64_t maxbytes, int maxagedays);
+
+   class query
+   {
+   public:
+      query() : since(0), level(kLDEBUG) {}
+
+      time_t since;
+      eLogLevel level;     // and above.
+      std::string service; // empty for all.
+   };
+
+   // write the lines of log.txt and its archives that match q, oldest first.
+   cResult show(const Poco::Path & logsdir, const query & q, std::ostream & os);
+
+   // parse --since: 2016-10-19, "2016-10-19 14:30" or an age such as 30m, 12h, 7d.
+   bool parsesince(const std::string & s, time_t & t);
+
+   // drunner logs [--since T] [--level L] [--service S]
+   cResult logscommand();
+
+} // namespace
+
+#endif
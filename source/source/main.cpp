@@ -23,50 +23,63 @@
 #include "sourcecopy.h"
 #include "registries.h"
 #include "proxy.h"
+#include "persistence.h"
+#include "logarchive.h"
 
 // ----------------------------------------------------------------------------------------------------------------------
 
 int main(int argc, char **argv)
+{
+   if (argc > 1 && 0==Poco::icompare(std::string(argv[1]), "debug"))
+   {
+      std::vector<std::string> args = { "drunner", "-v","-p","initialise" };
+      
+      //std::vector<std::string> args = { "drunner", "-v","list","all"};
+  ///    std::vector<std::string> args = { "drunner", "-v","install","rocketchat","ff"};
+    //        std::vector<std::string> args = { "drunner", "-v","obliterate","ff" };
+      //         std::vector<std::string> args = { "drunner", "-v","install","rocketchat" };
+      //         std::vector<std::string> args = { "drunner", "-v","__plugin__dbackup","run" };
+//         std::vector<std::string> args = { "drunner", "-v","unittest" };
+
+      return mainroutines::run(args, true);
+   }
+
+   return mainroutines::run(std::vector<std::string>(argv, argv + argc), false);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------
+
+int mainroutines::run(const std::vector<std::string> & args, bool forcereturn)
 {
    // try to create logging directory...
    if (!utils::fileexists(drunnerPaths::getPath_Logs()))
       Poco::File(drunnerPaths::getPath_Logs()).createDirectories();
 
-
-   bool forcereturn = false;
-
    try
    {
-      if (argc > 1 && 0==Poco::icompare(std::string(argv[1]), "debug"))
-      {
-         forcereturn = true;
-         std::vector<std::string> args = { "drunner", "-v","-p","initialise" };
-         
-         //std::vector<std::string> args = { "drunner", "-v","list","all"};
-     ///    std::vector<std::string> args = { "drunner", "-v","install","rocketchat","ff"};
-       //        std::vector<std::string> args = { "drunner", "-v","obliterate","ff" };
-         //         std::vector<std::string> args = { "drunner", "-v","install","rocketchat" };
-         //         std::vector<std::string> args = { "drunner", "-v","__plugin__dbackup","run" };
-//         std::vector<std::string> args = { "drunner", "-v","unittest" };
-
-         GlobalContext::init(args);
-      }
-      else
-         GlobalContext::init(argc, argv);
+      GlobalContext::init(args);
 
       logmsg(kLDEBUG,"dRunner C++ "+GlobalContext::getParams()->getVersion());
 
       cResult rval = mainroutines::process();
+      cResult saved = persistence::flush(); // settings changes are written once, here.
+      if (saved.error() && !rval.error())
+         rval = saved;
       if (rval.error())
       {
          logdbg("Error context: "+rval.context());
          fatal(rval.what());
       }
+      logflush();
       mainroutines::waitforreturn(forcereturn);
       return rval;
    }
 
    catch (const eExit & e) {
+      cResult r = persistence::flush();
+      if (r.error())
+         std::cerr << "Couldn't write settings: " << r.what() << std::endl;
+      logflush();
       mainroutines::waitforreturn(forcereturn);
       return e.exitCode();
    }
@@ -77,6 +90,21 @@ int main(int argc, char **argv)
 cResult mainroutines::process()
 {
    const params & p(*GlobalContext::getParams());
+
+   // tag what's logged with the service it's for, for drunner logs --service.
+   switch (p.getCommand())
+   {
+      case c_servicecmd: case c_update: case c_uninstall: case c_obliterate: case c_backup:
+         if (p.numArgs() > 0)
+            logservice(p.getArg(0));
+         break;
+      case c_install: case c_restore:
+         if (p.numArgs() > 1)
+            logservice(p.getArg(1));
+         break;
+      default:
+         break;
+   }
    
    if ((p.getCommand() == c_initialise) || (!utils::fileexists(drunnerPaths::getPath_Root())))
    {
@@ -87,9 +115,8 @@ cResult mainroutines::process()
    // allow unit tests to be run directly from installer.
    if (p.getCommand()==c_unittest)
    {
-      // todo: pass args through to catch.
-      // int result = Catch::Session().run( argc, argv );
-      int result = UnitTest();
+      // args are passed through to catch.
+      int result = UnitTest(p.getArgs());
       if (result!=0)
          logmsg(kLERROR,"Unit tests failed.");
       logmsg(kLINFO,"All unit tests passed.");
@@ -127,25 +154,33 @@ cResult mainroutines::process()
          break;
       }
 
+      case c_search:
+      {
+         if (p.numArgs() < 1)
+            logmsg(kLERROR, "Usage: drunner search TERM");
+         std::string term;
+         for (const auto & a : p.getArgs())
+            term += (term.length() > 0 ? " " : "") + a;
+         registries r;
+         return r.search(term);
+      }
+
+      case c_logs:
+      {
+         return logarchive::logscommand();
+      }
+
       case c_update:
       {
          if (p.numArgs() < 1)
             return drunnerSetup::update_drunner();
          else
-            return service_manage::update(p.getArg(0));
+            return service_manage::update(p.getArg(0), p.isFlagSet("force"));
       }
 
       case c_updateall:
       {
-         std::vector<std::string> vecstr;
-         utils::getAllServices(vecstr);
-         cResult r;
-         for (const auto & x : vecstr)
-         {
-            logmsg(kLINFO, "----- UPDATING " + x + " -----");
-            r += service_manage::update(x);
-         }
-         return r;
+         return service_manage::updateall(p.isFlagSet("force"));
       }
 
       case c_install:
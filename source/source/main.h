@@ -1,11 +1,15 @@
 #ifndef __MAIN_H
 #define __MAIN_H
 
+#include <string>
+#include <vector>
+
 #include "cresult.h"
 
 namespace mainroutines
 {
 
+   int run(const std::vector<std::string> & args, bool forcereturn); // the whole command, returning the exit code.
    cResult process();
    void waitforreturn(bool force);
 
@@ -15,6 +15,7 @@
 #include "exceptions.h"
 #include "drunner_paths.h"
 #include "dassert.h"
+#include "substitution.h"
 
 // Parse command line parameters.
 params::params(int argc, char * const * argv) :
@@ -34,7 +35,9 @@ params::params(int argc, char * const * argv) :
    {"configure",c_configure},
    {"servicecmd",c_servicecmd},
    {"registry",c_registry},
-   {"proxy",c_proxy}
+   {"proxy",c_proxy},
+   {"search",c_search},
+   {"logs",c_logs}
    })
 {
    _setdefaults();
@@ -43,10 +46,12 @@ params::params(int argc, char * const * argv) :
 
 std::string params::substitute( const std::string & source ) const
 {
-   std::string d(source);
-   d=utils::replacestring(d,"${VERSION}",mVersion);
-   d=utils::replacestring(d,"${EXENAME}","drunner");
-   return d;
+   const std::string exename = "drunner";
+   return substitution::substitute(source, [&](const std::string & name) -> const std::string * {
+      if (name == "VERSION") return &mVersion;
+      if (name == "EXENAME") return &exename;
+      return NULL;
+   });
 }
 
 bool params::isdrunnerCommand(std::string c) const
@@ -54,6 +59,12 @@ bool params::isdrunnerCommand(std::string c) const
    return (getdrunnerCommand(c) != c_UNDEFINED);
 }
 
+std::string params::getFlag(std::string flag) const
+{
+   auto it = mFlags.find(flag);
+   return (it == mFlags.end()) ? "" : it->second;
+}
+
 bool params::isHook(std::string c) const
 {
    size_t pos = c.find_last_of('_');
@@ -112,6 +123,16 @@ while (1)
             {"developer",0,0,'d'},
             {"pause",0,0,'p'},
 //            {"create", 1, 0, 'c'},
+
+            // command specific flags (not passed on to child drunner calls).
+            {"gitcache",0,0,0},
+            {"force",0,0,0},
+            {"noproxyreload",0,0,0},
+            {"since",1,0,0},
+            {"level",1,0,0},
+            {"service",1,0,0},
+            {"status",0,0,0},
+            {"json",0,0,0},
             {0, 0, 0, 0}
          };
 
@@ -126,6 +147,10 @@ while (1)
 
       switch (c)
       {
+         case 0:
+            mFlags[long_options[option_index].name] = (optarg != NULL) ? optarg : "";
+            break;
+
          case 's':
             mLogLevel=kLERROR;
             mServiceOutput_supportcalls = false;
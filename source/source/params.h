@@ -29,6 +29,10 @@ public:
    void setDevelopmentMode(bool dev) const { mDevelopmentMode = dev; }
    bool doPause() const { return mPause; }
 
+   // command specific long options, e.g. drunner clean --gitcache.
+   bool isFlagSet(std::string flag) const { return mFlags.find(flag) != mFlags.end(); }
+   std::string getFlag(std::string flag) const; // the flag's value, e.g. drunner logs --since 2h.
+
    bool isdrunnerCommand(std::string c) const;
    bool isHook(std::string c) const;
    eCommand getdrunnerCommand(std::string c) const;
@@ -46,6 +50,7 @@ private:
    bool mServiceOutput_servicecmd;
 
    std::vector<std::string> mOptions;
+   std::map<std::string, std::string> mFlags;
    params();
    void _setdefaults();
    void _parse(int argc, char * const * argv);
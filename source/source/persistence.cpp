@@ -0,0 +1,339 @@
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#endif
+
+#include <Poco/File.h>
+
+#include "persistence.h"
+#include "globallogger.h"
+
+namespace persistence
+{
+   static std::mutex sMutex;
+   static std::map<std::string, std::string> sPending;  // path -> contents to write.
+
+   // what we know is on disk: trusted only while the file's mtime and size are as they were.
+   struct ondisk
+   {
+      uint64_t hash;
+      int64_t mtime; // ns
+      int64_t size;
+   };
+   static std::map<std::string, ondisk> sOnDisk; // path -> ondisk.
+
+   // FNV-1a. Only compared within one run.
+   static uint64_t _hash(const std::string & s)
+   {
+      uint64_t h = 14695981039346656037ULL;
+      for (unsigned char c : s)
+      {
+         h ^= c;
+         h *= 1099511628211ULL;
+      }
+      return h;
+   }
+
+   static bool _readfile(const std::string & path, std::string & contents)
+   {
+      std::ifstream is(path, std::ios::in | std::ios::binary);
+      if (!is.is_open())
+         return false;
+      std::ostringstream oss;
+      oss << is.rdbuf();
+      contents = oss.str();
+      return !is.bad();
+   }
+
+   static bool _stat(const std::string & path, ondisk & od)
+   {
+#ifdef _WIN32
+      struct _stat64 st;
+      if (_stat64(path.c_str(), &st) != 0)
+         return false;
+      od.mtime = (int64_t)st.st_mtime * 1000000000;
+#else
+      struct stat st;
+      if (stat(path.c_str(), &st) != 0)
+         return false;
+      od.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+      od.size = (int64_t)st.st_size;
+      return true;
+   }
+
+   // remember path holds contents, as of now.
+   static void _ondisk(const std::string & path, const std::string & contents)
+   {
+      ondisk od;
+      od.hash = _hash(contents);
+      if (_stat(path, od))
+         sOnDisk[path] = od;
+      else
+         sOnDisk.erase(path);
+   }
+
+   static std::string _errstr()
+   {
+      return std::string(strerror(errno));
+   }
+
+   // -------------------------------------------------------------------------------
+
+#ifdef _WIN32
+   static cResult _replace(const std::string & tmp, const std::string & path)
+   {
+      if (!MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+         return cError("Unable to rename " + tmp + " to " + path);
+      return kRSuccess;
+   }
+#else
+   static cResult _replace(const std::string & tmp, const std::string & path)
+   {
+      if (rename(tmp.c_str(), path.c_str()) != 0)
+         return cError("Unable to rename " + tmp + " to " + path + ": " + _errstr());
+
+      // sync the directory so the rename itself survives a crash.
+      std::string dir = Poco::Path(path).parent().toString();
+      int dfd = open(dir.c_str(), O_RDONLY);
+      if (dfd >= 0)
+      {
+         fsync(dfd);
+         close(dfd);
+      }
+      return kRSuccess;
+   }
+#endif
+
+   static cResult _writeatomic(const std::string & path, const std::string & contents)
+   {
+      std::string tmp = path + ".tmp";
+#ifndef _WIN32
+      tmp += std::to_string(getpid());
+#endif
+
+      FILE * f = fopen(tmp.c_str(), "wb");
+      if (f == NULL)
+         return cError("Unable to open " + tmp + " for writing: " + _errstr());
+
+      bool ok = (fwrite(contents.data(), 1, contents.length(), f) == contents.length());
+      ok = ok && (fflush(f) == 0);
+#ifdef _WIN32
+      ok = ok && (_commit(_fileno(f)) == 0);
+#else
+      struct stat st;
+      if (ok && stat(path.c_str(), &st) == 0)
+         fchmod(fileno(f), st.st_mode & 07777); // keep the permissions of the file we replace.
+      ok = ok && (fsync(fileno(f)) == 0);
+#endif
+      ok = (fclose(f) == 0) && ok;
+
+      if (!ok)
+      {
+         std::string err = _errstr();
+         remove(tmp.c_str());
+         return cError("Unable to write " + tmp + ": " + err);
+      }
+
+      cResult r = _replace(tmp, path);
+      if (r.error())
+         remove(tmp.c_str());
+      return r;
+   }
+
+   // caller holds sMutex.
+   static cResult _write(const std::string & path, const std::string & contents)
+   {
+      uint64_t h = _hash(contents);
+
+      // another process may have changed the file since we saw it.
+      ondisk now;
+      bool exists = _stat(path, now);
+      auto it = sOnDisk.find(path);
+      if (it != sOnDisk.end() && (!exists || it->second.mtime != now.mtime || it->second.size != now.size))
+      {
+         sOnDisk.erase(it);
+         it = sOnDisk.end();
+      }
+      if (it == sOnDisk.end() && exists)
+      {
+         std::string current;
+         if (_readfile(path, current))
+         {
+            now.hash = _hash(current);
+            it = sOnDisk.insert(std::make_pair(path, now)).first;
+         }
+      }
+      if (it != sOnDisk.end() && it->second.hash == h)
+      {
+         drunner_logmsg(kLDEBUG, "Unchanged, not writing " + path);
+         return kRNoChange;
+      }
+
+      drunner_logmsg(kLDEBUG, "Writing " + path);
+      cResult r = _writeatomic(path, contents);
+      if (r.error())
+         sOnDisk.erase(path);
+      else
+         _ondisk(path, contents);
+      return r;
+   }
+
+   // -------------------------------------------------------------------------------
+
+   void save(const Poco::Path & path, const std::string & contents)
+   {
+      std::lock_guard<std::mutex> lock(sMutex);
+      sPending[path.toString()] = contents;
+   }
+
+   cResult load(const Poco::Path & path, std::string & contents)
+   {
+      std::lock_guard<std::mutex> lock(sMutex);
+      std::string p = path.toString();
+
+      auto it = sPending.find(p);
+      if (it != sPending.end())
+      {
+         contents = it->second;
+         return kRSuccess;
+      }
+
+      ondisk od;
+      if (!_stat(p, od))
+         return kRNoChange;
+      if (!_readfile(p, contents))
+         return cError("Unable to open " + p + " for reading.");
+      od.hash = _hash(contents); // stat'd first, so a change while we read is seen at the next write.
+      sOnDisk[p] = od;
+      return kRSuccess;
+   }
+
+   bool exists(const Poco::Path & path)
+   {
+      std::lock_guard<std::mutex> lock(sMutex);
+      std::string p = path.toString();
+      return (sPending.find(p) != sPending.end() || Poco::File(p).exists());
+   }
+
+   // caller holds sMutex.
+   static cResult _flushone(const std::string & path, const std::string & contents)
+   {
+      // trees deleted on purpose have had their writes discarded, so this is unexpected.
+      Poco::File dir(Poco::Path(path).parent());
+      if (!dir.exists())
+         return cError("Couldn't save " + path + " - its directory has gone.");
+      return _write(path, contents);
+   }
+
+   cResult flush()
+   {
+      std::lock_guard<std::mutex> lock(sMutex);
+      cResult rval;
+      for (const auto & x : sPending)
+         rval += _flushone(x.first, x.second);
+      sPending.clear();
+      return rval;
+   }
+
+   cResult flush(const Poco::Path & path)
+   {
+      std::lock_guard<std::mutex> lock(sMutex);
+      auto it = sPending.find(path.toString());
+      if (it == sPending.end())
+         return kRNoChange;
+      cResult r = _flushone(it->first, it->second);
+      sPending.erase(it);
+      return r;
+   }
+
+   void discard(const Poco::Path & path)
+   {
+      std::lock_guard<std::mutex> lock(sMutex);
+      std::string p = path.toString();
+      Poco::Path dir(path);
+      std::string prefix = dir.makeDirectory().toString();
+      for (auto it = sPending.begin(); it != sPending.end();)
+      {
+         if (it->first == p || it->first.compare(0, prefix.length(), prefix) == 0)
+         {
+            logdbg("Deleted, not writing " + it->first);
+            it = sPending.erase(it);
+         }
+         else
+            ++it;
+      }
+   }
+
+   cResult writefile(const Poco::Path & path, const std::string & contents)
+   {
+      std::lock_guard<std::mutex> lock(sMutex);
+      sPending.erase(path.toString());
+      return _write(path.toString(), contents);
+   }
+
+   // -------------------------------------------------------------------------------
+
+#ifdef _WIN32
+   filelock::filelock(const Poco::Path & path, bool shared)
+   {
+      std::string p = path.toString() + ".lock";
+      HANDLE h = CreateFileA(p.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, 0, NULL);
+      OVERLAPPED ov = {};
+      if (h != INVALID_HANDLE_VALUE && !LockFileEx(h, shared ? 0 : LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov))
+      {
+         CloseHandle(h);
+         h = INVALID_HANDLE_VALUE;
+      }
+      if (h == INVALID_HANDLE_VALUE)
+         logdbg("Couldn't lock " + p + ", carrying on without it.");
+      mHandle = (intptr_t)h;
+   }
+
+   filelock::~filelock()
+   {
+      HANDLE h = (HANDLE)mHandle;
+      if (h != INVALID_HANDLE_VALUE)
+         CloseHandle(h); // releases the lock.
+   }
+#else
+   filelock::filelock(const Poco::Path & path, bool shared)
+   {
+      std::string p = path.toString() + ".lock";
+      int fd = open(p.c_str(), O_RDWR | O_CREAT, 0600);
+      if (fd >= 0)
+         while (flock(fd, shared ? LOCK_SH : LOCK_EX) != 0)
+            if (errno != EINTR)
+            {
+               close(fd);
+               fd = -1;
+               break;
+            }
+      if (fd < 0)
+         logdbg("Couldn't lock " + p + ", carrying on without it.");
+      mHandle = fd;
+   }
+
+   filelock::~filelock()
+   {
+      if (mHandle >= 0)
+         close((int)mHandle); // releases the lock.
+   }
+#endif
+
+} // namespace
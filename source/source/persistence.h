@@ -0,0 +1,102 @@
+#ifndef __PERSISTENCE_H
+#define __PERSISTENCE_H
+
+#include <string>
+#include <cstdint>
+#include <sstream>
+
+#include <Poco/Path.h>
+#include <cereal/archives/json.hpp>
+
+#include "cresult.h"
+
+// Shared persistence for dRunner's small JSON settings files.
+//
+// save() only queues the contents. All of the saves to a file within one command are
+// coalesced and written once by flush(), which is called before any external command is
+// run and when drunner exits. Contents identical to what is already on disk are not
+// written at all, and a write goes to a temporary file which is synced and then renamed
+// over the target, so a crash never leaves a partial file behind.
+namespace persistence
+{
+   // queue contents to be written to path at the next flush.
+   void save(const Poco::Path & path, const std::string & contents);
+
+   // the queued contents if there are any, else the file's contents. kRNoChange if neither exists.
+   cResult load(const Poco::Path & path, std::string & contents);
+
+   // true if path has queued contents or exists on disk.
+   bool exists(const Poco::Path & path);
+
+   // write all queued contents. An error for any whose directory has gone.
+   cResult flush();
+
+   // write only path's queued contents, e.g. for a file other drunners read while we run.
+   cResult flush(const Poco::Path & path);
+
+   // drop anything queued for path, or for files under it - it's being deleted.
+   void discard(const Poco::Path & path);
+
+   // write contents to path now, atomically. kRNoChange if the file already holds contents.
+   cResult writefile(const Poco::Path & path, const std::string & contents);
+
+   // lock on path (via path.lock) across processes and threads, held for the object's lifetime.
+   // Exclusive unless shared, shared locks only exclude exclusive ones.
+   // For read-modify-write of files that concurrent drunner processes share, e.g. during
+   // updateall: load, change, save and flush() all while holding the lock.
+   class filelock
+   {
+   public:
+      filelock(const Poco::Path & path, bool shared = false); // blocks until the lock is ours.
+      ~filelock();
+
+   private:
+      filelock(const filelock &);
+      filelock & operator=(const filelock &);
+
+      intptr_t mHandle;
+   };
+
+   // -------------------------------------------------------------------------------
+
+   template <class T>
+   cResult savejson(const Poco::Path & path, const T & obj)
+   {
+      std::ostringstream os;
+      try
+      {
+         cereal::JSONOutputArchive archive(os);
+         archive(obj);
+      } // archive is complete once destroyed.
+      catch (const cereal::Exception & e)
+      {
+         return cError("Cereal exception on writing " + path.toString() + ": " + std::string(e.what()));
+      }
+      save(path, os.str());
+      return kRSuccess;
+   }
+
+   template <class T>
+   cResult loadjson(const Poco::Path & path, T & obj)
+   {
+      std::string contents;
+      cResult r = load(path, contents);
+      if (!r.success())
+         return r;
+
+      std::istringstream is(contents);
+      try
+      {
+         cereal::JSONInputArchive archive(is);
+         archive(obj);
+      }
+      catch (const cereal::Exception & e)
+      {
+         return cError("Cereal exception on reading " + path.toString() + ": " + std::string(e.what()));
+      }
+      return kRSuccess;
+   }
+
+} // namespace
+
+#endif
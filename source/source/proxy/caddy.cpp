@@ -6,16 +6,29 @@
 #include "proxy.h"
 #include "utils_docker.h"
 #include "drunner_paths.h"
+#include "globallogger.h"
 
-// generate the caddyfile in the shared volume
-cResult caddy::generate()
+// caddy (0.x) supports per-site upstreams, balancing, keep-alive and gzip level. It streams
+// requests rather than buffering them, only has a process-wide HTTP/2 switch and chooses
+// what to gzip by file extension, so those options are ignored here.
+static std::string _policy(const std::string & balance)
+{
+   if (Poco::icompare(balance, "leastconn") == 0)
+      return "least_conn";
+   if (Poco::icompare(balance, "iphash") == 0)
+      return "ip_hash";
+   return "round_robin";
+}
+
+// generate the caddyfile
+std::string caddy::config()
 {
    std::ostringstream oss;
 
    for (auto x : mProxyData)
    {
-      std::string ip = utils_docker::getIPAddress(x.container, proxy::networkName());
-      if (ip.length() == 0)
+      std::vector<std::string> hosts = upstreams(x);
+      if (hosts.size() == 0)
       {
          logmsg(kLWARN, "The container " + x.container + " does not appear to be attached to the proxy network '" + proxy::networkName() + "'.");
          logmsg(kLWARN, "Couldn't determine IP address for " + x.container + " - skipping proxy configuration.");
@@ -23,13 +36,31 @@ cResult caddy::generate()
       else
       {
          bool fakemode = (Poco::icompare(x.mode, "fake") == 0);
+         const proxyoptions & o(x.options);
+
+         if (o.buffering || !o.http2 || o.compresstypes.size() > 0)
+            logmsg(kLDEBUG, "caddy ignores the buffering, http2 and compresstypes proxy options (" + x.servicename + ").");
 
          oss << "https://" << x.domain << " {" << std::endl;
-         oss << "   proxy / " << ip << ":" << x.port << " {" << std::endl;
+         oss << "   proxy /";
+         for (const auto & h : hosts)
+            oss << " " << h;
+         oss << " {" << std::endl;
          oss << "      transparent" << std::endl;
          oss << "      websocket" << std::endl;
+         if (hosts.size() > 1)
+            oss << "      policy " << _policy(o.balance) << std::endl;
+         if (o.keepalive > 0)
+            oss << "      keepalive " << o.keepalive << std::endl;
          oss << "   }" << std::endl;
-         oss << "   gzip" << std::endl;
+         if (o.compression < 0)
+            oss << "   gzip" << std::endl;
+         else if (o.compression > 0)
+         {
+            oss << "   gzip {" << std::endl;
+            oss << "      level " << o.compression << std::endl;
+            oss << "   }" << std::endl;
+         }
          oss << "   tls " <<
             (fakemode ? "self_signed" : x.email)
             << std::endl;
@@ -45,57 +76,25 @@ cResult caddy::generate()
       }
    }
 
-   std::string encoded_data = utils::base64encodeWithEquals(oss.str());
-   logmsg(kLDEBUG, oss.str());
-
-   // generate the caddy file in the drunner-proxy-dataVolume volume.
-   CommandLine cl("docker", { "run","--rm",
-      "-v",dataVolume() + ":/data",
-      drunnerPaths::getdrunnerUtilsImage(),
-      "/bin/bash","-c",
-      "echo " + encoded_data + " | base64 -d > /data/caddyfile" });
-
-   std::string op;
-   int rval = utils::runcommand(cl, op);
-   if (rval != 0)
-   {
-      Poco::trimInPlace(op);
-      return cError("Command failed: " + op);
-   }
-
-   return kRSuccess;
+   return oss.str();
 }
 
-// restart the service
-cResult caddy::restart()
+// streamed straight into the data volume (no helper container), swapped in atomically.
+CommandLine caddy::writecommand() const
 {
-   cResult r = generate();
-   if (r.error())
-      return r;
-
-   std::string op;
-   if (utils_docker::dockerContainerRunning(containerName()))
-   { // just send signal to restart it.
-     //      docker exec <container> kill - SIGUSR1 1
-      logmsg(kLINFO, "Reloading dRunner proxy settings (SIGUSR1)");
-      CommandLine cl("docker", { "exec",containerName(),"kill","-SIGUSR1","1" });
-      int rval = utils::runcommand(cl, op);
-      if (rval != 0)
-         return cError("Command failed: " + op);
-      return kRSuccess;
-   }
-
-   if (utils_docker::dockerContainerExists(containerName()))
-   { // get rid of old crufty container.
-      logmsg(kLWARN, "Removing unexpected stopped proxy container! " + containerName());
-      utils_docker::removeContainer(containerName());
-   }
-
+   return CommandLine("docker", { "exec","-i",containerName(),"sh","-c",
+      "cat > /data/caddyfile.new && mv /data/caddyfile.new /data/caddyfile" });
+}
 
-   if (mProxyData.size() == 0)
-      return kRSuccess; // no need for proxy!
+CommandLine caddy::reloadcommand() const
+{
+   return CommandLine("docker", { "exec",containerName(),"kill","-SIGUSR1","1" });
+}
 
+cResult caddy::startcontainer()
+{
    logmsg(kLDEBUG, "Starting dRunner proxy.");
+   std::string op;
 
    // Container is not running. Volume get auto-created if not already present.
    // Note that the /root/.caddy volume mapping is critical to not burn LetsEncrypt certs on
@@ -118,11 +117,5 @@ cResult caddy::restart()
    int rval = utils::runcommand(cl, op);
    if (rval != 0)
       return cError("Command failed: " + op);
-
-   // wait for the proxy to come up.
-   logmsg(kLDEBUG, "Waiting for proxy to come up.");
-   if (!utils_docker::dockerContainerWait(containerName(), 80, 120))
-      logmsg(kLWARN, "The caddy proxy container didn't come up. O_o");
-
    return kRSuccess;
 }
@@ -8,16 +8,19 @@ class caddy : public proxyplugin
 public:
    caddy(const std::vector<proxydatum> & pd) : proxyplugin(pd) {}
 
-   virtual cResult restart();
+   virtual std::string name() const { return "caddy"; }
+   virtual std::string containerName() const { return container(); }
 
+   static std::string container() { return "drunner-proxy"; }
    static std::string dataVolume() { return "drunner-proxy-dataVolume"; }
    static std::string rootVolume() { return "drunner-proxy-rootVolume"; }
-   static std::string containerName() { return "drunner-proxy"; }
 
-private:
-   cResult generate();
+protected:
+   virtual std::string config();
+   virtual cResult startcontainer();
+   virtual CommandLine writecommand() const;
+   virtual CommandLine reloadcommand() const;
 };
 
 
 #endif
-
@@ -0,0 +1,192 @@
+#include <sstream>
+
+#include "Poco/String.h"
+
+#include "nginx.h"
+#include "proxy.h"
+#include "utils_docker.h"
+#include "globallogger.h"
+
+// what the container runs until drunner gives it a configuration: answers on port 80 only.
+static const std::string sPlaceholder =
+   "pid /var/run/nginx.pid; events {} http { server { listen 80; return 503; } }";
+
+static std::string _upstreamName(const std::string & servicename)
+{
+   std::string n = "drunner_";
+   for (char c : Poco::toLower(servicename))
+      n += (isalnum((unsigned char)c) ? c : '_');
+   return n;
+}
+
+// generate nginx.conf
+std::string nginx::config()
+{
+   std::ostringstream oss;
+
+   oss << "pid /var/run/nginx.pid;" << std::endl;
+   oss << "worker_processes auto;" << std::endl;
+   oss << "events {" << std::endl;
+   oss << "   worker_connections 4096;" << std::endl;
+   oss << "}" << std::endl << std::endl;
+
+   oss << "http {" << std::endl;
+   oss << "   server_names_hash_bucket_size 128;" << std::endl;
+   oss << "   client_max_body_size 0;" << std::endl;
+   oss << "   ssl_protocols TLSv1.2;" << std::endl;
+   oss << "   ssl_session_cache shared:SSL:10m;" << std::endl;
+   oss << "   # websockets upgrade, everything else keeps the upstream connection alive." << std::endl;
+   oss << "   map $http_upgrade $connection_upgrade {" << std::endl;
+   oss << "      default upgrade;" << std::endl;
+   oss << "      '' '';" << std::endl;
+   oss << "   }" << std::endl << std::endl;
+
+   for (auto x : mProxyData)
+   {
+      std::vector<std::string> hosts = upstreams(x);
+      if (hosts.size() == 0)
+      {
+         logmsg(kLWARN, "The container " + x.container + " does not appear to be attached to the proxy network '" + proxy::networkName() + "'.");
+         logmsg(kLWARN, "Couldn't determine IP address for " + x.container + " - skipping proxy configuration.");
+         continue;
+      }
+
+      const proxyoptions & o(x.options);
+      std::string upstream = _upstreamName(x.servicename);
+
+      oss << "   upstream " << upstream << " {" << std::endl;
+      if (Poco::icompare(o.balance, "leastconn") == 0)
+         oss << "      least_conn;" << std::endl;
+      else if (Poco::icompare(o.balance, "iphash") == 0)
+         oss << "      ip_hash;" << std::endl;
+      for (const auto & h : hosts)
+         oss << "      server " << h << ";" << std::endl;
+      oss << "      keepalive " << (o.keepalive > 0 ? o.keepalive : 16) << ";" << std::endl;
+      oss << "   }" << std::endl << std::endl;
+
+      oss << "   server {" << std::endl;
+      oss << "      listen 80;" << std::endl;
+      oss << "      server_name " << x.domain << ";" << std::endl;
+      oss << "      return 301 https://$host$request_uri;" << std::endl;
+      oss << "   }" << std::endl << std::endl;
+
+      oss << "   server {" << std::endl;
+      oss << "      listen 443 ssl" << (o.http2 ? " http2" : "") << ";" << std::endl;
+      oss << "      server_name " << x.domain << ";" << std::endl;
+      oss << "      ssl_certificate /data/certs/" << x.domain << ".crt;" << std::endl;
+      oss << "      ssl_certificate_key /data/certs/" << x.domain << ".key;" << std::endl;
+
+      if (o.compression == 0)
+         oss << "      gzip off;" << std::endl;
+      else
+      {
+         oss << "      gzip on;" << std::endl;
+         oss << "      gzip_proxied any;" << std::endl;
+         oss << "      gzip_comp_level " << (o.compression > 0 ? o.compression : 5) << ";" << std::endl;
+         if (o.compresstypes.size() > 0)
+         {
+            oss << "      gzip_types";
+            for (const auto & t : o.compresstypes)
+               oss << " " << t;
+            oss << ";" << std::endl;
+         }
+         else
+            oss << "      gzip_types text/css text/plain text/xml application/javascript application/json application/xml image/svg+xml;" << std::endl;
+      }
+
+      oss << "      location / {" << std::endl;
+      oss << "         proxy_pass http://" << upstream << ";" << std::endl;
+      oss << "         proxy_http_version 1.1;" << std::endl;
+      oss << "         proxy_set_header Host $host;" << std::endl;
+      oss << "         proxy_set_header X-Real-IP $remote_addr;" << std::endl;
+      oss << "         proxy_set_header X-Forwarded-For $proxy_add_x_forwarded_for;" << std::endl;
+      oss << "         proxy_set_header X-Forwarded-Proto $scheme;" << std::endl;
+      oss << "         proxy_set_header Upgrade $http_upgrade;" << std::endl;
+      oss << "         proxy_set_header Connection $connection_upgrade;" << std::endl;
+      oss << "         proxy_request_buffering " << (o.buffering ? "on" : "off") << ";" << std::endl;
+      if (!x.timeouts)
+      {
+         oss << "         proxy_read_timeout 1d;" << std::endl;
+         oss << "         proxy_send_timeout 1d;" << std::endl;
+      }
+      oss << "      }" << std::endl;
+      oss << "   }" << std::endl << std::endl;
+   }
+
+   oss << "}" << std::endl;
+   return oss.str();
+}
+
+// nginx -t checks the new file (certificates included) before it replaces the old one.
+CommandLine nginx::writecommand() const
+{
+   return CommandLine("docker", { "exec","-i",containerName(),"sh","-c",
+      "cat > /data/nginx.conf.new && nginx -q -t -c /data/nginx.conf.new && mv /data/nginx.conf.new /data/nginx.conf" });
+}
+
+// nginx may have only just been started, give it a moment to write its pid.
+CommandLine nginx::reloadcommand() const
+{
+   return CommandLine("docker", { "exec",containerName(),"sh","-c",
+      "for i in 1 2 3 4 5 6 7 8 9 10; do [ -s /var/run/nginx.pid ] && exec nginx -c /data/nginx.conf -s reload; sleep 1; done; exit 1" });
+}
+
+// make self-signed certificates for any domains that don't have any.
+cResult nginx::prepare()
+{
+   // the domains are passed as arguments to the script ($@), never pasted into it.
+   std::vector<std::string> args = { "exec",containerName(),"sh","-c",
+      "mkdir -p /data/certs && cd /data/certs && "
+      "for d in \"$@\"; do "
+      "[ -f \"$d.crt\" ] && [ -f \"$d.key\" ] && continue; "
+      "command -v openssl >/dev/null || apk add --no-cache openssl >/dev/null || exit 1; "
+      "openssl req -x509 -nodes -newkey rsa:2048 -days 3650 -subj \"/CN=$d\" -keyout \"$d.key\" -out \"$d.crt\" 2>/dev/null || exit 1; "
+      "echo \"$d\"; done",
+      "sh" };
+   if (mProxyData.size() == 0)
+      return kRNoChange;
+   for (const auto & x : mProxyData)
+   {
+      args.push_back(x.domain);
+      if (Poco::icompare(x.mode, "production") == 0)
+         logmsg(kLWARN, "nginx doesn't fetch certificates for " + x.domain + " (production mode): it will be self-signed until you put real ones in certs/ of the " + dataVolume() + " volume.");
+   }
+
+   CommandLine cl("docker", args);
+   std::string op;
+   if (utils::runcommand(cl, op) != 0)
+      return cError("Couldn't create certificates for nginx: " + op);
+
+   Poco::trimInPlace(op);
+   if (op.length() == 0)
+      return kRNoChange;
+   logmsg(kLINFO, "Created self-signed certificates for: " + op);
+   return kRSuccess;
+}
+
+cResult nginx::startcontainer()
+{
+   logmsg(kLDEBUG, "Starting dRunner proxy (nginx).");
+   std::string op;
+
+   // the certificates and configuration live in the data volume, so survive the container.
+   CommandLine cl("docker",
+   {
+      "run",
+      "-v",dataVolume() + ":/data",
+      "--name",containerName(),
+      "-p","80:80",
+      "-p","443:443",
+      "--restart=always",
+      "--network=" + proxy::networkName(),
+      "-d",
+      image(),
+      "sh","-c",
+      "[ -f /data/nginx.conf ] || echo '" + sPlaceholder + "' > /data/nginx.conf; exec nginx -c /data/nginx.conf -g 'daemon off;'"
+   });
+
+   int rval = utils::runcommand(cl, op);
+   if (rval != 0)
+      return cError("Command failed: " + op);
+   return kRSuccess;
+}
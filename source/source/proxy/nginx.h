@@ -0,0 +1,31 @@
+#ifndef __NGINX_H
+#define __NGINX_H
+
+#include "proxy.h"
+
+// nginx backend (PROXY=nginx). nginx doesn't fetch certificates itself: it serves
+// certs/DOMAIN.crt and certs/DOMAIN.key from its data volume, and a self-signed pair is
+// made for any domain that doesn't have them.
+class nginx : public proxyplugin
+{
+public:
+   nginx(const std::vector<proxydatum> & pd) : proxyplugin(pd) {}
+
+   virtual std::string name() const { return "nginx"; }
+   virtual std::string containerName() const { return container(); }
+
+   static std::string container() { return "drunner-proxy-nginx"; }
+   static std::string dataVolume() { return "drunner-proxy-nginx-dataVolume"; }
+   static std::string image() { return "nginx:stable-alpine"; }
+
+protected:
+   virtual std::string config();
+   virtual cResult startcontainer();
+   virtual CommandLine writecommand() const;
+   virtual CommandLine reloadcommand() const;
+   virtual cResult prepare();
+   virtual bool resolvesonload() const { return true; }
+};
+
+
+#endif
@@ -1,7 +1,8 @@
-#include <fstream>
-#include <cereal/archives/json.hpp>
 #include <memory>
+#include <sstream>
+#include <thread>
 #include "Poco/String.h"
+#include "Poco/MD5Engine.h"
 
 #include "proxy.h"
 #include "utils.h"
@@ -9,6 +10,43 @@
 #include "dassert.h"
 #include "utils_docker.h"
 #include "caddy.h"
+#include "nginx.h"
+#include "persistence.h"
+#include "exceptions.h"
+#include "globalcontext.h"
+
+// the changes queued by the open proxytransactions, in order. An empty datum.domain is a disable.
+// Unsynchronised: transactions and proxy changes belong to the main thread (see _mainthread).
+static int sTransactionDepth = 0;
+static std::vector<proxydatum> sQueued;
+
+// initialised before main() runs, so on the main thread.
+static const std::thread::id sMainThread = std::this_thread::get_id();
+
+static void _mainthread()
+{
+   drunner_assert(std::this_thread::get_id() == sMainThread, "Proxy changes can only be made from the main thread.");
+}
+
+// apply one queued change to the data, true if it changed anything.
+static bool _apply(proxydata & data, const proxydatum & change)
+{
+   std::string key = proxydata::key(change.servicename);
+   auto it = data.mProxyData.find(key);
+
+   if (change.domain.length() == 0)
+   { // disable
+      if (it == data.mProxyData.end())
+         return false;
+      data.mProxyData.erase(it);
+      return true;
+   }
+
+   if (it != data.mProxyData.end() && it->second == change)
+      return false;
+   data.mProxyData[key] = change;
+   return true;
+}
 
 proxy::proxy()
 {
@@ -22,7 +60,9 @@ std::unique_ptr<proxyplugin> proxy::getPlugin()
    case s2i("none") :
       return NULL;
    case s2i("caddy") :
-      return std::unique_ptr<proxyplugin>(new caddy(mData.mProxyData));
+      return std::unique_ptr<proxyplugin>(new caddy(mData.getAll()));
+   case s2i("nginx") :
+      return std::unique_ptr<proxyplugin>(new nginx(mData.getAll()));
    default:
       logmsg(kLERROR, "Invalid proxy setting: " + GlobalContext().getSettings()->getProxy());
    }
@@ -32,116 +72,306 @@ std::unique_ptr<proxyplugin> proxy::getPlugin()
 
 cResult proxy::proxyenable(proxydatum pd)
 {
+   _mainthread();
+   if (sTransactionDepth == 0)
+   {
+      proxytransaction t;
+      cResult r = proxyenable(pd);
+      if (!r.error())
+         r += t.commit();
+      return r;
+   }
+
    logmsg(kLINFO, "Enabling HTTPS reverse proxy for " + pd.servicename);
 
    cResult r = pd.valid();
    if (r.error())
       return r;
 
-   // load existing settings.
+   // compare against the saved settings with what's already queued applied.
    r = load();
    if (r.error())
       return r;
+   for (const auto & q : sQueued)
+      _apply(mData, q);
+   if (!_apply(mData, pd))
+      return kRNoChange; // already enabled.
 
-   for (unsigned int i = 0; i < mData.mProxyData.size(); ++i)
-      if (Poco::icompare(mData.mProxyData[i].servicename, pd.servicename) == 0)
-      {
-         if (mData.mProxyData[i] == pd)
-            return kRNoChange; // already enabled.
-
-         mData.mProxyData.erase(mData.mProxyData.begin() + i);
-      }
-
-   mData.mProxyData.push_back(pd);
-
-   r = proxyconfigchanged();
-   return r;
+   sQueued.push_back(pd);
+   return kRSuccess;
 }
 
 cResult proxy::proxydisable(std::string service)
 {
-   // load existing settings.
+   _mainthread();
+   if (sTransactionDepth == 0)
+   {
+      proxytransaction t;
+      cResult r = proxydisable(service);
+      if (!r.error())
+         r += t.commit();
+      return r;
+   }
+
    cResult r = load();
    if (r.error())
       return r;
+   for (const auto & q : sQueued)
+      _apply(mData, q);
 
-   int todelete = -1;
-   for (unsigned int i = 0; i < mData.mProxyData.size(); ++i)
-      if (Poco::icompare(mData.mProxyData[i].servicename, service) == 0)
-         todelete = i;
-
-   if (todelete == -1)
+   proxydatum pd;
+   pd.servicename = service;
+   if (!_apply(mData, pd))
       return kRNoChange; // already disabled.
 
-   mData.mProxyData.erase(mData.mProxyData.begin() + todelete);
+   sQueued.push_back(pd);
+   return kRSuccess;
+}
 
-   r = proxyconfigchanged();
-   return r;
+cResult proxy::commit()
+{
+   _mainthread();
+   if (sQueued.size() == 0)
+      return kRNoChange;
+
+   // re-read under the lock, concurrent drunners (updateall) may have changed it since we looked.
+   persistence::filelock lock(saveFilePath());
+   cResult r = load();
+   std::vector<proxydatum> queued;
+   queued.swap(sQueued);
+   if (r.error())
+      return r;
+
+   bool changed = false;
+   for (const auto & q : queued)
+      changed = _apply(mData, q) || changed;
+   if (!changed)
+      return kRNoChange;
+
+   logmsg(kLDEBUG, "Applying " + std::to_string(queued.size()) + " proxy change(s).");
+   return proxyconfigchanged();
 }
 
 // called when "drunner proxy" entered on command line.
 cResult proxy::handledrunnerproxycommand()
+{
+   return reload();
+}
+
+cResult proxy::reload()
 {
    cResult r = load();
-   if (r.success())
-      r += getPlugin()->restart();
+   std::unique_ptr<proxyplugin> plugin = getPlugin();
+   if (r.success() && plugin)
+      r += plugin->restart();
    return r;
 }
 
 cResult proxy::proxyconfigchanged()
 {
-   // save updated settings
+   // save updated settings, now - concurrent drunners (updateall) may be waiting on the lock to read them.
    cResult r = save();
+   if (!r.error())
+      r = persistence::flush();
    if (r.error())
       return r;
 
+   if (GlobalContext::getParams()->isFlagSet("noproxyreload"))
+   { // updateall restarts the proxy once, when all the services are done.
+      logmsg(kLDEBUG, "Proxy configuration saved, restart deferred.");
+      return kRSuccess;
+   }
+
    // Restart the proxy.
-   r += getPlugin()->restart();
+   std::unique_ptr<proxyplugin> plugin = getPlugin();
+   if (plugin)
+      r += plugin->restart();
    return r;
 }
 
 
 cResult proxy::load()
 {
-   if (!utils::fileexists(saveFilePath()))
-      return kRNoChange;
+   mData.mProxyData.clear();
+   return persistence::loadjson(saveFilePath(), mData);
+}
+
+cResult proxy::save()
+{
+   return persistence::savejson(saveFilePath(), mData);
+}
+
+void proxy::removeOtherBackends(std::string keepcontainer)
+{
+   std::vector<std::string> containers = { caddy::container(), nginx::container() };
+   for (const auto & c : containers)
+      if (c != keepcontainer && utils_docker::dockerContainerExists(c))
+      {
+         logmsg(kLINFO, "Removing the other proxy backend's container " + c);
+         utils_docker::removeContainer(c);
+      }
+}
 
-   // read the settings.
-   std::ifstream is(saveFilePath().toString());
-   if (is.bad())
-      return cError("Unable to open " + saveFilePath().toString() + " for reading.");
-   try
+// ---------------------------------------------------------------------------------------
+
+// the id of the last proxy container we configured and the hash of what we gave it.
+static Poco::Path _hashFilePath()
+{
+   return drunnerPaths::getPath_Settings().setFileName("proxyconfig.hash");
+}
+
+// the full id of the container if it's running, else empty.
+static std::string _runningContainerID(const std::string & container)
+{
+   CommandLine cl("docker", { "inspect","--format","{{.State.Running}} {{.Id}}",container });
+   std::string out;
+   if (utils::runcommand(cl, out) != 0)
+      return "";
+   std::istringstream iss(out);
+   std::string running, id;
+   iss >> running >> id;
+   return (running == "true" ? id : "");
+}
+
+cResult proxyplugin::restart()
+{
+   std::string conf = config();
+   std::string id = _runningContainerID(containerName());
+   bool started = false;
+
+   if (id.length() == 0)
    {
-      mData.mProxyData.clear();
-      cereal::JSONInputArchive archive(is);
-      archive(mData);
+      if (utils_docker::dockerContainerExists(containerName()))
+      { // get rid of old crufty container.
+         logmsg(kLWARN, "Removing unexpected stopped proxy container! " + containerName());
+         utils_docker::removeContainer(containerName());
+      }
+
+      if (mProxyData.size() == 0)
+         return kRSuccess; // no need for proxy!
+
+      proxy::removeOtherBackends(containerName());
+      cResult r = startcontainer();
+      if (r.error())
+         return r;
+      id = _runningContainerID(containerName());
+      started = true;
    }
-   catch (const cereal::Exception & e)
+
+   Poco::MD5Engine md5;
+   md5.update(conf);
+   std::string stamp = name() + " " + id + " " + Poco::DigestEngine::digestToHex(md5.digest());
+   std::string laststamp;
+   bool reresolve = resolvesonload() && GlobalContext::getSettings()->getProxyUseDNS();
+   if (!reresolve && persistence::load(_hashFilePath(), laststamp).success() && Poco::trim(laststamp) == stamp)
    {
-      return cError("Cereal exception on reading settings: " + std::string(e.what()));
+      logmsg(kLDEBUG, "dRunner proxy configuration is unchanged.");
+      return kRNoChange;
    }
+   logmsg(kLDEBUG, conf);
 
-   return kRSuccess;
+   cResult r = prepare();
+   if (r.error())
+      return r;
+
+   std::string op;
+   if (utils::runcommand_input(writecommand(), conf, op) != 0)
+   {
+      Poco::trimInPlace(op);
+      return cError("Couldn't write the " + name() + " configuration: " + op);
+   }
+
+   logmsg(kLINFO, "Reloading dRunner proxy settings (" + name() + ")");
+   if (utils::runcommand(reloadcommand(), op) != 0)
+      return cError("Command failed: " + op);
+   r = persistence::writefile(_hashFilePath(), stamp);
+
+   if (started)
+   { // it only listens on 80 once it has its configuration.
+      logmsg(kLDEBUG, "Waiting for proxy to come up.");
+      if (!utils_docker::dockerContainerWait(containerName(), 80, 120))
+         logmsg(kLWARN, "The " + name() + " proxy container didn't come up. O_o");
+   }
+   return r.error() ? r : cResult(kRSuccess);
 }
 
-cResult proxy::save()
+std::vector<std::string> proxyplugin::upstreams(const proxydatum & pd)
 {
-   logdbg("Creating " + saveFilePath().toString());
-   std::ofstream os(saveFilePath().toString());
-   if (os.bad() || !os.is_open())
-      return cError("Unable to open " + saveFilePath().toString() + " for writing.");
+   // docker's DNS resolves container names on the proxy network, otherwise look the addresses up in one go.
+   bool usedns = GlobalContext::getSettings()->getProxyUseDNS();
+   if (!usedns && !mHaveAddresses)
+   {
+      cResult r = utils_docker::getNetworkAddresses(proxy::networkName(), mAddresses);
+      if (r.error())
+         logmsg(kLDEBUG, r.what());
+      mHaveAddresses = true;
+   }
 
-   try
+   std::vector<std::string> hosts;
+   for (const auto & c : pd.containers())
    {
-      cereal::JSONOutputArchive archive(os);
-      archive(mData);
+      std::string ip = c;
+      if (!usedns)
+      {
+         auto it = mAddresses.find(c);
+         ip = (it != mAddresses.end() ? it->second : utils_docker::getIPAddress(c, proxy::networkName()));
+      }
+      if (ip.length() > 0)
+         hosts.push_back(ip + ":" + pd.port);
    }
-   catch (const cereal::Exception & e)
+   return hosts;
+}
+
+// ---------------------------------------------------------------------------------------
+
+proxytransaction::proxytransaction() : mDone(false)
+{
+   _mainthread();
+   ++sTransactionDepth;
+}
+
+proxytransaction::~proxytransaction()
+{
+   if (!mDone)
    {
-      return cError("Cereal exception on writing settings: " + std::string(e.what()));
+      try
+      {
+         cResult r = commit();
+         if (r.error())
+            logmsg(kLWARN, "Couldn't apply the proxy changes:\n " + r.what());
+      }
+      catch (const eExit &)
+      { // can't throw from here.
+         logmsg(kLWARN, "Couldn't apply the proxy changes.");
+      }
    }
-   drunner_assert(utils::fileexists(saveFilePath()), "Failed to create settings at " + saveFilePath().toString());
-   return kRSuccess;
+}
+
+cResult proxytransaction::commit()
+{
+   if (mDone)
+      return kRNoChange;
+   mDone = true;
+   --sTransactionDepth;
+
+   if (sTransactionDepth > 0)
+      return kRNoChange; // the outermost transaction will do it.
+   return proxy().commit();
+}
+
+// ---------------------------------------------------------------------------------------
+
+std::string proxydata::key(const std::string & servicename)
+{
+   return Poco::toLower(servicename);
+}
+
+std::vector<proxydatum> proxydata::getAll() const
+{
+   std::vector<proxydatum> v;
+   for (const auto & x : mProxyData)
+      v.push_back(x.second);
+   return v;
 }
 
 Poco::Path proxy::saveFilePath()
@@ -149,12 +379,25 @@ Poco::Path proxy::saveFilePath()
    return drunnerPaths::getPath_Settings().setFileName("dRunner_Proxy.json");
 }
 
+// letters, digits, dots and dashes only - the domain ends up in proxy configs and shell commands.
+static bool _validhostname(const std::string & h)
+{
+   if (h.length() == 0 || h.length() > 253 || h[0] == '-' || h[0] == '.')
+      return false;
+   for (char c : h)
+      if (!isalnum((unsigned char)c) && c != '.' && c != '-')
+         return false;
+   return true;
+}
+
 cResult proxydatum::valid()
 {
    if (servicename.length() == 0)
       return cError("Service name not set.");
    if (domain.length() == 0)
       return cError("Domain name not set.");
+   if (!_validhostname(domain))
+      return cError("Domain name " + domain + " is not a valid hostname.");
    if (container.length() == 0)
       return cError("Container not set.");
    if (port.length() == 0 || atoi(port.c_str())<=0)
@@ -162,7 +405,7 @@ cResult proxydatum::valid()
    switch (s2i(mode.c_str()))
    {
    case s2i("fake"):
-      return kRSuccess;
+      return options.valid();
 
    case s2i("staging"):
       return cError("Staging not currently supported.");
@@ -178,7 +421,14 @@ cResult proxydatum::valid()
       return cError("Unkown mode - must be fake, staging or production");
    }
 
-   return kRSuccess;
+   return options.valid();
+}
+
+std::vector<std::string> proxydatum::containers() const
+{
+   std::vector<std::string> c = { container };
+   c.insert(c.end(), options.upstreams.begin(), options.upstreams.end());
+   return c;
 }
 
 bool proxydatum::operator ==(const proxydatum &b) const
@@ -189,6 +439,36 @@ bool proxydatum::operator ==(const proxydatum &b) const
    if (Poco::icompare(port, b.port) != 0) return false;
    if (Poco::icompare(email, b.email) != 0) return false;
    if (Poco::icompare(mode, b.mode) != 0) return false;
+   if (timeouts != b.timeouts) return false;
+   if (!(options == b.options)) return false;
 
    return true;
 }
+
+cResult proxyoptions::valid() const
+{
+   for (const auto & u : upstreams)
+      if (u.length() == 0)
+         return cError("Empty upstream container name.");
+   switch (s2i(Poco::toLower(balance).c_str()))
+   {
+   case s2i(""):
+   case s2i("roundrobin"):
+   case s2i("leastconn"):
+   case s2i("iphash"):
+      break;
+   default:
+      return cError("Unknown balance - must be roundrobin, leastconn or iphash.");
+   }
+   if (keepalive < 0)
+      return cError("keepalive can't be negative.");
+   if (compression < -1 || compression > 9)
+      return cError("compression must be a gzip level from 1 to 9, or 0 for none.");
+   return kRSuccess;
+}
+
+bool proxyoptions::operator ==(const proxyoptions &b) const
+{
+   return upstreams == b.upstreams && Poco::icompare(balance, b.balance) == 0 && keepalive == b.keepalive &&
+      compression == b.compression && compresstypes == b.compresstypes && buffering == b.buffering && http2 == b.http2;
+}
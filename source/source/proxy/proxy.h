@@ -4,23 +4,56 @@
 #include <cereal/access.hpp>
 #include <cereal/types/string.hpp>
 #include <cereal/types/vector.hpp>
+#include <map>
+#include <memory>
 
 #include "Poco/Path.h"
 
 #include "cresult.h"
+#include "utils.h"
+
+// ---------------------------------------------------------------------------------------
+
+// per-service tuning. Each backend maps what it supports and ignores the rest (see restart()).
+class proxyoptions
+{
+public:
+   proxyoptions() : keepalive(0), compression(-1), buffering(false), http2(true) {}
+
+   cResult valid() const;
+   bool operator ==(const proxyoptions &b) const;
+
+   std::vector<std::string> upstreams; // more containers serving the same port, balanced with the datum's container.
+   std::string balance;                // roundrobin (default), leastconn or iphash.
+   int keepalive;                      // idle upstream connections to keep open, 0 for the backend's default.
+   int compression;                    // gzip level 1-9, 0 for none, -1 for the backend's default.
+   std::vector<std::string> compresstypes; // MIME types to compress, empty for the backend's default.
+   bool buffering;                     // read whole requests before passing them upstream.
+   bool http2;
+
+private:
+   friend class cereal::access;
+   template <class Archive> void serialize(Archive &ar, std::uint32_t const version)
+   {
+      ar(upstreams, balance, keepalive, compression, compresstypes, buffering, http2);
+   }
+};
+CEREAL_CLASS_VERSION(proxyoptions, 1);
 
 // ---------------------------------------------------------------------------------------
 
 class proxydatum
 {
 public:
-   proxydatum(std::string s, std::string d, std::string c, std::string p, std::string e, std::string m, bool t) :
-      servicename(s), domain(d), container(c), port(p), email(e), mode(m), timeouts(t)
+   proxydatum(std::string s, std::string d, std::string c, std::string p, std::string e, std::string m, bool t, proxyoptions o = proxyoptions()) :
+      servicename(s), domain(d), container(c), port(p), email(e), mode(m), timeouts(t), options(o)
    {}
 
-   proxydatum()
+   proxydatum() : timeouts(true)
    {}
 
+   std::vector<std::string> containers() const; // container, then options.upstreams.
+
    cResult valid();
 
    bool operator ==(const proxydatum &b) const;
@@ -32,47 +65,84 @@ public:
    std::string email;
    std::string mode;
    bool timeouts;
+   proxyoptions options;
 
 private:
    friend class cereal::access;
    template <class Archive> void save(Archive &ar, std::uint32_t const version) const 
    { 
-      ar(servicename, domain, container, port, email, mode, timeouts);
+      ar(servicename, domain, container, port, email, mode, timeouts, options);
    }
    template <class Archive> void load(Archive &ar, std::uint32_t const version) 
    {
       ar(servicename, domain, container, port, email, mode, timeouts);
+      options = proxyoptions();
+      if (version >= 2)
+         ar(options);
    }
 };
-CEREAL_CLASS_VERSION(proxydatum, 1);
+CEREAL_CLASS_VERSION(proxydatum, 2);
 
 // ---------------------------------------------------------------------------------------
 
 class proxydata
 {
 public:
-   std::vector<proxydatum> mProxyData;
+   std::map<std::string, proxydatum> mProxyData; // lower case service name -> datum.
+
+   static std::string key(const std::string & servicename);
+   std::vector<proxydatum> getAll() const;
 
 private:
-// --- serialisation --
+// --- serialisation -- (still a list on disk)
 friend class cereal::access;
-template <class Archive> void save(Archive &ar, std::uint32_t const version) const { ar(mProxyData); }
-template <class Archive> void load(Archive &ar, std::uint32_t const version) { mProxyData.clear(); ar(mProxyData); }
+template <class Archive> void save(Archive &ar, std::uint32_t const version) const { ar(getAll()); }
+template <class Archive> void load(Archive &ar, std::uint32_t const version) 
+{ 
+   std::vector<proxydatum> v;
+   ar(v);
+   mProxyData.clear(); 
+   for (const auto & pd : v)
+      mProxyData[key(pd.servicename)] = pd;
+}
 // --- serialisation --
 };
 CEREAL_CLASS_VERSION(proxydata, 1);
 
 // ---------------------------------------------------------------------------------------
 
+// A proxy backend, run in its own container on the proxy network. The backends generate
+// their configuration, the shared restart() does the rest.
 class proxyplugin
 {
 public:
-   proxyplugin(const std::vector<proxydatum> & pd) : mProxyData(pd) {}
+   proxyplugin(const std::vector<proxydatum> & pd) : mProxyData(pd), mHaveAddresses(false) {}
+   virtual ~proxyplugin() {}
 
-   virtual cResult restart() = 0;
+   // write the configuration into the backend's container and reload it, starting the
+   // container if need be. Does nothing (kRNoChange) if the running container already has it,
+   // unless it only resolves PROXYUSEDNS names on reload - the containers may have new addresses.
+   cResult restart();
+
+   virtual std::string name() const = 0;
+   virtual std::string containerName() const = 0;
 
 protected:
-   const std::vector<proxydatum> & mProxyData;
+   virtual std::string config() = 0;             // the whole configuration for mProxyData.
+   virtual cResult startcontainer() = 0;         // docker run the backend.
+   virtual CommandLine writecommand() const = 0; // reads the configuration on stdin, checks it and moves it into place.
+   virtual CommandLine reloadcommand() const = 0;
+   virtual cResult prepare() { return kRSuccess; } // anything the configuration needs in the container first.
+   virtual bool resolvesonload() const { return false; } // looks upstream names up only when it loads its configuration.
+
+   // ip:port (or name:port with PROXYUSEDNS) of each of the datum's containers, skipping any that aren't on the proxy network.
+   std::vector<std::string> upstreams(const proxydatum & pd);
+
+   const std::vector<proxydatum> mProxyData;
+
+private:
+   std::map<std::string, std::string> mAddresses;
+   bool mHaveAddresses;
 };
 
 
@@ -81,22 +151,46 @@ class proxy
 public:
    proxy();
 
+   // inside a proxytransaction these are only queued (kRNoChange if they'd change nothing).
    cResult proxyenable(proxydatum pd);
    cResult proxydisable(std::string service);
    cResult handledrunnerproxycommand();
+   cResult reload(); // regenerate the configuration and restart the proxy.
 
    static std::string networkName() { return "drunnerproxy"; }
+   static Poco::Path saveFilePath();
+   static void removeOtherBackends(std::string keepcontainer); // only one backend can hold ports 80 and 443.
 
 private:
+   friend class proxytransaction;
+
    cResult proxyconfigchanged();
+   cResult commit(); // apply the queued changes to the saved configuration.
 
    std::unique_ptr<proxyplugin> getPlugin();
    cResult load();
    cResult save();
-   Poco::Path saveFilePath();
 
    proxydata mData;
 };
 
+// Batches proxy changes. While a transaction is open proxyenable and proxydisable just
+// queue their changes, and when the outermost one commits (or goes out of scope) they are
+// applied to the saved configuration together and the proxy is restarted once, if at all.
+// Transactions nest, e.g. around an update's uninstall and install. Transactions, proxyenable
+// and proxydisable are for the main thread only (asserted): the queue is process-wide, so
+// changes made from another thread would land in whatever transaction main has open.
+class proxytransaction
+{
+public:
+   proxytransaction();
+   ~proxytransaction();
+
+   cResult commit(); // kRNoChange unless this is the outermost transaction.
+
+private:
+   bool mDone;
+};
+
 
 #endif
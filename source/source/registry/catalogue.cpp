@@ -0,0 +1,167 @@
+#include <atomic>
+#include <thread>
+#include <sstream>
+
+#include "Poco/String.h"
+#include <cereal/archives/portable_binary.hpp>
+
+#include "catalogue.h"
+#include "gitcache.h"
+#include "drunner_paths.h"
+#include "persistence.h"
+#include "exceptions.h"
+#include "globallogger.h"
+
+namespace sourcecopy
+{
+   static const uint32_t kCatalogueFormat = 1; // bump to discard old index files.
+
+   static std::string _key(std::string registry, std::string dService)
+   {
+      return Poco::toLower(registry) + "/" + Poco::toLower(dService);
+   }
+
+   catalogue::catalogue()
+   {
+      mPath = drunnerPaths::getPath_GitCache().setFileName("catalogue.bin");
+
+      std::string contents;
+      if (!persistence::load(mPath, contents).success())
+         return;
+
+      std::istringstream is(contents);
+      try
+      {
+         cereal::PortableBinaryInputArchive archive(is);
+         uint32_t format = 0;
+         archive(format);
+         if (format == kCatalogueFormat)
+            archive(mEntries);
+      }
+      catch (const cereal::Exception &)
+      { // only a cache.
+         logmsg(kLDEBUG, "Ignoring unreadable " + mPath.toString());
+         mEntries.clear();
+      }
+      _index();
+   }
+
+   cResult catalogue::_save() const
+   {
+      std::ostringstream os;
+      {
+         cereal::PortableBinaryOutputArchive archive(os);
+         archive(kCatalogueFormat, mEntries);
+      }
+      return persistence::writefile(mPath, os.str());
+   }
+
+   void catalogue::_index()
+   {
+      mIndex.clear();
+      for (size_t i = 0; i < mEntries.size(); ++i)
+         for (size_t j = 0; j < mEntries[i].items.size(); ++j)
+            mIndex[_key(mEntries[i].nicename, mEntries[i].items[j].nicename)] = std::make_pair(i, j);
+   }
+
+   cResult catalogue::find(std::string registry, std::string dService, registryitem & item) const
+   {
+      auto it = mIndex.find(_key(registry, dService));
+      if (it == mIndex.end())
+         return cError(dService + " does not exist in registry " + registry + ".");
+      item = mEntries[it->second.first].items[it->second.second];
+      return kRSuccess;
+   }
+
+   cResult catalogue::refresh(const std::vector<registrydefinition> & defs)
+   {
+      std::vector<catalogueentry> fresh(defs.size());
+      std::vector<std::string> errors(defs.size());
+      std::atomic<size_t> next(0);
+
+      auto worker = [&]() {
+         size_t i;
+         while ((i = next++) < defs.size())
+         {
+            catalogueentry & e(fresh[i]);
+            e.nicename = defs[i].mNiceName;
+            e.url = defs[i].mURL;
+            try
+            {
+               gitcache gc(e.url);
+               Poco::Path p;
+               cResult r = gc.get(p, true);
+               if (!r.success())
+               {
+                  errors[i] = r.what();
+                  continue;
+               }
+               e.commit = gc.getCommit();
+
+               for (const auto & old : mEntries)
+                  if (old.url == e.url && old.commit == e.commit && e.commit.length() > 0)
+                  { // unchanged, no need to read it again.
+                     e.items = old.items;
+                     break;
+                  }
+               if (e.items.size() == 0)
+               {
+                  r = parseregistry(Poco::Path(p, "registry"), e.items);
+                  if (!r.success())
+                     errors[i] = r.what();
+               }
+            }
+            catch (const eExit &)
+            {
+               errors[i] = "Couldn't fetch the registry.";
+            }
+         }
+      };
+
+      size_t nthreads = defs.size() < 8 ? defs.size() : 8;
+      std::vector<std::thread> threads;
+      for (size_t t = 1; t < nthreads; ++t)
+         threads.push_back(std::thread(worker));
+      worker();
+      for (auto & t : threads)
+         t.join();
+
+      // keep what we had for registries we couldn't refresh.
+      cResult rval = kRNoChange;
+      for (size_t i = 0; i < fresh.size(); ++i)
+         if (errors[i].length() > 0)
+         {
+            bool found = false;
+            for (const auto & old : mEntries)
+               if (old.url == fresh[i].url)
+               {
+                  std::string name = fresh[i].nicename;
+                  fresh[i] = old;
+                  fresh[i].nicename = name;
+                  found = true;
+               }
+            if (found)
+               logmsg(kLWARN, "Couldn't refresh registry " + fresh[i].nicename + ", using the cached copy:\n " + errors[i]);
+            else
+            {
+               fresh[i].commit = "";
+               fresh[i].items.clear();
+               rval += cError("Couldn't read registry " + fresh[i].nicename + ":\n " + errors[i]);
+            }
+         }
+
+      bool changed = (fresh.size() != mEntries.size());
+      for (size_t i = 0; !changed && i < fresh.size(); ++i)
+         changed = (fresh[i].nicename != mEntries[i].nicename || fresh[i].url != mEntries[i].url || fresh[i].commit != mEntries[i].commit);
+
+      if (changed)
+      {
+         logmsg(kLDEBUG, "Registry catalogue changed, rebuilding the index.");
+         mEntries = fresh;
+         _index();
+         rval += _save();
+      }
+      return rval;
+   }
+
+} // namespace
@@ -0,0 +1,62 @@
+#ifndef __CATALOGUE_H
+#define __CATALOGUE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <cereal/access.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+
+#include "Poco/Path.h"
+#include "cresult.h"
+#include "registry.h"
+
+namespace sourcecopy
+{
+   // the parsed contents of one registry, at one commit.
+   class catalogueentry
+   {
+   public:
+      std::string nicename; // of the registry.
+      std::string url;
+      std::string commit;
+      std::vector<registryitem> items;
+
+   private:
+      // --- serialisation --
+      friend class ::cereal::access;
+      template <class Archive> void serialize(Archive &ar, std::uint32_t const version) { ar(nicename, url, commit, items); }
+      // --- serialisation --
+   };
+
+   // The dServices of all configured registries, kept in one binary index file in the git
+   // cache. A registry is only reparsed when the commit it resolves to changes, and the
+   // registries are refreshed concurrently. Lookups are case-insensitive and hashed.
+   class catalogue
+   {
+   public:
+      catalogue(); // loads the index, if there is one.
+
+      // bring the catalogue up to date with the given registries (each fetched within the
+      // git cache TTL). A registry that can't be fetched keeps its previous entries.
+      cResult refresh(const std::vector<registrydefinition> & defs);
+
+      // find registry/dService (case-insensitive).
+      cResult find(std::string registry, std::string dService, registryitem & item) const;
+
+      const std::vector<catalogueentry> & getAll() const { return mEntries; }
+
+   private:
+      void _index();
+      cResult _save() const;
+
+      Poco::Path mPath;
+      std::vector<catalogueentry> mEntries;
+      std::unordered_map<std::string, std::pair<size_t, size_t> > mIndex; // lower case registry/dService -> entry, item.
+   };
+}
+CEREAL_CLASS_VERSION(sourcecopy::catalogueentry, 1);
+
+#endif
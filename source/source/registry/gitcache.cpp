@@ -3,79 +3,187 @@
 #include "Poco/DigestStream.h"
 #include "Poco/MD5Engine.h"
 #include "Poco/Environment.h"
+#include "Poco/StringTokenizer.h"
+
+#include <ctime>
+#include <fstream>
+#include <set>
+#include <mutex>
 
 #include "gitcache.h"
 #include "utils.h"
 #include "drunner_paths.h"
 #include "dassert.h"
+#include "globalcontext.h"
+#include "drunner_settings.h"
+#include "persistence.h"
+
+// -------------------------------------------------------------------------------
+
+gitrefs::gitrefs()
+{
+   mPath = drunnerPaths::getPath_GitCache().setFileName("gitrefs.json");
+   if (persistence::loadjson(mPath, mRefs).error())
+   { // only a cache.
+      logmsg(kLDEBUG, "Ignoring unreadable " + mPath.toString());
+      mRefs.clear();
+   }
+}
+
+gitref * gitrefs::find(std::string url, std::string tag)
+{
+   auto it = mRefs.find(_key(url, tag));
+   if (it == mRefs.end())
+      return NULL;
+   mTouched.insert(it->first); // the caller may change it.
+   return &it->second;
+}
+
+void gitrefs::set(std::string url, std::string tag, const gitref & ref)
+{
+   mRefs[_key(url, tag)] = ref;
+   mTouched.insert(_key(url, tag));
+}
+
+void gitrefs::erase(std::string url, std::string tag)
+{
+   mRefs.erase(_key(url, tag));
+   mTouched.insert(_key(url, tag));
+}
+
+void gitrefs::splitKey(std::string key, std::string & url, std::string & tag)
+{
+   size_t pos = key.rfind(' ');
+   url = key.substr(0, pos);
+   tag = (pos == std::string::npos) ? "" : key.substr(pos + 1);
+}
+
+// merges our changes into what's on disk now, which other drunners may have changed since we loaded it.
+cResult gitrefs::save()
+{
+   persistence::filelock lock(mPath);
+   std::map<std::string, gitref> current;
+   if (persistence::loadjson(mPath, current).error())
+      current.clear();
+
+   for (const auto & k : mTouched)
+   {
+      auto it = mRefs.find(k);
+      if (it == mRefs.end())
+         current.erase(k);
+      else
+         current[k] = it->second;
+   }
+   mTouched.clear();
+   mRefs = current;
 
-gitcache::gitcache(std::string url, std::string tag) : mURL(url), mTag(tag)
+   cResult r = persistence::savejson(mPath, mRefs);
+   if (!r.error())
+      r = persistence::flush(mPath);
+   return r.error() ? r : cResult(kRSuccess);
+}
+
+// -------------------------------------------------------------------------------
+
+gitcache::gitcache(std::string url, std::string tag) : mURL(url), mTag(tag), mTTL(300)
 {
    if (mTag.length() == 0)
       mTag = "master";
 
+   if (GlobalContext::hasSettings())
+      mTTL = GlobalContext::getSettings()->getGitCacheTTL();
+
    drunner_assert(mURL.length() > 0, "Empty URL given to gitcache");
 }
 
-static bool _sGitChecked = false;
+// checked once, by whichever thread gets there first (registry refreshes run in parallel).
+static std::once_flag _sGitChecked;
 static bool _sHasGit = false;
 
-cResult gitcache::runGitCommand(std::vector<std::string> args) const
-{
-   CommandLine op;
-   std::string out;
-
-   //tKeyVals env;
-   //std::string s = Poco::Environment::get("PATH");
-   //logmsg(kLDEBUG, "PATH = " + s);
-   //env["PATH"] = s;
+// the shared object store, relative to the git cache directory.
+static const std::string kStore = "shared.git";
 
+static bool _hasHostGit()
+{
    // Git commonly installed on Windows does not support HTTPS (GnuTLS fails to initialize).
    // So we just fall back to the container approach.
 #ifndef _WIN32
-   if (!_sGitChecked)
-   {
-      op.command = "git";
-      op.args = { "--version" };
+   std::call_once(_sGitChecked, []() {
+      CommandLine op("git", { "--version" });
+      std::string out;
       cResult r0 = utils::runcommand_stream(op, kOSuppressed, "", {}, &out);
       Poco::trimInPlace(out);
       logmsg(kLDEBUG, "   " + out);
       _sHasGit = r0.success();
-      _sGitChecked = true;
       if (_sHasGit)
          logmsg(kLDEBUG, "Using host's git command.");
       else
          logmsg(kLDEBUG, "Git not found on host, using container.");
-   }
+   });
 #endif
-   cResult r;
+   return _sHasGit;
+}
 
+// the shared store needs the host's git, since the checkouts refer to it by its path on the host.
+static bool _useSharedStore()
+{
+   if (GlobalContext::hasSettings() && !GlobalContext::getSettings()->getGitCacheShared())
+      return false;
+   return _hasHostGit();
+}
+
+cResult gitcache::runGitCommand(std::vector<std::string> args) const
+{
+   std::string out;
+   return runGitCommand(args, out, true);
+}
+
+cResult gitcache::runGitCommand(std::vector<std::string> args, std::string & out, bool errorsFatal) const
+{
    if (!utils::fileexists(getCachePath()))
       utils::makedirectory(getCachePath(), S_700);
    drunner_assert(utils::fileexists(getCachePath()), "Failed to create " + getCachePath().toString());
 
-   if (_sHasGit)
+   return _rungit(getCachePath(), args, out, errorsFatal);
+}
+
+cResult gitcache::_rungit(Poco::Path dir, std::vector<std::string> args, std::string & out, bool errorsFatal)
+{
+   CommandLine op;
+
+   //tKeyVals env;
+   //std::string s = Poco::Environment::get("PATH");
+   //logmsg(kLDEBUG, "PATH = " + s);
+   //env["PATH"] = s;
+
+   cResult r;
+   if (_hasHostGit())
    {
       op.command = "git";
       op.args = args;
-      r = utils::runcommand_stream(op, kOSuppressed, getCachePath(), {}, &out);
+      r = utils::runcommand_stream(op, kOSuppressed, dir, {}, &out);
    }
    else
    { // run in container.
       op.command = "docker";
-      op.args = { "run","--rm","-v",getCachePath().toString() + ":/dst",
+      op.args = { "run","--rm","-v",dir.toString() + ":/dst",
          drunnerPaths::getdrunnerUtilsImage(),"bash","-c"};
       std::string bashline = "cd /dst ; git";
       for (auto x : args)
          bashline+=" " + x;
       op.args.push_back(bashline);
 
-      r = utils::runcommand_stream(op, kOSuppressed, getCachePath(), {}, &out);
+      r = utils::runcommand_stream(op, kOSuppressed, dir, {}, &out);
    }
    if (r.success())
       logmsg(kLDEBUG, out);
-   else
+   else if (errorsFatal)
       logmsg(kLERROR, out);
+   else
+   {
+      logmsg(kLDEBUG, out);
+      return cError("git " + (args.size() > 0 ? args[0] : "") + " failed:\n" + out);
+   }
 
    return r;
 }
@@ -88,104 +196,313 @@ Poco::Path gitcache::getCachePath() const
 }
 
 
+// the commit checked out in the cache, or "" if there isn't one.
+std::string gitcache::getCommit() const
+{
+   gitrefs refs;
+   gitref * r = refs.find(mURL, mTag);
+   if (r != NULL && r->commit.length() > 0)
+      return r->commit;
+   return _head();
+}
+
+std::string gitcache::_head() const
+{
+   Poco::Path gitfolder = getCachePath();
+   gitfolder.pushDirectory(".git");
+   if (!utils::fileexists(gitfolder))
+      return "";
+
+   std::string out;
+   if (!runGitCommand({ "rev-parse","--verify","HEAD" }, out, false).success())
+      return "";
+   Poco::trimInPlace(out);
+   return (out.length() == 40) ? out : "";
+}
+
+// the commit the remote currently has for the tag, or "" if it can't tell us (e.g. offline, or the tag is a commit).
+std::string gitcache::_lsremote() const
+{
+   std::string out;
+   if (!runGitCommand({ "ls-remote",mURL,mTag,mTag + "^{}" }, out, false).success())
+      return "";
+
+   // prefer the commit an annotated tag points at, then the tag, then a branch.
+   std::string peeled, tag, branch;
+   Poco::StringTokenizer lines(out, "\n", Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+   for (const auto & line : lines)
+   {
+      size_t tab = line.find('\t');
+      if (tab != 40)
+         continue; // not a ref line.
+      std::string sha = line.substr(0, 40);
+      std::string ref = line.substr(41);
+      if (ref == "refs/tags/" + mTag + "^{}")
+         peeled = sha;
+      else if (ref == "refs/tags/" + mTag)
+         tag = sha;
+      else if (ref == "refs/heads/" + mTag)
+         branch = sha;
+   }
+   if (peeled.length() > 0) return peeled;
+   if (tag.length() > 0) return tag;
+   return branch;
+}
+
+// fetch the tag into the shared store, and check it out from there. Forks and mirrors of
+// a dService then share their objects rather than each holding a copy.
+cResult gitcache::_fetchshared() const
+{
+   std::string out;
+   Poco::Path root = drunnerPaths::getPath_GitCache();
+   persistence::filelock lock(Poco::Path(root).setFileName(kStore)); // git won't share a shallow repo between fetches.
+   Poco::Path store(root);
+   store.pushDirectory(kStore);
+   if (!utils::fileexists(store))
+   {
+      logmsg(kLDEBUG, "Creating shared git store " + store.toString());
+      cResult r = _rungit(root, { "init","--quiet","--bare",kStore }, out, false);
+      if (!r.success())
+         return r;
+   }
+
+   // the checkout borrows objects from the store.
+   Poco::Path info = getCachePath();
+   info.pushDirectory(".git").pushDirectory("objects").pushDirectory("info");
+   Poco::File(info).createDirectories();
+   std::string objects = Poco::Path(store).pushDirectory("objects").toString();
+   if (objects.length() > 1 && objects[objects.length() - 1] == '/')
+      objects.erase(objects.length() - 1);
+   std::ofstream alternates(Poco::Path(info, "alternates").toString(), std::ios::out | std::ios::trunc);
+   alternates << objects << std::endl;
+   alternates.close();
+   if (alternates.fail())
+      return cError("Unable to write git alternates for " + getCachePath().toString());
+
+   logmsg(kLDEBUG, "Fetching " + mTag + " into the shared git store.");
+   cResult r = _rungit(root, { "--git-dir=" + kStore,"fetch","--depth","1","--no-tags",mURL,"+" + mTag + ":" + _storeref() }, out, false);
+   if (!r.success())
+      return r;
+   r = _rungit(root, { "--git-dir=" + kStore,"rev-parse","--verify",_storeref() + "^{commit}" }, out, false);
+   if (!r.success())
+      return r;
+   Poco::trimInPlace(out);
+
+   // the store's history is cut off where it was fetched shallowly, and git in the checkout
+   // needs to know where (its own shallow file), or walking history fails, gc included.
+   Poco::Path shallow = getCachePath();
+   shallow.pushDirectory(".git").setFileName("shallow");
+   Poco::File storeshallow(Poco::Path(store).setFileName("shallow"));
+   try
+   {
+      if (storeshallow.exists())
+         storeshallow.copyTo(shallow.toString());
+      else if (Poco::File(shallow).exists())
+         Poco::File(shallow).remove();
+   }
+   catch (const Poco::Exception & e)
+   {
+      return cError("Unable to copy the shallow commits for " + getCachePath().toString() + ": " + e.displayText());
+   }
+
+   return runGitCommand({ "checkout","--quiet","--force","--detach",out }, out, false);
+}
+
+// shallow fetch of just the tag (or branch), then check it out.
+cResult gitcache::_fetch() const
+{
+   Poco::Path gitfolder = getCachePath();
+   gitfolder.pushDirectory(".git");
+   if (!utils::fileexists(gitfolder))
+   {
+      logmsg(kLDEBUG, "Creating git cache for " + mURL);
+      runGitCommand({ "init","--quiet" });
+      runGitCommand({ "remote","add","origin",mURL });
+   }
+
+   if (_useSharedStore())
+   {
+      if (_fetchshared().success())
+         return kRSuccess;
+      logmsg(kLDEBUG, "Couldn't use the shared git store for " + mURL + ", fetching into the checkout.");
+   }
+
+   std::string out;
+   logmsg(kLDEBUG, "Fetching " + mTag + " via git.");
+   if (runGitCommand({ "fetch","--depth","1","--no-tags","origin",mTag }, out, false).success())
+      return runGitCommand({ "checkout","--quiet","--force","--detach","FETCH_HEAD" });
+
+   // e.g. a commit hash the server won't serve by itself.
+   logmsg(kLDEBUG, "Shallow fetch of " + mTag + " failed, fetching everything.");
+   cResult r = runGitCommand({ "fetch","--tags","origin" }, out, false);
+   if (r.success())
+      r += runGitCommand({ "checkout","--quiet","--force","--detach",mTag }, out, false);
+   return r;
+}
+
+// Concurrent users (a parallel updateall, registry refreshes) hold the whole cache shared
+// and their own entry exclusively. clean holds the whole cache exclusively.
+static Poco::Path _lockPath()
+{
+   return drunnerPaths::getPath_GitCache().setFileName("gitcache");
+}
+
 cResult gitcache::get(Poco::Path & p, bool forceUpdate) const
 {
-   // checkout repo, copy subfolder if present.
-   // git clone --progress -b master --depth 1 https://github.com/drunner/d10_rocketchat
+   persistence::filelock all(_lockPath(), true);
+   persistence::filelock mine(drunnerPaths::getPath_GitCache().setFileName(hash(mURL)));
+   return _get(p, forceUpdate);
+}
+
+cResult gitcache::_get(Poco::Path & p, bool forceUpdate) const
+{
    drunner_assert(mURL.length() > 0, "Empty URL given to gitcache");
 
-   cResult r;
    p = getCachePath();
 
-   Poco::Path gitfolder = p;
-   gitfolder.pushDirectory(".git");
+   int64_t now = (int64_t)std::time(NULL);
+   gitrefs refs;
+   gitref * cached = refs.find(mURL, mTag);
+   std::string head = _head();
 
-   if (utils::fileexists(gitfolder))
-   {
-      if (forceUpdate)
+   if (cached != NULL && head.length() > 0 && cached->commit == head)
+   { // the checkout is what the tag last resolved to.
+      if (!forceUpdate || now - cached->checked < mTTL)
       {
-         logmsg(kLDEBUG, "Updating via git.");
-         r+= runGitCommand({ "pull" });
+         logmsg(kLDEBUG, "Using cached " + mTag + " (" + head + ") of " + mURL);
+         if (now - cached->used < 3600)
+            return kRSuccess; // recent enough, save the write.
+         cached->used = now;
+         return refs.save();
       }
    }
-   else
+
+   // ask the remote - much cheaper than fetching.
+   gitref ref;
+   ref.commit = _lsremote();
+   if (ref.commit.length() == 0 && mTag == head)
+      ref.commit = head; // tag is the commit itself.
+
+   if (ref.commit.length() == 0 || ref.commit != head)
    {
-      logmsg(kLDEBUG, "Cloning via git.");
-      r+= runGitCommand({ "clone","--progress",mURL,"." });
-      //      r+= runGitCommand({ "clone","--progress","-b",mTag,"--depth","1",mURL,"." });
+      cResult r = _fetch();
+      if (!r.success())
+      {
+         if (cached == NULL || head.length() == 0 || cached->commit != head)
+            return r;
+         logmsg(kLWARN, "Couldn't update " + mURL + ", using the cached copy of " + mTag + ".");
+         return kRSuccess;
+      }
+      ref.commit = _head();
    }
+   else
+      logmsg(kLDEBUG, mTag + " of " + mURL + " is unchanged (" + head + ")");
 
-   logmsg(kLDEBUG, "Checking out tag "+mTag+" via git.");
-   r+=runGitCommand({ "checkout",mTag });
-   return r;
+   ref.checked = ref.used = now;
+   refs.set(mURL, mTag, ref);
+   return refs.save();
 }
 
-// copies the contents of src to dest.
-cResult gitcache::recursiveCopyContents(Poco::Path src, Poco::Path dest, std::string skipDir)
+static uint64_t _dirsize(Poco::Path dir)
 {
-   if (!utils::fileexists(dest))
-      return cError("Destination directory does not exist.");
+   uint64_t total = 0;
+   std::vector<Poco::File> files;
+   Poco::File(dir).list(files);
+   for (const auto & f : files)
+      if (f.isLink())
+         continue;
+      else if (f.isDirectory())
+         total += _dirsize(Poco::Path(f.path()).makeDirectory());
+      else
+         total += f.getSize();
+   return total;
+}
 
-   logmsg(kLDEBUG, "Copying tree contents in " + src.toString() + " to " + dest.toString());
+static std::string _mb(uint64_t bytes)
+{
+   return std::to_string((bytes + 512 * 1024) / (1024 * 1024)) + " MB";
+}
 
-   try
+cResult gitcache::clean(int maxagedays)
+{
+   Poco::Path root = drunnerPaths::getPath_GitCache();
+   if (!utils::fileexists(root))
+      return kRNoChange;
+
+   persistence::filelock lock(_lockPath());
+   uint64_t before = _dirsize(root);
+   int64_t cutoff = (int64_t)std::time(NULL) - (int64_t)maxagedays * 24 * 60 * 60;
+
+   // expire unused entries. A checkout that lost one of its tags is removed too, as
+   // its objects may be pruned from the store below.
+   gitrefs refs;
+   std::set<std::string> liverefs, livedirs, deaddirs;
+   std::map<std::string, gitref> all = refs.getAll();
+   for (const auto & x : all)
    {
-      Poco::DirectoryIterator end;
-      for (Poco::DirectoryIterator it(src); it != end; ++it)
+      std::string url, tag;
+      gitrefs::splitKey(x.first, url, tag);
+      if (x.second.used < cutoff)
       {
-         if (it->isDirectory())
-         {
-            Poco::Path p( it->path() );
-            p.makeDirectory();
-            drunner_assert(p.depth() > 1, "Asked to copy from root directory. Disallowed.");
-            drunner_assert(p.isDirectory(), "Converted path is not a directory.");
-            std::string dirname = p[p.depth() - 1];
-
-            if (Poco::icompare(dirname, skipDir) != 0)
-            {
-               drunner_assert(dirname.length() > 0, "Empty path.");
-               logmsg(kLDEBUG, "Copying folder "+it->path()+" ("+  dirname + ") to "+dest.toString());
-
-               Poco::Path subdest(dest);
-               subdest.pushDirectory(dirname);
-               utils::makedirectory(subdest, S_700);
-               recursiveCopyContents(it->path(), subdest);
-            }
-            else
-               logmsg(kLDEBUG, "Skipping .git directory tree");
-         }
-         else
-         {
-            drunner_assert(it->path().length() > 0, "Empty file path.");
-            it->copyTo(dest.toString());
-            logmsg(kLDEBUG, "Copied " + it->path() + " to " + dest.toString());
-         }
+         drunner_log(kLDEBUG, "Expiring {} of {}", tag, url);
+         refs.erase(url, tag);
+         deaddirs.insert(hash(url));
       }
+      else
+      {
+         liverefs.insert("refs/cache/" + hash(url) + "/" + tag);
+         livedirs.insert(hash(url));
+      }
+   }
+   for (const auto & d : deaddirs)
+      livedirs.erase(d);
+
+   std::string out;
+   Poco::Path store(root);
+   store.pushDirectory(kStore);
+   bool hasstore = utils::fileexists(store);
+   if (hasstore && _rungit(root, { "--git-dir=" + kStore,"for-each-ref","--format=%(refname)","refs/cache/" }, out, false).success())
+   {
+      Poco::StringTokenizer lines(out, "\n", Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+      for (const auto & ref : lines)
+         if (liverefs.find(ref) == liverefs.end())
+            _rungit(root, { "--git-dir=" + kStore,"update-ref","-d",ref }, out, false);
    }
-   catch (Poco::Exception & e)
+
+   int removed = 0;
+   std::vector<Poco::File> entries;
+   Poco::File(root).list(entries);
+   for (const auto & f : entries)
    {
-      fatal(e.what());
+      std::string name = Poco::Path(f.path()).getFileName();
+      if (!f.isDirectory() || name == kStore || livedirs.find(name) != livedirs.end())
+         continue;
+      drunner_log(kLDEBUG, "Removing unused git cache {}", f.path());
+      utils::deltree(Poco::Path(f.path()).makeDirectory());
+      ++removed;
    }
-   logmsg(kLDEBUG, "Finished copying " + src.toString() + " to " + dest.toString());
-   return kRSuccess;
-}
+   cResult r = refs.save();
 
-//cResult gitcache::copyRepoTo(Poco::Path dest, bool forceUpdate) const
-//{
-//   logmsg(kLDEBUG, "Copying repo " + mURL + " with tag " + mTag + " to " + dest.toString());
-//
-//   Poco::Path p;
-//   cResult r = get(p, forceUpdate);
-//   if (!r.success())
-//      return r;
-//
-//   drunner_assert(utils::fileexists(p), "Directory does not exist: " + p.toString());
-//
-//   return recursiveCopyContents(p, dest);
-//}
+   // compact what's left. Checkouts that borrow from the store have no objects of their own to
+   // pack, so only those that fetched for themselves are gc'd.
+   logmsg(kLINFO, "Compacting the git cache.");
+   if (hasstore)
+      r += _rungit(root, { "--git-dir=" + kStore,"gc","--quiet","--prune=now" }, out, false);
+   for (const auto & d : livedirs)
+   {
+      Poco::Path dir(root);
+      dir.pushDirectory(d);
+      Poco::Path git = Poco::Path(dir).pushDirectory(".git");
+      if (utils::fileexists(git) && !utils::fileexists(Poco::Path(git).pushDirectory("objects").pushDirectory("info").setFileName("alternates")))
+         r += _rungit(dir, { "gc","--quiet","--prune=now" }, out, false);
+   }
 
+   uint64_t after = _dirsize(root);
+   logmsg(kLINFO, "Git cache: removed " + std::to_string(removed) + " unused entries, " + _mb(before) + " -> " + _mb(after) + ".");
+   return r;
+}
 
-std::string gitcache::hash(std::string url) const
+std::string gitcache::hash(std::string url)
 {
    using Poco::DigestOutputStream;
    using Poco::DigestEngine;
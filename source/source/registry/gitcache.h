@@ -2,25 +2,81 @@
 #define __GITCACHE_H
 
 #include <string>
+#include <map>
+#include <set>
+#include <cereal/access.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/map.hpp>
+
 #include "Poco/Path.h"
 #include "cresult.h"
 
+// what a (url, tag) last resolved to, and when.
+class gitref
+{
+public:
+   gitref() : checked(0), used(0) {}
+
+   std::string commit;
+   int64_t checked; // when the remote was last asked (seconds since epoch).
+   int64_t used;    // when the checkout was last used.
+
+private:
+   // --- serialisation --
+   friend class cereal::access;
+   template <class Archive> void serialize(Archive &ar, std::uint32_t const version) { ar(commit, checked, used); }
+   // --- serialisation --
+};
+CEREAL_CLASS_VERSION(gitref, 1);
+
+class gitrefs
+{
+public:
+   gitrefs();
+
+   gitref * find(std::string url, std::string tag);
+   void set(std::string url, std::string tag, const gitref & ref);
+   void erase(std::string url, std::string tag);
+   cResult save(); // merges with concurrent changes and writes now.
+
+   const std::map<std::string, gitref> & getAll() const { return mRefs; }
+   static void splitKey(std::string key, std::string & url, std::string & tag);
+
+private:
+   static std::string _key(std::string url, std::string tag) { return url + " " + tag; }
+   Poco::Path mPath;
+   std::map<std::string, gitref> mRefs;
+   std::set<std::string> mTouched; // keys we may have changed.
+};
+
 class gitcache
 {
 public:
    gitcache(std::string url, std::string tag = "");
 
    cResult get(Poco::Path & p, bool forceUpdate = false) const;
-   
-   static cResult recursiveCopyContents(Poco::Path src, Poco::Path dest, std::string skipDir=".git");
+   Poco::Path getCachePath() const;
+   std::string getCommit() const; // the commit the tag last resolved to (empty if never fetched).
+   void setTTL(int seconds) { mTTL = seconds; } // how long a resolved tag is trusted.
+
+   // expire entries unused for maxagedays and compact what's left (drunner clean --gitcache).
+   static cResult clean(int maxagedays);
 
 private:
-   std::string hash(std::string url) const;
+   static std::string hash(std::string url);
+   cResult _get(Poco::Path & p, bool forceUpdate) const;
    cResult runGitCommand(std::vector<std::string> args) const;
-   Poco::Path getCachePath() const;
+   cResult runGitCommand(std::vector<std::string> args, std::string & out, bool errorsFatal) const;
+   static cResult _rungit(Poco::Path dir, std::vector<std::string> args, std::string & out, bool errorsFatal);
+
+   std::string _head() const;
+   std::string _lsremote() const;
+   cResult _fetch() const;
+   cResult _fetchshared() const;
+   std::string _storeref() const { return "refs/cache/" + hash(mURL) + "/" + mTag; }
 
    std::string mURL, mTag;
+   int mTTL;
 };
 
 #endif
-
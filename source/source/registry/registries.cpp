@@ -2,8 +2,6 @@
 
 #include "Poco/String.h"
 #include "Poco/File.h"
-#include <cereal/archives/json.hpp>
-#include <fstream>
 
 #include "utils.h"
 #include "utils_docker.h"
@@ -13,6 +11,9 @@
 #include "buildnum.h"
 #include "timez.h"
 #include "registry.h"
+#include "catalogue.h"
+#include "search.h"
+#include "persistence.h"
 
 registries::registries()
 {
@@ -62,22 +63,26 @@ cResult registries::showregistries()
 
 cResult registries::showAllRegistereddServices()
 {
-   for (const auto & y : mData.getAll())
+   sourcecopy::catalogue cat;
+   cResult r = cat.refresh(mData.getAll());
+   if (r.error())
+      logmsg(kLWARN, r.what());
+
+   for (const auto & y : cat.getAll())
    {
       logmsg(kLINFO, "--------------------------------------------");
-      logmsg(kLINFO, "REGISTRY " + y.mNiceName + " ("+y.mURL+")");
+      logmsg(kLINFO, "REGISTRY " + y.nicename + " ("+y.url+")");
       logmsg(kLINFO, " ");
 
-      sourcecopy::registry reg(y);
       int maxkey = 0, maxdesc = 0;
-      for (const auto & z : reg.getAll())
+      for (const auto & z : y.items)
       {
-         maxkey = utils::_max(maxkey, y.mNiceName.length() + 1 + z.nicename.length());
+         maxkey = utils::_max(maxkey, y.nicename.length() + 1 + z.nicename.length());
          maxdesc = utils::_max(maxdesc, z.description.length());
       }
-      for (const auto & z : reg.getAll())
+      for (const auto & z : y.items)
       {
-         logmsg(kLINFO, " " + utils::_pad(y.mNiceName + "/" + z.nicename, maxkey) +
+         logmsg(kLINFO, " " + utils::_pad(y.nicename + "/" + z.nicename, maxkey) +
             "   " + utils::_pad(z.description, maxdesc));
       }
       logmsg(kLINFO, " ");
@@ -86,6 +91,56 @@ cResult registries::showAllRegistereddServices()
    return kRSuccess;
 }
 
+// true if the catalogue entry is for one of the registries in defs.
+static bool _configured(const sourcecopy::catalogueentry & e, const std::vector<registrydefinition> & defs)
+{
+   for (const auto & d : defs)
+      if (Poco::icompare(d.mNiceName, e.nicename) == 0 && d.mURL == e.url)
+         return true;
+   return false;
+}
+
+cResult registries::search(std::string term)
+{
+   // the catalogue is only refreshed if it was built for a different set of registries
+   // (or never built), so searching doesn't otherwise touch git.
+   sourcecopy::catalogue cat;
+   bool same = (cat.getAll().size() == mData.getAll().size());
+   for (size_t i = 0; same && i < cat.getAll().size(); ++i)
+      same = _configured(cat.getAll()[i], mData.getAll());
+   if (!same)
+   {
+      cResult r = cat.refresh(mData.getAll());
+      if (r.error())
+         logmsg(kLWARN, r.what());
+   }
+
+   std::vector<sourcecopy::catalogueentry> entries;
+   for (const auto & e : cat.getAll())
+      if (_configured(e, mData.getAll()))
+         entries.push_back(e);
+
+   sourcecopy::searchindex index(entries);
+   std::vector<sourcecopy::searchresult> results = index.search(term);
+   if (results.size() == 0)
+   {
+      logmsg(kLINFO, "No dServices match " + term + ".");
+      return kRNoChange;
+   }
+
+   int maxkey = 0, maxdesc = 0;
+   for (const auto & z : results)
+   {
+      maxkey = utils::_max(maxkey, z.registry.length() + 1 + z.item.nicename.length());
+      maxdesc = utils::_max(maxdesc, z.item.description.length());
+   }
+   for (const auto & z : results)
+      logmsg(kLINFO, " " + utils::_pad(z.registry + "/" + z.item.nicename, maxkey) +
+         "   " + utils::_pad(z.item.description, maxdesc));
+
+   return kRSuccess;
+}
+
 registrydefinition registries::get(std::string & registry) const
 {
    // load registries and see if we can find a match for nicename.
@@ -110,44 +165,12 @@ registrydefinition registries::get(std::string & registry) const
 
 cResult registries::load()
 {
-   if (!utils::fileexists(mPath))
-      return kRNoChange;
-
-   // read the settings.
-   std::ifstream ifs(mPath.toString());
-   if (ifs.bad())
-      return cError("Unable to open " + mPath.toString() + " for reading.");
-
-   try
-   {
-      cereal::JSONInputArchive archive(ifs);
-      archive(mData);
-   }
-   catch (const cereal::Exception & e)
-   {
-      return cError("Cereal exception on reading registries: " + std::string(e.what()));
-   }
-
-   return kRSuccess;
+   return persistence::loadjson(mPath, mData);
 }
 
 cResult registries::save()
 {
-   std::ofstream ofs(mPath.toString());
-   if (ofs.bad())
-      return cError("Unable to open " + mPath.toString() + " for writing.");
-
-   try
-   {
-      cereal::JSONOutputArchive archive(ofs);
-      archive(mData);
-   }
-   catch (const cereal::Exception & e)
-   {
-      return cError("Cereal exception on writing registries: " + std::string(e.what()));
-   }
-
-   return kRSuccess;
+   return persistence::savejson(mPath, mData);
 }
 
 
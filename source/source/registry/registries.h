@@ -45,8 +45,10 @@ public:
    cResult showregistries();
 
    cResult showAllRegistereddServices();
+   cResult search(std::string term); // from the cached catalogue, without touching git.
 
    registrydefinition get(std::string & registry) const;
+   const std::vector<registrydefinition> & getAll() const { return mData.getAll(); }
    
    static cResult splitImageName(std::string imagename, std::string & registry, std::string & dService, std::string & tag);
 
@@ -11,49 +11,8 @@
 #include "sourcecopy.h"
 #include "gitcache.h"
 
-sourcecopy::registry::registry(registrydefinition r)
-{
-   gitcache gc(r.mURL);
-   logmsg(kLDEBUG, "Reading registry.");
-   Poco::Path p;
-   cResult rslt = gc.get(p, false);
-   if (!rslt.success())
-      fatal(rslt.what());
-
-   std::ifstream infile( p.toString() + "/registry");
-   if (!infile.is_open())
-      fatal("Couldn't open registry "+r.mNiceName+".");
-
-   std::string line;
-   while (std::getline(infile, line))
-   {
-      Poco::trimInPlace(line);
-      if (line.length() > 0 && line[0] != '#')
-      {
-         registryitem ri;
-         rslt +=loadline(line, ri);
-         if (rslt.success())
-            mRegistryItems.push_back(ri);
-         else
-            fatal(rslt.what());
-      }
-   }
-}
-
-cResult sourcecopy::registry::get(const std::string nicename, registryitem & item)
-{
-   for (unsigned int i = 0; i<mRegistryItems.size(); ++i)
-      if (Poco::icompare(mRegistryItems[i].nicename, nicename) == 0)
-      {
-         item = mRegistryItems[i];
-         return kRSuccess;
-      }
-
-   return cError(nicename + " does not exist in registry.");
-}
-
 // returns index of separating space.
-int getchunk(std::string l)
+static int getchunk(std::string l)
 {
    drunner_assert(l.length() > 0, "getchunk passed empty string.");
    drunner_assert(!iswspace(l[0]), "gitchunk given untrimmed string.");
@@ -68,7 +27,7 @@ int getchunk(std::string l)
    return l.length();
 }
 
-cResult sourcecopy::registry::loadline(const std::string line, registryitem & ri)
+static cResult loadline(const std::string line, sourcecopy::registryitem & ri)
 {
    // expect three whitespace separated strings.
    std::vector<std::string> chunks;
@@ -88,8 +47,28 @@ cResult sourcecopy::registry::loadline(const std::string line, registryitem & ri
    ri.url = chunks[1];
    ri.description = chunks[2];
 
-   logmsg(kLDEBUG, "<" + ri.nicename + "><" + ri.url + "><" + ri.description + ">");
-
    return kRSuccess;
 }
 
+cResult sourcecopy::parseregistry(Poco::Path path, std::vector<registryitem> & items)
+{
+   items.clear();
+   std::ifstream infile(path.toString());
+   if (!infile.is_open())
+      return cError("Couldn't open registry file " + path.toString());
+
+   std::string line;
+   while (std::getline(infile, line))
+   {
+      Poco::trimInPlace(line);
+      if (line.length() > 0 && line[0] != '#')
+      {
+         registryitem ri;
+         cResult rslt = loadline(line, ri);
+         if (!rslt.success())
+            return rslt;
+         items.push_back(ri);
+      }
+   }
+   return kRSuccess;
+}
@@ -2,9 +2,12 @@
 #define __REGISTRY_H
 
 #include <string>
+#include <vector>
 #include <cereal/access.hpp>
 #include <cereal/types/string.hpp>
 
+#include "Poco/Path.h"
+
 #include "cresult.h"
 
 
@@ -38,25 +41,18 @@ namespace sourcecopy
       std::string nicename;
       std::string url;
       std::string description;
-   };
-
-   class registry
-   {
-   public:
-      registry(registrydefinition r);
-      
-      cResult get(
-         const std::string nicename,
-         registryitem & item
-      );
-
-      const std::vector<registryitem> & getAll() { return mRegistryItems; }
 
    private:
-      cResult loadline(const std::string line, registryitem & ri);
-      std::vector<registryitem> mRegistryItems;
+      // --- serialisation --
+      friend class ::cereal::access;
+      template <class Archive> void serialize(Archive &ar, std::uint32_t const version) { ar(nicename, url, description); }
+      // --- serialisation --
    };
+
+   // reads the registry file (lines of: nicename GitURI description) at path.
+   cResult parseregistry(Poco::Path path, std::vector<registryitem> & items);
 }
+CEREAL_CLASS_VERSION(sourcecopy::registryitem, 1);
 
 
 #endif
\ No newline at end of file
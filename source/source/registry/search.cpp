@@ -0,0 +1,98 @@
+#include <algorithm>
+
+#include "Poco/String.h"
+
+#include "search.h"
+
+namespace sourcecopy
+{
+   // the distinct trigrams of s, padded so short words and word ends still count.
+   static std::vector<uint32_t> _trigrams(const std::string & s)
+   {
+      std::string p = " " + s + " ";
+      std::vector<uint32_t> t;
+      for (size_t i = 0; i + 3 <= p.length(); ++i)
+         t.push_back(((uint32_t)(unsigned char)p[i] << 16) | ((uint32_t)(unsigned char)p[i + 1] << 8) | (unsigned char)p[i + 2]);
+      std::sort(t.begin(), t.end());
+      t.erase(std::unique(t.begin(), t.end()), t.end());
+      return t;
+   }
+
+   searchindex::searchindex(const std::vector<catalogueentry> & entries)
+   {
+      for (const auto & e : entries)
+         for (const auto & item : e.items)
+         {
+            document d;
+            d.registry = e.nicename;
+            d.item = item;
+            d.name = Poco::toLower(item.nicename);
+            d.text = d.name + " " + Poco::toLower(item.description);
+
+            uint32_t id = (uint32_t)mDocs.size();
+            mDocs.push_back(d);
+            for (uint32_t t : _trigrams(mDocs.back().text))
+               mPostings[t].push_back(id);
+         }
+   }
+
+   std::vector<searchresult> searchindex::search(std::string term, size_t maxresults) const
+   {
+      std::vector<searchresult> results;
+      term = Poco::toLower(Poco::trim(term));
+      if (term.length() == 0)
+         return results;
+
+      // count the query's trigrams in each document.
+      std::vector<uint32_t> q = _trigrams(term);
+      std::vector<uint16_t> hits(mDocs.size(), 0);
+      for (uint32_t t : q)
+      {
+         auto it = mPostings.find(t);
+         if (it != mPostings.end())
+            for (uint32_t id : it->second)
+               ++hits[id];
+      }
+
+      // score from the index, then only build results for the best.
+      std::vector<std::pair<double, uint32_t> > scored;
+      for (size_t i = 0; i < mDocs.size(); ++i)
+      {
+         if (hits[i] == 0)
+            continue;
+
+         const document & d(mDocs[i]);
+         double score = (double)hits[i] / q.size();
+         if (d.name == term)
+            score += 4;
+         else if (d.name.compare(0, term.length(), term) == 0)
+            score += 3;
+         else if (d.name.find(term) != std::string::npos)
+            score += 2;
+         else if (d.text.find(term) != std::string::npos)
+            score += 1;
+         else if (score < 0.5)
+            continue;
+         scored.push_back(std::make_pair(score, (uint32_t)i));
+      }
+
+      size_t n = std::min(maxresults, scored.size());
+      std::partial_sort(scored.begin(), scored.begin() + n, scored.end(),
+         [this](const std::pair<double, uint32_t> & a, const std::pair<double, uint32_t> & b) {
+         if (a.first != b.first)
+            return a.first > b.first;
+         return mDocs[a.second].name < mDocs[b.second].name;
+      });
+
+      for (size_t i = 0; i < n; ++i)
+      {
+         searchresult r;
+         r.registry = mDocs[scored[i].second].registry;
+         r.item = mDocs[scored[i].second].item;
+         r.score = scored[i].first;
+         results.push_back(r);
+      }
+      return results;
+   }
+
+} // namespace
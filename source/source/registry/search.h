@@ -0,0 +1,44 @@
+#ifndef __SEARCH_H
+#define __SEARCH_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "catalogue.h"
+
+namespace sourcecopy
+{
+   class searchresult
+   {
+   public:
+      std::string registry;
+      registryitem item;
+      double score;
+   };
+
+   // Trigram index over the names and descriptions of the dServices in a catalogue (drunner search).
+   class searchindex
+   {
+   public:
+      searchindex(const std::vector<catalogueentry> & entries);
+
+      // best first: substring matches rank above fuzzy ones, and the name counts for more than
+      // the description. Fuzzy matches must share at least half of the term's trigrams.
+      std::vector<searchresult> search(std::string term, size_t maxresults = 20) const;
+
+   private:
+      class document
+      {
+      public:
+         std::string registry;
+         registryitem item;
+         std::string name, text; // lower case.
+      };
+
+      std::vector<document> mDocs;
+      std::unordered_map<uint32_t, std::vector<uint32_t> > mPostings; // trigram -> documents, ascending.
+   };
+}
+
+#endif
@@ -6,6 +6,8 @@
 #include "globalcontext.h"
 #include "buildnum.h"
 #include "gitcache.h"
+#include "treesync.h"
+#include "catalogue.h"
 #include "dassert.h"
 
 namespace sourcecopy
@@ -38,49 +40,66 @@ namespace sourcecopy
 
 
 
-   cResult _installfrom(Poco::Path p, const servicePaths & sp)
-   {
-      Poco::Path target = sp.getPathdService();
-
-      if (getServiceLuaParent(p).success())
-         return gitcache::recursiveCopyContents(p, target);
-
-      return cError("Unable to locate service.lua at " + p.toString());
-   }
-
-
    // -----------------------------------------------------------------------------
-   // Install the imagename.
-   cResult install(std::string imagename, const servicePaths & sp)
+   // Find the dService definition for imagename, fetching it if needed.
+   cResult resolve(std::string imagename, Poco::Path & p, std::string & commit)
    {
+      commit = "";
+
       std::string localstr = "local:";
       if (Poco::icompare(imagename.substr(0, localstr.length()), localstr) == 0)
       {
          imagename.erase(0, localstr.length());
          drunner_assert(imagename.length() > 0, "Empty folder passed to install_local.");
-         return _installfrom(imagename, sp);
+         p = Poco::Path(imagename);
       }
+      else
+      {
+         registries regall;
+
+         std::string registry, dService, tag;
+         registries::splitImageName(imagename, registry, dService, tag);
 
-      registries regall;
+         regall.get(registry); // fatal if the registry isn't configured.
 
-      std::string registry, dService, tag;
-      registries::splitImageName(imagename, registry, dService, tag);
+         sourcecopy::catalogue cat;
+         cResult refreshrslt = cat.refresh(regall.getAll());
+         if (refreshrslt.error())
+            logmsg(kLWARN, refreshrslt.what());
 
-      registrydefinition regdef = regall.get(registry);
-      
-      sourcecopy::registry r(regdef);
-      sourcecopy::registryitem regitem;
-      cResult getrslt = r.get(dService, regitem);
-      if (!getrslt.success())
-         return getrslt;
+         sourcecopy::registryitem regitem;
+         cResult getrslt = cat.find(registry, dService, regitem);
+         if (!getrslt.success())
+            return getrslt;
 
-      Poco::Path p;
-      gitcache gc(regitem.url, tag);
-      cResult rslt = gc.get(p, true);
-      if (!rslt.success())
-         return rslt;
+         gitcache gc(regitem.url, tag);
+         cResult rslt = gc.get(p, true);
+         if (!rslt.success())
+            return rslt;
+         commit = gc.getCommit();
+      }
+
+      if (!getServiceLuaParent(p).success())
+         return cError("Unable to locate service.lua at " + p.toString());
+      return kRSuccess;
+   }
+
+   // -----------------------------------------------------------------------------
+   // Install the imagename.
+   cResult install(std::string imagename, const servicePaths & sp, treesync::summary * changes, source * used)
+   {
+      source src;
+      cResult r = resolve(imagename, src.path, src.commit);
+      if (!r.success())
+         return r;
 
-      return _installfrom(p,sp);
+      treesync::summary s;
+      r = treesync::sync(src.path, sp.getPathdService(), s);
+      if (changes != NULL)
+         *changes = s;
+      if (used != NULL)
+         *used = src;
+      return r;
    }
 
    cResult normaliseNames(std::string & imagename, std::string & servicename)
@@ -3,10 +3,24 @@
 
 #include "utils.h"
 #include "service_paths.h"
+#include "treesync.h"
 
 namespace sourcecopy
 {
-   cResult install(std::string imagename, const servicePaths & sp);
+   // where a dService definition came from.
+   struct source
+   {
+      Poco::Path path;    // the folder holding its service.lua.
+      std::string commit; // empty for local: images.
+   };
+
+   // locates the folder holding the dService definition for imagename (fetching it into the git cache if needed),
+   // and the git commit it came from (empty for local: images).
+   cResult resolve(std::string imagename, Poco::Path & p, std::string & commit);
+
+   // syncs the dService definition into the service's folder, optionally reporting what changed
+   // and where it came from.
+   cResult install(std::string imagename, const servicePaths & sp, treesync::summary * changes = NULL, source * used = NULL);
    cResult normaliseNames(std::string & imagename, std::string & servicename);
    cResult registrycommand();
 
@@ -20,11 +20,17 @@
 
 
 service::service(std::string servicename) : 
-   servicePaths(servicename),
-   mServiceVars(servicename)
+   servicePaths(servicename)
 {
 }
 
+serviceVars & service::_vars() const
+{
+   if (!mServiceVars)
+      mServiceVars.reset(new serviceVars(mName));
+   return *mServiceVars;
+}
+
 cResult service::servicecmd()
 {
    const params & p(*GlobalContext::getParams());
@@ -43,7 +49,7 @@ cResult service::servicecmd()
 
    // handle configure
    if (0 == Poco::icompare(cl.command, "configure"))
-      return mServiceVars.handleConfigureCommand(cl);
+      return _vars().handleConfigureCommand(cl);
 
    // check reserved commands
    if (p.isdrunnerCommand(cl.command) && cl.command != "help")
@@ -62,7 +68,7 @@ cResult service::runLuaFunction(CommandLine cl)
    for (const auto & x : cl.args) oss << " " << x;
    logmsg(kLDEBUG, "serviceCmd is: " + oss.str());
 
-   servicelua::luafile sl(mServiceVars,cl);
+   servicelua::luafile sl(mName, [this]() -> serviceVars & { return _vars(); }, cl);
    cResult rval = sl.getResult();
 
    if (rval == kRNotImplemented)
@@ -73,5 +79,5 @@ cResult service::runLuaFunction(CommandLine cl)
 
 const std::string service::getImageName() const
 {
-   return mServiceVars.getImageName();
+   return _vars().getImageName();
 }
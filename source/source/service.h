@@ -17,7 +17,7 @@ public:
    service(std::string servicename); 
 
    const std::string getImageName() const;
-   const serviceVars & getServiceVars() const { return mServiceVars; }
+   const serviceVars & getServiceVars() const { return _vars(); }
 
 
    cResult backup(std::string backupfile);
@@ -28,8 +28,11 @@ public:
 private:
    cResult _runserviceRunnerCommand(const CommandLine & serviceCmd) const;
    cResult _dstop(const CommandLine & operation) const;
+   serviceVars & _vars() const; // loaded on first use.
 
-   serviceVars mServiceVars; // the full configuration for the service. Includes config from service.lua + extras.
+   // the full configuration for the service. Includes config from service.lua + extras.
+   // Loading it scans service.lua and reads the saved variables, so it's left until needed.
+   mutable std::unique_ptr<serviceVars> mServiceVars;
 };
 
 
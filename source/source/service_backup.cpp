@@ -1,4 +1,5 @@
 #include <cstdlib>
+#include <ctime>
 
 #include <Poco/File.h>
 #include <Poco/String.h>
@@ -14,6 +15,7 @@
 #include "utils_docker.h"
 #include "dassert.h"
 #include "service_lua.h"
+#include "service_index.h"
 
 // Back up this service to backupfile.
 cResult service::backup(std::string backupfile)
@@ -42,8 +44,8 @@ cResult service::backup(std::string backupfile)
 
    // -----------------------------------------
    // back up whatever the dService tells us to
-   mServiceVars.setTempBackupFolder(paths.getPathSubArchives().toString());
-   servicelua::luafile lf(mServiceVars, CommandLine("backup"));
+   _vars().setTempBackupFolder(paths.getPathSubArchives().toString());
+   servicelua::luafile lf(_vars(), CommandLine("backup"));
    if (!lf.getResult().success())
       fatal("Failed to run backup command in the dService's service.lua.");
 
@@ -93,6 +95,12 @@ cResult service::backup(std::string backupfile)
    logmsg(kLINFO, "Time to move archive:             " + tstep.getelpased());
    tstep.restart();
 
+   int64_t when = (int64_t)time(NULL);
+   uint64_t size = (uint64_t)Poco::File(bf).getSize();
+   cResult r = serviceindex::update(mName, [when, size](serviceinfo & e) { e.lastbackup = when; e.lastbackupsize = size; });
+   if (r.error())
+      logmsg(kLWARN, "Couldn't record the backup in the service index:\n " + r.what());
+
    // -----------------------------------------
    // Output results.
    logmsg(kLINFO, "Archive of service " + getName() + " created at " + bf.toString());
@@ -166,6 +174,7 @@ cResult service_manage::service_restore(const std::string & backupfile, std::str
 
    // -----------------------------------------
    // restore whatever the dService tells us to
+   utils_docker::dockerrecorder recorder;
    serviceVars sv(servicename);
    sv.setTempBackupFolder(backuppaths.getPathSubArchives().toString());
    servicelua::luafile lf(sv, CommandLine("restore"));
@@ -175,6 +184,11 @@ cResult service_manage::service_restore(const std::string & backupfile, std::str
    logmsg(kLINFO, "Time for dService lua restore: " + tstep.getelpased());
    tstep.restart();
 
+   const std::vector<std::string> & volumes(recorder.getVolumes());
+   cResult r = serviceindex::update(servicename, [&volumes](serviceinfo & e) { e.volumes = volumes; });
+   if (r.error())
+      logmsg(kLWARN, "Couldn't add " + servicename + " to the service index:\n " + r.what());
+
    // -----------------------------------------
    // Output results.
    logmsg(kLINFO, "The backup " + bf.toString() + " has been restored.");
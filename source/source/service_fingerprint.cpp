@@ -0,0 +1,82 @@
+#include "service_fingerprint.h"
+#include "service_paths.h"
+#include "sourcecopy.h"
+#include "treesync.h"
+#include "utils_docker.h"
+#include "persistence.h"
+#include "globallogger.h"
+#include "buildnum.h"
+
+cResult servicefingerprint::compute(std::string imagename, const std::vector<std::string> & images)
+{
+   sourcecopy::source src;
+   cResult r = sourcecopy::resolve(imagename, src.path, src.commit);
+   if (!r.success())
+      return r;
+   return compute(src, images);
+}
+
+cResult servicefingerprint::compute(const sourcecopy::source & src, const std::vector<std::string> & images)
+{
+   mDrunner = getVersionStr();
+   mCommit = src.commit;
+
+   mTree = treesync::treehash(src.path);
+   if (mTree.length() == 0)
+      return cError("Couldn't hash the dService definition at " + src.path.toString());
+
+   mImages.clear();
+   for (const auto & image : images)
+   {
+      cResult r = utils_docker::pullImage(image);
+      if (!r.success())
+         return r;
+      r = utils_docker::getImageID(image, mImages[image]);
+      if (!r.success())
+         return r;
+   }
+   return kRSuccess;
+}
+
+cResult servicefingerprint::load(std::string servicename)
+{
+   return persistence::loadjson(servicePaths(servicename).getPathFingerprint(), *this);
+}
+
+cResult servicefingerprint::save(std::string servicename) const
+{
+   return persistence::savejson(servicePaths(servicename).getPathFingerprint(), *this);
+}
+
+std::vector<std::string> servicefingerprint::getImages() const
+{
+   std::vector<std::string> images;
+   for (const auto & x : mImages)
+      images.push_back(x.first);
+   return images;
+}
+
+std::string servicefingerprint::differences(const servicefingerprint & other) const
+{
+   std::string d;
+   if (mDrunner != other.mDrunner)
+      d += "drunner " + (other.mDrunner.length() > 0 ? other.mDrunner : std::string("(older)")) + " -> " + mDrunner + "\n";
+   if (mCommit != other.mCommit)
+      d += "definition commit " + other.mCommit + " -> " + mCommit + "\n";
+   else if (mTree != other.mTree)
+      d += "definition files changed\n";
+
+   for (const auto & x : mImages)
+   {
+      auto it = other.mImages.find(x.first);
+      if (it == other.mImages.end())
+         d += "image " + x.first + " added\n";
+      else if (it->second != x.second)
+         d += "image " + x.first + " changed\n";
+   }
+   for (const auto & x : other.mImages)
+      if (mImages.find(x.first) == mImages.end())
+         d += "image " + x.first + " removed\n";
+
+   return d;
+}
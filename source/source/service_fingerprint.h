@@ -0,0 +1,58 @@
+#ifndef __SERVICE_FINGERPRINT_H
+#define __SERVICE_FINGERPRINT_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <cereal/access.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/map.hpp>
+
+#include "cresult.h"
+#include "sourcecopy.h"
+
+// What an installed service was built from: the git commit of its definition, a hash of
+// the definition tree, the IDs of the images its install pulled and the drunner version
+// that generated its launch scripts. If all of these are unchanged then an update has
+// nothing to do.
+class servicefingerprint
+{
+public:
+   servicefingerprint() {}
+
+   // fingerprint imagename as it is now. Fetches the definition (within the git cache TTL)
+   // and pulls the given images (subject to the usual pull settings) to find their IDs.
+   cResult compute(std::string imagename, const std::vector<std::string> & images);
+
+   // fingerprint the definition an install used, rather than fetching it again.
+   cResult compute(const sourcecopy::source & src, const std::vector<std::string> & images);
+
+   cResult load(std::string servicename);
+   cResult save(std::string servicename) const;
+
+   std::vector<std::string> getImages() const;
+
+   // human readable list of what differs from other, empty if nothing.
+   std::string differences(const servicefingerprint & other) const;
+   bool operator==(const servicefingerprint & other) const { return differences(other).length() == 0; }
+
+private:
+   std::string mCommit; // empty for local: installs.
+   std::string mTree;
+   std::map<std::string, std::string> mImages; // image -> image ID.
+   std::string mDrunner; // drunner's version. Empty in version 1 fingerprints, so they're all updated once.
+
+   // --- serialisation --
+   friend class cereal::access;
+   template <class Archive> void serialize(Archive &ar, std::uint32_t const version)
+   {
+      ar(mCommit, mTree, mImages);
+      if (version >= 2)
+         ar(mDrunner);
+   }
+   // --- serialisation --
+};
+CEREAL_CLASS_VERSION(servicefingerprint, 2);
+
+#endif
@@ -0,0 +1,183 @@
+#include <map>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+
+#include <cereal/types/map.hpp>
+
+#include "service_index.h"
+#include "service_vars.h"
+#include "drunner_paths.h"
+#include "persistence.h"
+#include "proxy.h"
+#include "exceptions.h"
+#include "globallogger.h"
+#include "utils.h"
+
+namespace serviceindex
+{
+   typedef std::map<std::string, serviceinfo> tIndex; // servicename -> entry.
+
+   Poco::Path indexPath()
+   {
+      return drunnerPaths::getPath_Settings().setFileName("dRunner_Services.json");
+   }
+
+   static tIndex _load()
+   {
+      tIndex index;
+      if (persistence::loadjson(indexPath(), index).error())
+      { // it's rebuilt from the services.
+         logmsg(kLDEBUG, "Ignoring unreadable " + indexPath().toString());
+         index.clear();
+      }
+      return index;
+   }
+
+   static cResult _save(const tIndex & index)
+   {
+      cResult r = persistence::savejson(indexPath(), index);
+      if (!r.error())
+         r = persistence::flush(indexPath());
+      return r.error() ? r : cResult(kRSuccess);
+   }
+
+   static proxydata _proxydata()
+   {
+      proxydata pd;
+      if (persistence::loadjson(proxy::saveFilePath(), pd).error())
+         pd.mProxyData.clear();
+      return pd;
+   }
+
+   // the domains and containers from the proxy configuration.
+   static void _refreshproxy(serviceinfo & e, const proxydata & pd)
+   {
+      e.domains.clear();
+      e.containers.clear();
+      auto it = pd.mProxyData.find(proxydata::key(e.servicename));
+      if (it != pd.mProxyData.end())
+      {
+         e.domains.push_back(it->second.domain);
+         e.containers = it->second.containers();
+      }
+   }
+
+   // the image name from the service variables, and the proxy details.
+   static void _refresh(serviceinfo & e, const proxydata & pd)
+   {
+      e.imagename = serviceVars(e.servicename).getImageName();
+      _refreshproxy(e, pd);
+   }
+
+   cResult getAll(std::vector<serviceinfo> & services)
+   {
+      std::vector<std::string> installed;
+      utils::getAllServices(installed);
+      std::sort(installed.begin(), installed.end());
+
+      tIndex index = _load();
+      proxydata pd = _proxydata();
+      std::vector<serviceinfo> missing;
+      for (const auto & s : installed)
+         if (index.find(s) == index.end())
+         {
+            missing.push_back(serviceinfo());
+            missing.back().servicename = s;
+         }
+      bool stale = (index.size() + missing.size() != installed.size());
+
+      if (missing.size() > 0)
+      { // each reads its own service.lua and variables.
+         stale = true;
+         std::atomic<size_t> next(0);
+         auto worker = [&]() {
+            size_t i;
+            while ((i = next++) < missing.size())
+               try
+               {
+                  _refresh(missing[i], pd);
+               }
+               catch (const eExit &)
+               {
+                  logmsg(kLDEBUG, "Couldn't read the service variables of " + missing[i].servicename);
+               }
+         };
+
+         size_t nthreads = missing.size() < 8 ? missing.size() : 8;
+         std::vector<std::thread> threads;
+         for (size_t t = 1; t < nthreads; ++t)
+            threads.push_back(std::thread(worker));
+         worker();
+         for (auto & t : threads)
+            t.join();
+      }
+
+      if (stale)
+      {
+         persistence::filelock lock(indexPath());
+         index = _load(); // another drunner may have changed it since.
+         for (const auto & e : missing)
+            if (index.find(e.servicename) == index.end())
+               index[e.servicename] = e;
+         for (auto it = index.begin(); it != index.end();)
+            if (std::binary_search(installed.begin(), installed.end(), it->first))
+               ++it;
+            else
+               it = index.erase(it);
+
+         cResult r = _save(index);
+         if (r.error())
+            logmsg(kLWARN, "Couldn't save the service index:\n " + r.what());
+      }
+
+      // service.lua enables and disables the proxy (e.g. on start) without touching the index,
+      // so the domains and containers always come from the proxy configuration.
+      services.clear();
+      for (const auto & s : installed)
+      {
+         auto it = index.find(s);
+         if (it != index.end())
+         {
+            services.push_back(it->second);
+            _refreshproxy(services.back(), pd);
+         }
+      }
+      return kRSuccess;
+   }
+
+   cResult update(std::string servicename, std::function<void(serviceinfo &)> change)
+   {
+      serviceinfo fresh;
+      fresh.servicename = servicename;
+      try
+      {
+         _refresh(fresh, _proxydata());
+      }
+      catch (const eExit &)
+      {
+         return cError("Couldn't read the service variables of " + servicename);
+      }
+
+      persistence::filelock lock(indexPath());
+      tIndex index = _load();
+      serviceinfo & e(index[servicename]);
+      e.servicename = servicename;
+      e.imagename = fresh.imagename;
+      e.domains = fresh.domains;
+      e.containers = fresh.containers;
+      if (change)
+         change(e);
+      return _save(index);
+   }
+
+   cResult remove(std::string servicename)
+   {
+      persistence::filelock lock(indexPath());
+      tIndex index = _load();
+      if (index.erase(servicename) == 0)
+         return kRNoChange;
+      return _save(index);
+   }
+
+} // namespace
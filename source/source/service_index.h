@@ -0,0 +1,59 @@
+#ifndef __SERVICE_INDEX_H
+#define __SERVICE_INDEX_H
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <cereal/access.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+
+#include <Poco/Path.h>
+
+#include "cresult.h"
+
+// one installed service, as drunner list shows it.
+class serviceinfo
+{
+public:
+   serviceinfo() : lastbackup(0), lastbackupsize(0) {}
+
+   std::string servicename;
+   std::string imagename;
+   std::vector<std::string> volumes;    // the docker volumes its install (or restore) created.
+   std::vector<std::string> domains;    // proxied to the service.
+   std::vector<std::string> containers; // the proxied containers.
+   int64_t lastbackup;      // seconds since epoch, 0 if never backed up.
+   uint64_t lastbackupsize; // bytes.
+
+private:
+   // --- serialisation --
+   friend class cereal::access;
+   template <class Archive> void serialize(Archive &ar, std::uint32_t const version)
+   {
+      ar(servicename, imagename, volumes, domains, containers, lastbackup, lastbackupsize);
+   }
+   // --- serialisation --
+};
+CEREAL_CLASS_VERSION(serviceinfo, 1);
+
+// The installed services, kept in one small file in the settings directory so that drunner
+// list doesn't have to load every service. Install, update, restore, backup, uninstall and
+// obliterate keep it current. A service missing from it (e.g. installed by an older drunner)
+// is added the next time it's read, and one that's gone is dropped. The domains and
+// containers are read from the proxy configuration each time.
+namespace serviceindex
+{
+   // every installed service, sorted by name.
+   cResult getAll(std::vector<serviceinfo> & services);
+
+   // refresh servicename's image name and proxy domains, then apply change (if given) to its
+   // entry, all under the index lock so concurrent drunners (e.g. updateall) don't collide.
+   cResult update(std::string servicename, std::function<void(serviceinfo &)> change = nullptr);
+   cResult remove(std::string servicename);
+
+   Poco::Path indexPath();
+}
+
+#endif
@@ -2,6 +2,7 @@
 #include <ctime>
 #include <sstream>
 #include <fstream>
+#include <cstring>
 
 #include <Poco/StreamCopier.h>
 
@@ -27,29 +28,22 @@ void stripescapes(std::string &s)
    }
 }
 
-void dServiceLog(Poco::PipeInputStream & istrm_cout)
+void dServiceLog(Poco::PipeInputStream & istrm_cout, std::ostream & copy)
 {
-   escapefilter ef;
-   char buf[2] = { 'x',0 };
-   bool initialised = false;
+   servicelogger log(kLINFO);
+   char buf[65536];
 
    while (true)
-   {
+   { // block for the first byte, then take whatever else is already buffered.
       int i = istrm_cout.get();
       if (i == -1)
          return;
-      char c = (char)i;
-
-      if (ef.valid(c))
-      { // output c.
-         if (!initialised)
-            logverbatim(kLINFO, getheader(kLINFO));
-         initialised = true;
-         buf[0] = c;
-         logverbatim(kLINFO, buf);
-         if (c == '\n')
-            initialised = false;
-      }
+      buf[0] = (char)i;
+      std::streamsize n = istrm_cout.readsome(buf + 1, sizeof(buf) - 1);
+      size_t len = 1 + (size_t)(n > 0 ? n : 0);
+      copy.write(buf, len);
+      log.write(buf, len);
+      log.flushpartial(); // nothing more yet, so show a prompt now rather than when its line ends.
    }
 }
 
@@ -82,4 +76,113 @@ bool escapefilter::valid(char c)
       mStage = kSearching;
       return false;
    }
-}
\ No newline at end of file
+}
+
+void escapefilter::filter(const char * p, size_t n, std::string & out)
+{ // memchr does the scanning, a word or vector at a time, so plain text is copied in whole runs.
+   const char * end = p + n;
+   while (p < end)
+   {
+      switch (mStage)
+      {
+      case kSearching:
+      {
+         const char * esc = (const char *)memchr(p, '\033', end - p);
+         if (esc == NULL)
+         {
+            out.append(p, end - p);
+            return;
+         }
+         out.append(p, esc - p);
+         p = esc + 1;
+         mStage = kGotEscape;
+         break;
+      }
+
+      case kGotEscape:
+         if (*p == '[')
+         {
+            ++p;
+            mStage = kTriggered;
+         }
+         else
+            mStage = kSearching;
+         break;
+
+      default: // kTriggered
+      {
+         const char * m = (const char *)memchr(p, 'm', end - p);
+         if (m == NULL)
+            return;
+         p = m + 1;
+         mStage = kSearching;
+         break;
+      }
+      }
+   }
+}
+
+// -----------------------------------------------------------------------------------------
+
+servicelogger::servicelogger(eLogLevel level) : 
+   mLevel(level), mSink([level](const std::string & s) { logverbatim(level, s); }), mOpen(false)
+{
+}
+
+servicelogger::servicelogger(eLogLevel level, sink s) : mLevel(level), mSink(s), mOpen(false)
+{
+}
+
+servicelogger::~servicelogger()
+{
+   flush();
+}
+
+void servicelogger::write(const char * p, size_t n)
+{
+   mClean.clear();
+   mFilter.filter(p, n, mClean);
+
+   const char * s = mClean.data();
+   const char * end = s + mClean.length();
+   const char * nl = (const char *)memchr(s, '\n', end - s);
+   if (nl == NULL)
+   {
+      mPartial.append(s, end - s);
+      return;
+   }
+
+   std::string header = getheader(mLevel); // once per block.
+   mBatch.clear();
+   do
+   {
+      if (!mOpen)
+         mBatch += header;
+      mOpen = false;
+      mBatch += mPartial;
+      mBatch.append(s, nl + 1 - s);
+      mPartial.clear();
+      s = nl + 1;
+   } while (s < end && (nl = (const char *)memchr(s, '\n', end - s)) != NULL);
+   mPartial.append(s, end - s);
+
+   mSink(mBatch);
+}
+
+void servicelogger::flushpartial()
+{
+   if (mPartial.length() == 0)
+      return;
+   mSink((mOpen ? "" : getheader(mLevel)) + mPartial);
+   mPartial.clear();
+   mOpen = true;
+}
+
+void servicelogger::flush()
+{
+   if (mPartial.length() == 0 && !mOpen)
+      return;
+   mSink((mOpen ? "" : getheader(mLevel)) + mPartial + "\n");
+   mPartial.clear();
+   mOpen = false;
+}
@@ -4,11 +4,13 @@
 #include "enums.h"
 #include "params.h"
 #include <string>
+#include <functional>
 
 #include <Poco/PipeStream.h>
 
 
-void dServiceLog(Poco::PipeInputStream & istrm_cout);
+// log everything read from the pipe, line by line, until it closes. Also copied raw to copy.
+void dServiceLog(Poco::PipeInputStream & istrm_cout, std::ostream & copy);
 
 
 enum eStage
@@ -18,12 +20,44 @@ enum eStage
    kTriggered
 };
 
+// strips ESC [ ... m colour sequences, which may be split across calls.
 class escapefilter
 {
 public:
    escapefilter();
    bool valid(char c);
+
+   // append the bytes of [p, p+n) that aren't part of an escape sequence to out.
+   void filter(const char * p, size_t n, std::string & out);
+
    eStage mStage;
 };
 
+// Turns a service's raw output into log lines: escape sequences stripped and one header
+// per line. Each block written goes to the sink in a single call, any partial last line is
+// held back until its newline arrives (or flush). flushpartial sends it on without ending the
+// line - e.g. a prompt - and the rest of the line follows without another header.
+class servicelogger
+{
+public:
+   typedef std::function<void(const std::string &)> sink;
+
+   servicelogger(eLogLevel level = kLINFO); // to logverbatim.
+   servicelogger(eLogLevel level, sink s);
+   ~servicelogger();
+
+   void write(const char * p, size_t n);
+   void flushpartial();
+   void flush();
+
+private:
+   eLogLevel mLevel;
+   sink mSink;
+   escapefilter mFilter;
+   std::string mClean;   // this block, filtered.
+   std::string mPartial; // start of a line still to come.
+   std::string mBatch;
+   bool mOpen;           // a line has been started on the sink but not finished.
+};
+
 #endif
@@ -5,7 +5,9 @@
 #include "service_lua.h"
 #include "utils.h"
 #include "globallogger.h"
+#include "globalcontext.h"
 #include "dassert.h"
+#include "proxy.h"
 
 #include "lua.hpp"
 
@@ -19,14 +21,31 @@ namespace servicelua
 {   
  // -------------------------------------------------------------------------------
 
+   static int _luapanic(lua_State *L)
+   {
+      const char * msg = lua_tostring(L, -1);
+      logmsg(kLWARN, "Unprotected error in service.lua: " + std::string(msg ? msg : "?"));
+      return 0; // lua aborts.
+   }
+
    luafile::luafile(serviceVars & sv, const CommandLine & serviceCmd) :
-      mServicePaths(sv.getServiceName()), 
-      mServiceVars(sv)
+      luafile(sv.getServiceName(), [&sv]() -> serviceVars & { return sv; }, serviceCmd)
+   {
+   }
+
+   luafile::luafile(const std::string & servicename, varsloader loadvars, const CommandLine & serviceCmd) :
+      mServicePaths(servicename),
+      mArena([]() { return GlobalContext::hasSettings() ? GlobalContext::getSettings()->getLuaMemLimit() : (size_t)0; }),
+      mLoadVars(loadvars),
+      mServiceVars(NULL)
    {
       drunner_assert(mServicePaths.getPathServiceLua().isFile(), "Coding error: services.lua path provided to luafile is not a file!");
 
-      L = luaL_newstate();
+      L = lua_newstate(luaarena::alloc, &mArena);
+      drunner_assert(L != NULL, "Couldn't create the lua state.");
+      lua_atpanic(L, _luapanic);
       luaL_openlibs(L);
+      mArena.trackgc(L);
 
       // add pointer to ourselves, so C functions can access us.
       lua_pushlightuserdata(L, (void*)this);  // value
@@ -46,15 +65,62 @@ namespace servicelua
          mResult = validate();
       
       if (!mResult.error())
+      { // any proxy changes the command makes are applied together when it's done.
+         proxytransaction pt;
          mResult = _runCommand(serviceCmd);
+         cResult r = pt.commit();
+         if (r.error())
+            logmsg(kLWARN, "Couldn't apply the proxy changes:\n " + r.what());
+      }
    }
       
    // -------------------------------------------------------------------------------
 
+   serviceVars & luafile::getServiceVars()
+   {
+      if (!mServiceVars)
+      {
+         mServiceVars = &mLoadVars();
+         for (const auto & def : mUnchecked)
+            _checkConfiguration(def);
+         mUnchecked.clear();
+      }
+      return *mServiceVars;
+   }
+
+   void luafile::addConfiguration(envDef cf)
+   {
+      if (mServiceVars)
+         _checkConfiguration(cf);
+      else
+         mUnchecked.push_back(cf);
+   }
+
+   // just sanity check the pass serviceVars has already done.
+   void luafile::_checkConfiguration(const envDef & def)
+   {
+      const envDef * x = mServiceVars->getDef(def.name);
+      if (x != NULL)
+      {
+         if (0 != Poco::icompare(x->defaultval,def.defaultval))
+            logmsg(kLWARN, "Inconsistency of default value between quick read and lua execution for config " + def.defaultval);
+
+         if (0 != Poco::icompare(x->description, def.description))
+            logmsg(kLWARN, "Inconsistency of description between quick read and lua execution for config " + def.defaultval);
+      }
+      else
+         logmsg(kLWARN, "Inconsistency of name between quick read and lua execution for config " + def.defaultval);
+   }
+
+   // -------------------------------------------------------------------------------
+
    luafile::~luafile()
    {
       if (L)
+      {
+         logmsg(kLDEBUG, mArena.getStats());
          lua_close(L);
+      }
    }
 
    // -------------------------------------------------------------------------------
@@ -135,7 +201,7 @@ namespace servicelua
                std::string key = line.substr(pos + 2, pos2 - pos - 2);
                std::string repstr = utils::getenv(key);
                if (repstr.length() == 0)
-                  repstr = mServiceVars.getVal(key);
+                  repstr = getServiceVars().getVal(key);
                line.replace(pos, pos2 - pos + 1, repstr);
             }
          }
@@ -145,10 +211,10 @@ namespace servicelua
       // line has had variables substituted. Execute.
       int error = luaL_loadbuffer(L, wholefile.c_str(), wholefile.length(), path.toString().c_str());
       if (error)
-         fatal("Failed loading:\n" + wholefile + "\n\n" + lua_tostring(L, -1));
+         fatal("Failed loading:\n" + wholefile + "\n\n" + _luaerror());
 
       if (lua_pcall(L, 0, 0, 0) != 0)
-         fatal("Failed to execute " + path.toString() + ":\n" + lua_tostring(L, -1));
+         fatal("Failed to execute " + path.toString() + ":\n" + _luaerror());
 
 
 
@@ -180,7 +246,7 @@ namespace servicelua
          fatal("The argument returned by help was not a string, rather "+std::string(lua_typename(L,1)));
       std::string help = lua_tostring(L, 1);
 
-      logmsg(kLINFO, mServiceVars.substitute(help));
+      logmsg(kLINFO, getServiceVars().substitute(help));
       return kRSuccess;
    }
 
@@ -207,7 +273,7 @@ namespace servicelua
             lua_pushstring(L, x.c_str());
 
          if (lua_pcall(L, serviceCmd.args.size(), 1, 0) != LUA_OK)
-            fatal("Command " + serviceCmd.command + " failed:\n "+ std::string(lua_tostring(L,-1)));
+            fatal("Command " + serviceCmd.command + " failed:\n "+ _luaerror());
 
          if (!lua_isnumber(L, -1))
          {
@@ -224,6 +290,18 @@ namespace servicelua
 
    // -------------------------------------------------------------------------------
 
+   std::string luafile::_luaerror() const
+   {
+      const char * msg = lua_tostring(L, -1);
+      std::string e(msg ? msg : "(no error message)");
+      if (mArena.limitHit())
+         e += "\nThe service.lua memory limit of " + std::to_string(mArena.getLimit() / (1024 * 1024)) +
+            "MB was reached. Change it with:\n drunner configure LUAMEMLIMIT=MB";
+      return e;
+   }
+
+   // -------------------------------------------------------------------------------
+
    Poco::Path luafile::getdRunDir() const
    {
       return mdRunDir;
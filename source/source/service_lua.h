@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <functional>
 
 #include <Poco/Path.h>
 #include "cresult.h"
@@ -11,25 +12,30 @@
 #include "variables.h"
 #include "lua.hpp"
 #include "service_vars.h"
+#include "service_lua_arena.h"
 
 namespace servicelua
 {
    // lua file.
    class luafile {
    public:
+      typedef std::function<serviceVars &()> varsloader;
+
       // runs the given command.
       luafile(serviceVars & sv, const CommandLine & serviceCmd);
+      // runs the given command, only loading the service variables if the lua needs them.
+      luafile(const std::string & servicename, varsloader loadvars, const CommandLine & serviceCmd);
       ~luafile();
 
       cResult getResult() { return mResult; }
       
       // for lua
-      void addConfiguration(envDef cf);
+      void addConfiguration(envDef cf); // checked against the quick read of service.lua once the variables are loaded.
       Poco::Path getdRunDir() const;
       void setdRunDir(std::string p);
       std::string getServiceName() { return mServicePaths.getName(); }
 
-      serviceVars & getServiceVars() { return mServiceVars; }
+      serviceVars & getServiceVars(); // loaded on first use.
       //Poco::Path getPathdService();
 
       bool hasCommand(std::string command) const;
@@ -40,11 +46,16 @@ namespace servicelua
       cResult _loadlua();
       cResult _showHelp();
       cResult _runCommand(const CommandLine & serviceCmd);
+      std::string _luaerror() const; // error message on top of the stack.
+      void _checkConfiguration(const envDef & def);
 
       const servicePaths mServicePaths;
 
+      luaarena mArena; // must outlive L.
       lua_State * L;
-      serviceVars & mServiceVars;
+      varsloader mLoadVars;
+      serviceVars * mServiceVars; // null until loaded.
+      std::vector<envDef> mUnchecked; // from addconfig, before the variables were loaded.
 
       Poco::Path mdRunDir;
       cResult mResult;
@@ -0,0 +1,209 @@
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include "service_lua_arena.h"
+
+/*
+
+The luaarena class is the allocator given to each service.lua interpreter. It caps how much
+memory a dService script can use and keeps some statistics about what it did.
+
+*/
+
+namespace servicelua
+{
+   // -------------------------------------------------------------------------------
+
+   luaarena::luaarena(size_t limitbytes) :
+      mChunkPos(NULL), mChunkEnd(NULL),
+      mLimit(limitbytes), mInUse(0), mPeak(0), mNumAllocs(0), mGCCycles(0), mLimitHit(false)
+   {
+      for (size_t i = 0; i < kNumClasses; ++i)
+         mFreeLists[i] = NULL;
+   }
+
+   luaarena::luaarena(std::function<size_t()> limitbytes) : luaarena((size_t)0)
+   {
+      mLimitFn = limitbytes;
+   }
+
+   luaarena::~luaarena()
+   {
+      for (auto c : mChunks)
+         std::free(c);
+   }
+
+   void luaarena::_resolvelimit()
+   {
+      std::function<size_t()> f;
+      f.swap(mLimitFn); // asked once.
+      mLimit = f();
+   }
+
+   // -------------------------------------------------------------------------------
+
+   void * luaarena::alloc(void * ud, void * ptr, size_t osize, size_t nsize)
+   {
+      luaarena * a = (luaarena *)ud;
+
+      if (ptr == NULL)
+         osize = 0; // osize encodes the object type when ptr is NULL.
+
+      if (nsize == 0)
+      { // free.
+         if (ptr != NULL)
+            a->_free(ptr, osize);
+         return NULL;
+      }
+
+      if (nsize > osize && a->mLimitFn && a->mInUse + (nsize - osize) > kMinLimit)
+         a->_resolvelimit();
+
+      if (nsize > osize && a->mLimit > 0 && a->mInUse + (nsize - osize) > a->mLimit)
+      { // Lua raises a memory error when growing fails. Shrinking must never fail.
+         a->mLimitHit = true;
+         return NULL;
+      }
+
+      if (ptr == NULL)
+         return a->_allocate(nsize);
+
+      // resize. Blocks in the same size class can be reused as they are.
+      if (osize <= kMaxSmall && nsize <= kMaxSmall && _classof(osize) == _classof(nsize))
+      {
+         a->mInUse = a->mInUse - osize + nsize;
+         if (a->mInUse > a->mPeak) a->mPeak = a->mInUse;
+         return ptr;
+      }
+
+      if (osize > kMaxSmall && nsize > kMaxSmall)
+      { // both large - let the system allocator do it.
+         void * p = std::realloc(ptr, nsize);
+         if (p == NULL)
+            return NULL;
+         a->mInUse = a->mInUse - osize + nsize;
+         if (a->mInUse > a->mPeak) a->mPeak = a->mInUse;
+         ++a->mNumAllocs;
+         return p;
+      }
+
+      void * p = a->_allocate(nsize);
+      if (p == NULL)
+         return NULL;
+      std::memcpy(p, ptr, osize < nsize ? osize : nsize);
+      a->_free(ptr, osize);
+      return p;
+   }
+
+   // -------------------------------------------------------------------------------
+
+   void * luaarena::_allocate(size_t nsize)
+   {
+      void * p;
+      if (nsize > kMaxSmall)
+         p = std::malloc(nsize);
+      else
+      {
+         size_t c = _classof(nsize);
+         if (mFreeLists[c] != NULL)
+         {
+            p = mFreeLists[c];
+            mFreeLists[c] = mFreeLists[c]->next;
+         }
+         else
+            p = _carve(c);
+      }
+
+      if (p == NULL)
+         return NULL;
+
+      ++mNumAllocs;
+      mInUse += nsize;
+      if (mInUse > mPeak) mPeak = mInUse;
+      return p;
+   }
+
+   void luaarena::_free(void * ptr, size_t osize)
+   {
+      mInUse -= osize;
+
+      if (osize > kMaxSmall)
+      {
+         std::free(ptr);
+         return;
+      }
+
+      size_t c = _classof(osize);
+      freeblock * b = (freeblock *)ptr;
+      b->next = mFreeLists[c];
+      mFreeLists[c] = b;
+   }
+
+   void * luaarena::_carve(size_t sizeclass)
+   {
+      size_t blocksize = sizeclass * kGranularity;
+      if (mChunkPos == NULL || (size_t)(mChunkEnd - mChunkPos) < blocksize)
+      {
+         // hand the tail of the old chunk to the freelists so it isn't wasted.
+         while (mChunkPos != NULL && (size_t)(mChunkEnd - mChunkPos) >= kGranularity)
+         {
+            size_t c = (size_t)(mChunkEnd - mChunkPos) / kGranularity;
+            if (c >= kNumClasses) c = kNumClasses - 1;
+            freeblock * b = (freeblock *)mChunkPos;
+            b->next = mFreeLists[c];
+            mFreeLists[c] = b;
+            mChunkPos += c * kGranularity;
+         }
+
+         char * chunk = (char *)std::malloc(kChunkSize);
+         if (chunk == NULL)
+            return NULL;
+         mChunks.push_back(chunk);
+         mChunkPos = chunk;
+         mChunkEnd = chunk + kChunkSize;
+      }
+
+      void * p = mChunkPos;
+      mChunkPos += blocksize;
+      return p;
+   }
+
+   // -------------------------------------------------------------------------------
+
+   // finaliser of the sentinel object. Counts the cycle and creates a new sentinel
+   // for the next collection to find.
+   int luaarena::_gcsentinel(lua_State * L)
+   {
+      luaarena * a = (luaarena *)lua_touserdata(L, lua_upvalueindex(1));
+      ++a->mGCCycles;
+      a->trackgc(L);
+      return 0;
+   }
+
+   void luaarena::trackgc(lua_State * L)
+   {
+      lua_newuserdata(L, 1);
+      lua_createtable(L, 0, 1);
+      lua_pushlightuserdata(L, (void*)this);
+      lua_pushcclosure(L, _gcsentinel, 1);
+      lua_setfield(L, -2, "__gc");
+      lua_setmetatable(L, -2);
+      lua_pop(L, 1); // unreferenced, so the next collection finalises it.
+   }
+
+   // -------------------------------------------------------------------------------
+
+   std::string luaarena::getStats() const
+   {
+      std::ostringstream oss;
+      oss << "Lua memory: peak " << mPeak << " bytes";
+      if (mLimit > 0)
+         oss << " (limit " << mLimit << ")";
+      oss << ", " << mNumAllocs << " allocations, "
+         << mChunks.size() << " arena chunks, "
+         << mGCCycles << " GC cycles.";
+      return oss.str();
+   }
+
+} // namespace
@@ -0,0 +1,81 @@
+#ifndef __SERVICE_LUA_ARENA_H
+#define __SERVICE_LUA_ARENA_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "lua.hpp"
+
+namespace servicelua
+{
+   // Memory arena for a single lua_State. Small blocks are carved out of large
+   // chunks and recycled through per size-class freelists; larger blocks go
+   // straight to the system allocator. Lua tells us the old size of every block
+   // it frees or resizes, so no per-block header is needed. Releasing the arena
+   // just hands the chunks back, regardless of how many blocks were carved.
+   //
+   // The arena must outlive the lua_State that uses it (i.e. lua_close first).
+   class luaarena
+   {
+   public:
+      luaarena(size_t limitbytes = 0); // 0 = no limit.
+      // the limit is asked for only once kMinLimit is in use - below that no limit can apply.
+      luaarena(std::function<size_t()> limitbytes);
+      ~luaarena();
+
+      static const size_t kMinLimit = 1024 * 1024; // LUAMEMLIMIT is in MB.
+
+      // the lua_Alloc function. ud must point to the luaarena.
+      static void * alloc(void * ud, void * ptr, size_t osize, size_t nsize);
+
+      // installs a __gc sentinel in L that counts completed garbage collection cycles.
+      void trackgc(lua_State * L);
+
+      size_t getLimit() const { return mLimit; }
+      size_t getInUse() const { return mInUse; }
+      size_t getPeak() const { return mPeak; }
+      size_t getNumAllocs() const { return mNumAllocs; }
+      size_t getNumChunks() const { return mChunks.size(); }
+      size_t getGCCycles() const { return mGCCycles; }
+      bool limitHit() const { return mLimitHit; }
+
+      std::string getStats() const;
+
+   private:
+      luaarena(const luaarena &) = delete;
+      luaarena & operator=(const luaarena &) = delete;
+
+      void * _allocate(size_t nsize);
+      void _free(void * ptr, size_t osize);
+      void * _carve(size_t sizeclass);
+      void _resolvelimit();
+
+      static size_t _classof(size_t size) { return (size + kGranularity - 1) / kGranularity; }
+      static int _gcsentinel(lua_State * L);
+
+      static const size_t kGranularity = 16;
+      static const size_t kMaxSmall = 512;
+      static const size_t kNumClasses = kMaxSmall / kGranularity + 1;
+      static const size_t kChunkSize = 64 * 1024;
+
+      struct freeblock { freeblock * next; };
+
+      freeblock * mFreeLists[kNumClasses];
+      std::vector<char *> mChunks;
+      char * mChunkPos;
+      char * mChunkEnd;
+
+      std::function<size_t()> mLimitFn; // set until the limit is known.
+      size_t mLimit;
+      size_t mInUse;
+      size_t mPeak;
+      size_t mNumAllocs;
+      size_t mGCCycles;
+      bool mLimitHit;
+   };
+
+} // namespace
+
+#endif
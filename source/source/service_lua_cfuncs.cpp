@@ -6,6 +6,7 @@
 #include "dassert.h"
 #include "utils_docker.h"
 #include "proxy.h"
+#include "persistence.h"
 
 // -----------------------------------------------------------------------------------------------------------------------
 // -----------------------------------------------------------------------------------------------------------------------
@@ -25,6 +26,8 @@ extern "C" int l_getdrundir(lua_State *L);
 extern "C" int l_setdrundir(lua_State *L);
 extern "C" int l_getpwd(lua_State *L);
 extern "C" int l_isdockerrunning(lua_State *L);
+extern "C" int l_dockerps(lua_State *L);
+extern "C" int l_dockervolumes(lua_State *L);
 
 extern "C" int l_docker(lua_State *L);
 extern "C" int l_dockerti(lua_State *L);
@@ -74,6 +77,8 @@ namespace servicelua
 
       REGISTERLUAC(l_dockerstop, "dockerstop")
       REGISTERLUAC(l_isdockerrunning, "isdockerrunning")
+      REGISTERLUAC(l_dockerps, "dockerps")
+      REGISTERLUAC(l_dockervolumes, "dockervolumes")
       REGISTERLUAC(l_dockerwait, "dockerwait")
       REGISTERLUAC(l_dockerpull, "dockerpull")
       REGISTERLUAC(l_dockercreatevolume, "dockercreatevolume")
@@ -140,7 +145,7 @@ namespace servicelua
 
    // -----------------------------------------------------------------------------------------------------------------------
 
-   // just sanity check the pass we've already done.
+   // just sanity check the pass we've already done (when the service variables are loaded).
    extern "C" int l_addconfig(lua_State *L)
    {
       if (lua_gettop(L) != 3)
@@ -152,24 +157,7 @@ namespace servicelua
       drunner_assert(lua_isstring(L, 3), "The description must be a string.");
 
       envDef def(lua_tostring(L, 1), lua_tostring(L, 2), lua_tostring(L, 3), ENV_PERSISTS | ENV_USERSETTABLE);
-      const std::vector<envDef> & config = servicelua::get_luafile(L)->getServiceVars().getEnvDefs();
-      bool found = false;
-      for (auto & x : config)
-         if (0 == Poco::icompare(x.name, def.name))
-         {
-            found = true;
-
-            if (0 != Poco::icompare(x.defaultval,def.defaultval))
-               logmsg(kLWARN, "Inconsistency of default value between quick read and lua execution for config " + def.defaultval);
-
-            if (0 != Poco::icompare(x.description, def.description))
-               logmsg(kLWARN, "Inconsistency of description between quick read and lua execution for config " + def.defaultval);
-
-            break;
-         }
-
-      if (!found)
-         logmsg(kLWARN, "Inconsistency of name between quick read and lua execution for config " + def.defaultval);
+      servicelua::get_luafile(L)->addConfiguration(def);
 
       return _luasuccess(L);
    }
@@ -267,6 +255,11 @@ namespace servicelua
       args.insert(args.begin(), { "docker","-ti","--rm" });
       operation.setfromvector(args);
 
+      // the command may read our settings, so write out any that are pending.
+      cResult pr = persistence::flush();
+      if (pr.error())
+         logmsg(kLWARN, "Couldn't write settings: " + pr.what());
+
       int rval = -1;
       try {
          luafile * lf = get_luafile(L);
@@ -300,6 +293,90 @@ namespace servicelua
 
    // -----------------------------------------------------------------------------------------------------------------------
 
+   // optional single argument: a name filter for docker.
+   std::string _namefilter(lua_State *L, std::string funcname)
+   {
+      if (lua_gettop(L) > 1)
+         logmsg(kLWARN, "Expected at most one argument (a name filter) for " + funcname + ".");
+      if (lua_gettop(L) == 0)
+         return "";
+      drunner_assert(lua_isstring(L, 1), "name filter must be a string.");
+      luafile *lf = get_luafile(L);
+      return lf->getServiceVars().substitute(lua_tostring(L, 1));
+   }
+
+   void _setfield(lua_State *L, const char * key, const std::string & val)
+   {
+      lua_pushstring(L, val.c_str());
+      lua_setfield(L, -2, key);
+   }
+
+   extern "C" int l_dockerps(lua_State *L)
+   {
+      // dockerps( [namefilter] )
+      // Returns a table, keyed by container name, of tables with
+      // name, state, image, running, networks (network -> IP) and ports.
+      std::string filter = _namefilter(L, "dockerps");
+
+      std::vector<utils_docker::dockercontainer> containers;
+      cResult r = utils_docker::getContainers(containers, filter);
+      if (r.error())
+         return _luafail(L, r.what());
+
+      lua_createtable(L, 0, containers.size());
+      for (const auto & c : containers)
+      {
+         lua_createtable(L, 0, 6);
+         _setfield(L, "name", c.name);
+         _setfield(L, "state", c.state);
+         _setfield(L, "image", c.image);
+         lua_pushboolean(L, c.running());
+         lua_setfield(L, -2, "running");
+
+         lua_createtable(L, 0, c.networks.size());
+         for (const auto & n : c.networks)
+            _setfield(L, n.first.c_str(), n.second);
+         lua_setfield(L, -2, "networks");
+
+         lua_createtable(L, c.ports.size(), 0);
+         for (unsigned int i = 0; i < c.ports.size(); ++i)
+         {
+            lua_pushstring(L, c.ports[i].c_str());
+            lua_rawseti(L, -2, i + 1);
+         }
+         lua_setfield(L, -2, "ports");
+
+         lua_setfield(L, -2, c.name.c_str());
+      }
+      return 1;
+   }
+
+   // -----------------------------------------------------------------------------------------------------------------------
+
+   extern "C" int l_dockervolumes(lua_State *L)
+   {
+      // dockervolumes( [namefilter] )
+      // Returns a table, keyed by volume name, of tables with name and driver.
+      std::string filter = _namefilter(L, "dockervolumes");
+
+      std::vector<utils_docker::dockervolume> volumes;
+      cResult r = utils_docker::getVolumes(volumes, filter);
+      if (r.error())
+         return _luafail(L, r.what());
+
+      lua_createtable(L, 0, volumes.size());
+      for (const auto & v : volumes)
+      {
+         lua_createtable(L, 0, 2);
+         _setfield(L, "name", v.name);
+         _setfield(L, "driver", v.driver);
+         lua_setfield(L, -2, v.name.c_str());
+      }
+      return 1;
+   }
+
+   // -----------------------------------------------------------------------------------------------------------------------
+
    extern "C" int l_dockerwait(lua_State *L)
    {
       // dockerwait( containername, port, timeout=30s)
@@ -571,11 +648,57 @@ namespace servicelua
 
    // -----------------------------------------------------------------------------------------------------------------------
 
+   // string or table of strings at index i.
+   static std::vector<std::string> _luastrings(lua_State *L, int i)
+   {
+      std::vector<std::string> vs;
+      if (lua_isstring(L, i))
+         vs.push_back(lua_tostring(L, i));
+      else if (lua_istable(L, i))
+      {
+         lua_pushnil(L);
+         while (lua_next(L, i) != 0)
+         {
+            drunner_assert(lua_isstring(L, -1), "Table value isn't a string");
+            vs.push_back(lua_tostring(L, -1));
+            lua_pop(L, 1);
+         }
+      }
+      return vs;
+   }
+
+   // the optional proxyenable options table, e.g. { upstreams={"web2"}, balance="leastconn", keepalive=32 }
+   static proxyoptions _luaproxyoptions(lua_State *L, int t)
+   {
+      proxyoptions o;
+      lua_pushnil(L);
+      while (lua_next(L, t) != 0)
+      {
+         drunner_assert(lua_type(L, -2) == LUA_TSTRING, "proxyenable: option names must be strings.");
+         std::string key = lua_tostring(L, -2);
+         int v = lua_gettop(L);
+         switch (s2i(key.c_str()))
+         {
+         case s2i("upstreams"): o.upstreams = _luastrings(L, v); break;
+         case s2i("balance"): o.balance = (lua_isstring(L, v) ? lua_tostring(L, v) : ""); break;
+         case s2i("keepalive"): o.keepalive = (int)lua_tointeger(L, v); break;
+         case s2i("compression"): o.compression = (int)lua_tointeger(L, v); break;
+         case s2i("compresstypes"): o.compresstypes = _luastrings(L, v); break;
+         case s2i("buffering"): o.buffering = (lua_toboolean(L, v) == 1); break;
+         case s2i("http2"): o.http2 = (lua_toboolean(L, v) == 1); break;
+         default:
+            logmsg(kLWARN, "proxyenable: unknown option " + key);
+         }
+         lua_pop(L, 1);
+      }
+      return o;
+   }
+
    extern "C" int l_proxyenable(lua_State *L)
    {
-      if (lua_gettop(L) < 5 || lua_gettop(L) > 6)
+      if (lua_gettop(L) < 5 || lua_gettop(L) > 7)
       {
-         logmsg(kLWARN, "Expected 5 to 6 arguments: proxyenable( HOSTNAME, CONTAINER, PORT, EMAIL, MODE, [TIMEOUTS] )");
+         logmsg(kLWARN, "Expected 5 to 7 arguments: proxyenable( HOSTNAME, CONTAINER, PORT, EMAIL, MODE, [TIMEOUTS], [OPTIONS] )");
       }
 
       luafile *lf = get_luafile(L);
@@ -587,10 +710,14 @@ namespace servicelua
       drunner_assert(lua_isstring(L, 4), "proxyenable: String expected as 4th argument.");
       drunner_assert(lua_isstring(L, 5), "proxyenable: String expected as 5th argument.");
       drunner_assert(lua_gettop(L)==5 || lua_isboolean(L, 6), "proxyenable: Boolean expected as 6th optional argument.");
+      drunner_assert(lua_gettop(L)<=6 || lua_istable(L, 7), "proxyenable: Table expected as 7th optional argument.");
 
       bool timeouts = true;
-      if (lua_gettop(L) == 6)
+      if (lua_gettop(L) >= 6)
          timeouts = (lua_toboolean(L, 6)==1);
+      proxyoptions options;
+      if (lua_gettop(L) >= 7)
+         options = _luaproxyoptions(L, 7);
       if (!timeouts)
          logmsg(kLDEBUG, "Timeouts disabled for " + servicename);
 
@@ -603,7 +730,8 @@ namespace servicelua
             std::to_string(lua_tointeger(L, 3)),
             lua_tostring(L, 4),
             lua_tostring(L, 5),
-            timeouts
+            timeouts,
+            options
          )
       );
 
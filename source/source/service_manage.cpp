@@ -1,8 +1,19 @@
 #include <sys/stat.h>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
 
 #include <Poco/String.h>
 #include <Poco/File.h>
+#include <Poco/Process.h>
+#include <Poco/Pipe.h>
+#include <Poco/PipeStream.h>
+#include <Poco/StreamCopier.h>
 
 #include "utils.h"
 #include "utils_docker.h"
@@ -19,6 +30,11 @@
 #include "dassert.h"
 #include "service_vars.h"
 #include "sourcecopy.h"
+#include "service_fingerprint.h"
+#include "persistence.h"
+#include "proxy.h"
+#include "service_index.h"
+#include "treedelete.h"
 
 
 namespace service_manage
@@ -75,30 +91,25 @@ namespace service_manage
       return _createLaunchScript(servicename);
    }
 
-   cResult _install_create(std::string servicename, std::string imagename)
+   cResult _install_create(std::string servicename, std::string imagename, sourcecopy::source & src)
    {
       drunner_assert(imagename.length() > 0, "Can't create service " + servicename + " - imagename could not be determined.");
       servicePaths sp(servicename);
 
       try
       {
-         // nuke any existing dService files on host (but preserve volume containers!).
-         if (utils::fileexists(sp.getPathdService()))
-         {
-            Poco::File spath(sp.getPathdService());
-            spath.remove(true); // recursively delete.
-         }
-
          // notice for hostVolumes.
          if (utils::fileexists(sp.getPathHostVolume()))
             logmsg(kLINFO, "A drunner hostVolume already exists for " + servicename + ", reusing it.");
 
          _create_common(servicename);
 
-         // copy files to service directory on host.
-         cResult r = sourcecopy::install(imagename, sp);
-         if (!r.success())
+         // sync files to service directory on host (only what changed is copied, stale files are removed).
+         treesync::summary changes;
+         cResult r = sourcecopy::install(imagename, sp, &changes, &src);
+         if (r.error())
             fatal(r.what());
+         logmsg(kLDEBUG, "dService files: " + changes.describe());
 
          // write out service configuration for the dService.
          serviceVars sv(servicename);
@@ -135,7 +146,14 @@ namespace service_manage
       if (utils::fileexists(sp.getPathdService()))
          logmsg(kLERROR, "Service already exists. Try:\n drunner update " + servicename);
 
-      _install_create(servicename,imagename);
+      return _install(servicename, imagename);
+   }
+
+   cResult _install(std::string servicename, std::string imagename)
+   {
+      utils_docker::dockerrecorder recorder;
+      sourcecopy::source src;
+      _install_create(servicename, imagename, src);
 
       serviceVars sv(servicename);
       servicelua::luafile lf(sv, CommandLine("install"));
@@ -143,11 +161,24 @@ namespace service_manage
       if (lf.getResult() != kRSuccess)
          fatal("Failed to run install in service.lua:\n"+lf.getResult().what());
 
+      // record what we installed so a later update can tell if there's anything to do.
+      servicefingerprint fp;
+      cResult r = fp.compute(src, recorder.getImages());
+      if (r.success())
+         r = fp.save(servicename);
+      if (!r.success())
+         logmsg(kLWARN, "Couldn't fingerprint " + servicename + ", the next update will reinstall it:\n " + r.what());
+
+      const std::vector<std::string> & volumes(recorder.getVolumes());
+      r = serviceindex::update(servicename, [&volumes](serviceinfo & e) { e.volumes = volumes; });
+      if (r.error())
+         logmsg(kLWARN, "Couldn't add " + servicename + " to the service index:\n " + r.what());
+
       logdbg("Installation of " + servicename + " complete.");
       return kRSuccess;
    }
 
-   cResult uninstall(std::string servicename)
+   cResult uninstall(std::string servicename, bool keepFiles)
    {
       servicePaths sp(servicename);
       cResult rval = kRNoChange;
@@ -168,16 +199,21 @@ namespace service_manage
       }
 
    
-      // delete the service tree.
-      logmsg(kLINFO, "Deleting all of the dService files");
-      rval += utils::deltree(sp.getPathdService());
+      if (!keepFiles)
+      { // delete the service tree.
+         logmsg(kLINFO, "Deleting all of the dService files");
+         rval += utils::deltree(sp.getPathdService());
 
-      if (utils::fileexists(sp.getPathdService()))
-         return cError("Uninstall failed - couldn't delete " + sp.getPathdService().toString());
+         if (utils::fileexists(sp.getPathdService()))
+            return cError("Uninstall failed - couldn't delete " + sp.getPathdService().toString());
+      }
 
       // delete the launch script
       rval += _removeLaunchScript(servicename);
 
+      if (!keepFiles)
+         serviceindex::remove(servicename);
+
       if (!rval.error())
          logmsg(kLINFO, "Uninstalled " + servicename);
       return rval;
@@ -206,28 +242,36 @@ namespace service_manage
          }
       }
 
+      // both trees are moved into the trash at once and deleted in the background, by one process.
+      size_t trashed = treedelete::trashcount();
+      if (trashed > 0)
+         logmsg(kLWARN, "drunner's trash (" + drunnerPaths::getPath_Temp().pushDirectory("trash").toString() + ") still holds " +
+            std::to_string(trashed) + " tree(s) from earlier deletes - they're still being deleted, or couldn't be (see the log).");
+
+      std::vector<Poco::Path> trees;
       if (utils::fileexists(sp.getPathdService()))
-      { // delete the service tree.
+      { // the service tree.
          logmsg(kLINFO, "Obliterating all of the dService files.");
-         cResult result = utils::deltree(sp.getPathdService());
-         rval += result;
-         if (result != kRSuccess)
-            logmsg(kLINFO, "Failed to delete the dService files.");
+         trees.push_back(sp.getPathdService());
       }
-
-      // delete the host volumes
       if (utils::fileexists(sp.getPathHostVolume()))
-      {
+      { // the host volumes.
          logdbg("Obliterating the hostVolume (includes configuration).");
-         cResult result = utils::deltree(sp.getPathHostVolume());
+         trees.push_back(sp.getPathHostVolume());
+      }
+      if (trees.size() > 0)
+      {
+         cResult result = treedelete::removeasync(trees);
          rval += result;
-         if (result != kRSuccess)
-            logmsg(kLINFO, "Failed to delete the hostVolume files.");
+         if (result.error())
+            logmsg(kLINFO, "Failed to delete the dService or hostVolume files.");
       }
 
       // delete the launch script
       rval += _removeLaunchScript(servicename);
 
+      serviceindex::remove(servicename);
+
       if (rval == kRNoChange)
          logmsg(kLWARN, "Couldn't find any trace of dService " + servicename + " - no changes made.");
       else if (rval.error())
@@ -239,7 +283,32 @@ namespace service_manage
 
    // -------------------------------------------------------------------------------------------------
 
-   cResult update(std::string servicename)
+   static bool _uptodate(std::string servicename, std::string imagename)
+   {
+      servicefingerprint installed, current;
+      if (!utils::fileexists(servicePaths(servicename).getPathServiceLua()) || !installed.load(servicename).success())
+      {
+         logmsg(kLDEBUG, "No fingerprint for " + servicename + ", reinstalling.");
+         return false;
+      }
+
+      cResult r = current.compute(imagename, installed.getImages());
+      if (!r.success())
+      {
+         logmsg(kLDEBUG, "Couldn't fingerprint " + servicename + ", reinstalling: " + r.what());
+         return false;
+      }
+
+      std::string d = current.differences(installed);
+      if (d.length() > 0)
+      {
+         logmsg(kLINFO, "Changes to " + servicename + ":\n" + d);
+         return false;
+      }
+      return true;
+   }
+
+   cResult update(std::string servicename, bool force)
    { // update the service (recreate it)
      // settings file for service contains imagename, so we can still update after
      // an uninstall!
@@ -250,10 +319,19 @@ namespace service_manage
       drunner_assert(imagename.length() > 0, "Imagename is empty!");
       logmsg(kLDEBUG, "Imagename is " + imagename);
 
+      if (!force && _uptodate(servicename, imagename))
+      {
+         logmsg(kLINFO, servicename + " is up to date. Use --force to reinstall it anyway.");
+         return kRNoChange;
+      }
+
+      // a service that disables its proxy on uninstall and enables it again on install leaves it alone.
+      proxytransaction pt;
+
       try
       {
          logmsg(kLINFO, "Attempting to uninstall " + servicename);
-         cResult r = uninstall(servicename);
+         cResult r = uninstall(servicename, true); // keep the files, the install below syncs them.
          if (!r.success())
             logmsg(kLINFO, "Uninstall failed: "+r.what());
       }
@@ -263,14 +341,180 @@ namespace service_manage
       }
 
       logmsg(kLINFO, "Installing " + servicename + " from " + imagename);
-      cResult r2= install(servicename, imagename);
+      cResult r2 = _install(servicename, imagename);
       if (r2.success())
          logmsg(kLINFO, "Installation complete.");
+      r2 += pt.commit();
+
+      // the proxy changes are only saved once committed.
+      cResult r3 = serviceindex::update(servicename);
+      if (r3.error())
+         logmsg(kLWARN, "Couldn't update " + servicename + " in the service index:\n " + r3.what());
       return r2;
    }
 
 
 
+   // -------------------------------------------------------------------------------------------------
+
+   class updatejob
+   {
+   public:
+      updatejob(std::string s) : servicename(s), rval(-1), seconds(0) {}
+
+      std::string servicename;
+      Poco::Path log;
+      servicefingerprint before;
+      bool hadfingerprint;
+      int rval; // exit code of drunner update.
+      double seconds;
+   };
+
+   // runs drunner update for one service in its own process, output to the job's log.
+   static void _runupdatejob(updatejob & job, const std::vector<std::string> & args)
+   {
+      auto start = std::chrono::steady_clock::now();
+      std::ofstream os(job.log.toString(), std::ios::out | std::ios::trunc);
+      try
+      {
+         // stdin is at EOF: workers run side by side with output to their logs, so prompts
+         // from them would interleave on the one terminal with no one to see them.
+         Poco::Pipe inpipe, outpipe;
+         Poco::ProcessHandle ph = Poco::Process::launch(drunnerPaths::getPath_Exe().toString(), args, &inpipe, &outpipe, &outpipe);
+         inpipe.close(Poco::Pipe::CLOSE_WRITE);
+         Poco::PipeInputStream pis(outpipe);
+         Poco::StreamCopier::copyStream(pis, os);
+         job.rval = ph.wait();
+      }
+      catch (const Poco::Exception & e)
+      {
+         os << "Couldn't run drunner: " << e.displayText() << std::endl;
+         job.rval = -1;
+      }
+      job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   }
+
+   static std::string _jobresult(const updatejob & job)
+   {
+      switch (job.rval)
+      {
+      case kRSuccess: return "updated";
+      case kRNoChange: return "unchanged";
+      default: return "FAILED";
+      }
+   }
+
+   static std::string _jobchanges(const updatejob & job)
+   {
+      if (job.rval == kRNoChange)
+         return "-";
+      if (job.rval != kRSuccess)
+         return "see " + job.log.toString();
+
+      servicefingerprint after;
+      std::string d;
+      if (job.hadfingerprint && after.load(job.servicename).success())
+         d = after.differences(job.before);
+      if (d.length() == 0)
+         return "reinstalled";
+      Poco::trimInPlace(d);
+      return utils::replacestring(d, "\n", "; ");
+   }
+
+   cResult updateall(bool force)
+   {
+      std::vector<std::string> services;
+      utils::getAllServices(services);
+      if (services.size() == 0)
+      {
+         logmsg(kLINFO, "No dServices are installed.");
+         return kRNoChange;
+      }
+
+      const params & p(*GlobalContext::getParams());
+      std::vector<std::string> flags = { "--noproxyreload", (p.getLogLevel() == kLDEBUG) ? "-v" : "-n" };
+      if (force)
+         flags.push_back("--force");
+      if (p.isDevelopmentMode())
+         flags.push_back("-d");
+
+      std::vector<updatejob> jobs;
+      for (const auto & s : services)
+      {
+         updatejob job(s);
+         job.log = drunnerPaths::getPath_Logs().setFileName("update-" + s + ".log");
+         job.hadfingerprint = job.before.load(s).success();
+         jobs.push_back(job);
+      }
+
+      cResult pr = persistence::flush(); // the children read our settings.
+      if (pr.error())
+         return pr;
+
+      size_t workers = (size_t)GlobalContext::getSettings()->getUpdateWorkers();
+      if (workers > jobs.size())
+         workers = jobs.size();
+      logmsg(kLINFO, "Updating " + std::to_string(jobs.size()) + " services, " + std::to_string(workers) + " at a time.");
+
+      std::atomic<size_t> next(0);
+      std::mutex logmutex;
+      auto worker = [&]() {
+         size_t i;
+         while ((i = next++) < jobs.size())
+         {
+            std::vector<std::string> args = { "update", jobs[i].servicename };
+            args.insert(args.end(), flags.begin(), flags.end());
+            _runupdatejob(jobs[i], args);
+
+            std::lock_guard<std::mutex> lock(logmutex);
+            logmsg(kLINFO, jobs[i].servicename + ": " + _jobresult(jobs[i]));
+         }
+      };
+      std::vector<std::thread> threads;
+      for (size_t t = 0; t < workers; ++t)
+         threads.push_back(std::thread(worker));
+      for (auto & t : threads)
+         t.join();
+
+      // one proxy reload for the lot, if anything was updated. The proxy is only reloaded if its
+      // configuration changed - reinstalled services have new containers with new addresses, which
+      // changes it unless PROXYUSEDNS is set, and then a backend that only resolves names when it
+      // loads its configuration (nginx) is always reloaded.
+      cResult rval = kRNoChange;
+      if (std::any_of(jobs.begin(), jobs.end(), [](const updatejob & j) { return j.rval == kRSuccess; }))
+      {
+         logmsg(kLINFO, "Reloading the proxy.");
+         rval += proxy().reload();
+      }
+
+      // summary table.
+      size_t w = 7;
+      for (const auto & job : jobs)
+         w = std::max(w, job.servicename.length());
+      std::ostringstream table;
+      table << std::left << std::setw(w + 2) << "SERVICE" << std::setw(10) << "TIME" << std::setw(11) << "RESULT" << "CHANGES" << std::endl;
+      std::string failed;
+      for (const auto & job : jobs)
+      {
+         std::ostringstream secs;
+         secs << std::fixed << std::setprecision(1) << job.seconds << "s";
+         table << std::left << std::setw(w + 2) << job.servicename << std::setw(10) << secs.str()
+            << std::setw(11) << _jobresult(job) << _jobchanges(job) << std::endl;
+
+         if (job.rval == kRSuccess)
+            rval += kRSuccess;
+         else if (job.rval != kRNoChange)
+            failed += " " + job.servicename;
+      }
+      logmsg(kLINFO, "\n" + table.str());
+
+      if (failed.length() > 0)
+         return cError("Failed to update:" + failed);
+      return rval;
+   }
+
+   // -------------------------------------------------------------------------------------------------
+
    cResult _createLaunchScript(std::string servicename)
    {
 #ifdef _WIN32
@@ -9,12 +9,14 @@
 namespace service_manage
 {
    cResult obliterate(std::string servicename);
-   cResult uninstall(std::string servicename);
-   cResult update(std::string servicename);
+   cResult uninstall(std::string servicename, bool keepFiles = false); // keepFiles leaves the dService definition on disk.
+   cResult update(std::string servicename, bool force = false); // no-op if the installed fingerprint is current, unless forced.
+   cResult updateall(bool force); // updates every service, each in its own drunner process, in parallel.
    cResult install(std::string & servicename, std::string & imagename);
    cResult service_restore(const std::string & backupfile, std::string servicename);
 
    // helper routines.
+   cResult _install(std::string servicename, std::string imagename); // install without the already-exists check (used by update).
    cResult _createLaunchScript(std::string servicename);
    cResult _removeLaunchScript(std::string servicename);
 
@@ -31,6 +31,11 @@ Poco::Path servicePaths::getPathServiceVars() const
    return getPathHostVolume().setFileName("serviceconfig.json");
 }
 
+Poco::Path servicePaths::getPathFingerprint() const
+{
+   return getPathHostVolume().setFileName("fingerprint.json");
+}
+
 Poco::Path servicePaths::getPathLaunchScript() const
 {
    return drunnerPaths::getPath_Bin().setFileName(getName());
@@ -15,6 +15,7 @@ public:
    Poco::Path getPathHostVolume() const;
    Poco::Path getPathLaunchScript() const;
    Poco::Path getPathServiceVars() const;
+   Poco::Path getPathFingerprint() const;
    std::string getName() const;
 
    // provided by the dService.
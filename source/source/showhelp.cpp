@@ -36,16 +36,20 @@ OPTIONS
 COMMANDS
    ${EXENAME} configure [OPTION=[VALUE]] [OPTION=[VALUE]] ...
 
-   ${EXENAME} clean
-   ${EXENAME} list
+   ${EXENAME} clean [--gitcache]
+   ${EXENAME} list       [--status] [--json]
+   ${EXENAME} list       registries
+   ${EXENAME} search     TERM
+   ${EXENAME} logs       [--since 2h|DATE] [--level warn] [--service SERVICENAME]
    ${EXENAME} update
+   ${EXENAME} updateall  [--force]
    ${EXENAME} initialise
 
    [PASS=?] ${EXENAME} backup  SERVICENAME BACKUPFILE
    [PASS=?] ${EXENAME} restore BACKUPFILE  SERVICENAME
 
    ${EXENAME} install    [REGISTRY/]REPO[:TAG] [SERVICENAME]
-   ${EXENAME} update     SERVICENAME
+   ${EXENAME} update     SERVICENAME [--force]
    ${EXENAME} uninstall  SERVICENAME
    ${EXENAME} obliterate SERVICENAME
 
@@ -53,6 +57,8 @@ COMMANDS
    ${EXENAME} registry add NICENAME GITURL
    ${EXENAME} registry del NICENAME
 
+   ${EXENAME} unittest [CATCH ARGS]    e.g. ${EXENAME} unittest [benchmark]
+
 
 EXIT CODE
    0   - success
@@ -0,0 +1,152 @@
+#include <mutex>
+#include <unordered_map>
+
+#include "substitution.h"
+
+namespace substitution
+{
+   // - and . too, as keys like my-key and a.b substituted unbraced before. The longest defined
+   // prefix is used, so $NAME-data and $NAME. still end the name where they should.
+   static inline bool isnamechar(char c)
+   {
+      return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.';
+   }
+
+   // -------------------------------------------------------------------------------
+
+   compiledtemplate::compiledtemplate(const std::string & s) : mLiteralLength(0), mNumTokens(0)
+   {
+      size_t lit = 0; // start of the current literal run.
+      size_t pos = 0;
+      while ((pos = s.find('$', pos)) != std::string::npos)
+      {
+         size_t namestart, nameend, tokenend;
+         bool braced = (pos + 1 < s.length() && s[pos + 1] == '{');
+         if (braced)
+         {
+            namestart = pos + 2;
+            nameend = namestart;
+            while (nameend < s.length() && isnamechar(s[nameend]))
+               ++nameend;
+            if (nameend == namestart || nameend == s.length() || s[nameend] != '}')
+            { // not a token (e.g. ${HOME:-$FOO}) - a literal $, and any tokens inside are still found.
+               ++pos;
+               continue;
+            }
+            tokenend = nameend + 1;
+         }
+         else
+         {
+            namestart = pos + 1;
+            nameend = namestart;
+            while (nameend < s.length() && isnamechar(s[nameend]))
+               ++nameend;
+            if (nameend == namestart)
+            { // lone $.
+               ++pos;
+               continue;
+            }
+            tokenend = nameend;
+         }
+
+         _addliteral(s, lit, pos - lit);
+         segment t;
+         t.token = true;
+         t.braced = braced;
+         t.text = s.substr(namestart, nameend - namestart);
+         mSegments.push_back(t);
+         ++mNumTokens;
+
+         pos = lit = tokenend;
+      }
+      _addliteral(s, lit, s.length() - lit);
+   }
+
+   void compiledtemplate::_addliteral(const std::string & s, size_t pos, size_t len)
+   {
+      if (len == 0)
+         return;
+      segment l;
+      l.token = false;
+      l.braced = false;
+      l.text = s.substr(pos, len);
+      mSegments.push_back(l);
+      mLiteralLength += len;
+   }
+
+   std::string compiledtemplate::render(const tLookup & lookup) const
+   {
+      std::string out;
+      out.reserve(mLiteralLength + 16 * mNumTokens);
+
+      for (const auto & seg : mSegments)
+      {
+         if (!seg.token)
+         {
+            out += seg.text;
+            continue;
+         }
+
+         const std::string * v = lookup(seg.text);
+         if (v != NULL)
+         {
+            out += *v;
+            continue;
+         }
+
+         if (seg.braced)
+         { // not defined - leave it be.
+            out += "${" + seg.text + "}";
+            continue;
+         }
+
+         // longest defined prefix of the name.
+         size_t len = seg.text.length();
+         while (--len > 0)
+            if ((v = lookup(seg.text.substr(0, len))) != NULL)
+               break;
+
+         if (v != NULL)
+         {
+            out += *v;
+            out.append(seg.text, len, std::string::npos);
+         }
+         else
+         {
+            out += '$';
+            out += seg.text;
+         }
+      }
+      return out;
+   }
+
+   // -------------------------------------------------------------------------------
+
+   static const size_t kMaxCached = 512;
+   static std::mutex sCacheMutex;
+   static std::unordered_map<std::string, std::shared_ptr<const compiledtemplate>> sCache;
+
+   std::shared_ptr<const compiledtemplate> compile(const std::string & s)
+   {
+      std::lock_guard<std::mutex> lock(sCacheMutex);
+
+      auto it = sCache.find(s);
+      if (it != sCache.end())
+         return it->second;
+
+      if (sCache.size() >= kMaxCached)
+         sCache.clear(); // simple, and the working set is small.
+
+      std::shared_ptr<const compiledtemplate> t = std::make_shared<const compiledtemplate>(s);
+      sCache[s] = t;
+      return t;
+   }
+
+   std::string substitute(const std::string & s, const tLookup & lookup)
+   {
+      if (s.find('$') == std::string::npos)
+         return s;
+      return compile(s)->render(lookup);
+   }
+
+} // namespace
@@ -0,0 +1,51 @@
+#ifndef __SUBSTITUTION_H
+#define __SUBSTITUTION_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+
+// Single pass substitution of $NAME and ${NAME} tokens in a string.
+//
+// NAME is made of letters, digits, underscores, dashes and dots. For an unbraced $NAME the longest
+// defined prefix of the name is used (so $FOOBAR prefers FOOBAR over FOO, and still
+// becomes value(FOO)+"BAR" if only FOO is defined). Tokens that aren't defined are
+// left untouched. Substituted values are not themselves scanned for tokens.
+namespace substitution
+{
+   // returns the value of name, or NULL if name is not defined.
+   typedef std::function<const std::string * (const std::string & name)> tLookup;
+
+   class compiledtemplate
+   {
+   public:
+      compiledtemplate(const std::string & s);
+
+      std::string render(const tLookup & lookup) const;
+      bool hasTokens() const { return mNumTokens > 0; }
+
+   private:
+      struct segment
+      {
+         bool token;
+         bool braced;
+         std::string text; // literal text, or the token's name.
+      };
+
+      void _addliteral(const std::string & s, size_t pos, size_t len);
+
+      std::vector<segment> mSegments;
+      size_t mLiteralLength;
+      size_t mNumTokens;
+   };
+
+   // compiles s (or fetches it from the cache of recently used templates) and renders it.
+   std::string substitute(const std::string & s, const tLookup & lookup);
+
+   // the cached compiled template for s.
+   std::shared_ptr<const compiledtemplate> compile(const std::string & s);
+
+} // namespace
+
+#endif
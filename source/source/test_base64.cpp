@@ -0,0 +1,164 @@
+#include <chrono>
+#include <random>
+#include <iterator>
+
+#include "catch/catch.h"
+#include "base64.h"
+#include "basen.h"
+#include "globallogger.h"
+#include "testutils.h"
+
+using namespace testutils;
+
+static std::string _random(size_t len, unsigned int seed)
+{
+   std::mt19937 gen(seed);
+   std::string s(len, '\0');
+   for (auto & c : s)
+      c = (char)(gen() & 0xff);
+   return s;
+}
+
+static std::vector<base64::kernel> _kernels()
+{
+   std::vector<base64::kernel> v = { base64::kScalar };
+   for (base64::kernel k : { base64::kSSSE3, base64::kAVX2 })
+      if (base64::use(k))
+         v.push_back(k);
+   base64::use(base64::best());
+   return v;
+}
+
+TEST_CASE("Test that base64 encodes and decodes", "[base64.h]") {
+   SECTION("RFC 4648 test vectors")
+   {
+      const char * vectors[][2] = { { "", "" }, { "f", "Zg==" }, { "fo", "Zm8=" }, { "foo", "Zm9v" },
+         { "foob", "Zm9vYg==" }, { "fooba", "Zm9vYmE=" }, { "foobar", "Zm9vYmFy" } };
+      for (const auto & v : vectors)
+      {
+         REQUIRE(base64::encode(v[0]) == v[1]);
+         REQUIRE(base64::encodedlength(strlen(v[0])) == strlen(v[1]));
+         REQUIRE(base64::decode(v[1]) == v[0]);
+      }
+      REQUIRE(base64::encode("fooba", false) == "Zm9vYmE");
+      REQUIRE(base64::encodedlength(5, false) == 7);
+      REQUIRE(base64::decode("Zm9vYmE") == "fooba");
+   }
+
+   SECTION("Every kernel agrees with the scalar code")
+   {
+      for (auto k : _kernels())
+      {
+         INFO("kernel " << base64::name(k));
+         REQUIRE(base64::use(k));
+         for (size_t len = 0; len < 300; ++len)
+         {
+            std::string s = _random(len, (unsigned int)len);
+            std::string e = base64::encode(s);
+            base64::use(base64::kScalar);
+            REQUIRE(e == base64::encode(s));
+            base64::use(k);
+            REQUIRE(base64::decode(e) == s);
+         }
+      }
+      base64::use(base64::best());
+   }
+
+   SECTION("Decoding skips whitespace and anything else that isn't base64")
+   {
+      std::string s = _random(1000, 1);
+      std::string e = base64::encode(s);
+      std::string wrapped;
+      for (size_t i = 0; i < e.length(); i += 76)
+         wrapped += e.substr(i, 76) + "\r\n";
+      for (auto k : _kernels())
+      {
+         base64::use(k);
+         REQUIRE(base64::decode(wrapped) == s);
+         REQUIRE(base64::decode(" Zm9v\tYmFy!\n") == "foobar");
+         REQUIRE(base64::decode("Zm9vYmFyZm9vYmFyZm9vYmFyZm9vYmF\xffyZm9vYmFyZm9vYmFy") == "foobarfoobarfoobarfoobarfoobarfoobar");
+      }
+      base64::use(base64::best());
+   }
+
+   SECTION("Streaming in pieces of any size gives the same as all at once")
+   {
+      std::string s = _random(5000, 2);
+      std::mt19937 gen(3);
+      for (int rep = 0; rep < 20; ++rep)
+      {
+         base64::encoder enc(rep % 2 == 0);
+         std::string e;
+         for (size_t i = 0; i < s.length();)
+         {
+            size_t n = std::min<size_t>(gen() % 100, s.length() - i);
+            enc.update(s.data() + i, n, e);
+            i += n;
+         }
+         enc.finish(e);
+         REQUIRE(e == base64::encode(s, rep % 2 == 0));
+
+         base64::decoder dec;
+         std::string d;
+         for (size_t i = 0; i < e.length();)
+         {
+            size_t n = std::min<size_t>(gen() % 100, e.length() - i);
+            dec.update(e.data() + i, n, d);
+            i += n;
+         }
+         dec.finish(d);
+         REQUIRE(d == s);
+      }
+   }
+}
+
+// -----------------------------------------------------------------------------------------------
+
+TEST_CASE("Benchmark base64", "[base64.h][.][benchmark]") {
+   const size_t len = 16 * 1024 * 1024;
+   const int reps = 5;
+   std::string s = _random(len, 4);
+   double mb = (double)len / 1048576.0;
+
+   // the old way, through bn:: a byte at a time into back_inserter and ostream_iterator.
+   auto t = std::chrono::steady_clock::now();
+   std::string e;
+   for (int r = 0; r < reps; ++r)
+   {
+      e.clear();
+      bn::encode_b64(s.begin(), s.end(), std::back_inserter(e));
+   }
+   double toldenc = elapsedms(t) / reps;
+   t = std::chrono::steady_clock::now();
+   std::string d;
+   for (int r = 0; r < reps; ++r)
+   {
+      std::ostringstream os;
+      bn::decode_b64(e.begin(), e.end(), std::ostream_iterator<char>(os, ""));
+      d = os.str();
+   }
+   double tolddec = elapsedms(t) / reps;
+   REQUIRE(d == s);
+
+   logmsg(kLINFO, "base64 benchmark (" + std::to_string(len / 1048576) + " MB):");
+   logmsg(kLINFO, "  basen  : encode " + std::to_string(mb * 1000 / toldenc) + " MB/s, decode " + std::to_string(mb * 1000 / tolddec) + " MB/s");
+
+   for (auto k : _kernels())
+   {
+      base64::use(k);
+      t = std::chrono::steady_clock::now();
+      for (int r = 0; r < reps; ++r)
+         e = base64::encode(s);
+      double tenc = elapsedms(t) / reps;
+      t = std::chrono::steady_clock::now();
+      for (int r = 0; r < reps; ++r)
+         d = base64::decode(e);
+      double tdec = elapsedms(t) / reps;
+      REQUIRE(d == s);
+
+      std::string n = base64::name(k);
+      n.resize(7, ' ');
+      logmsg(kLINFO, "  " + n + ": encode " + std::to_string(mb * 1000 / tenc) + " MB/s, decode " + std::to_string(mb * 1000 / tdec) + " MB/s");
+   }
+   base64::use(base64::best());
+}
@@ -0,0 +1,64 @@
+#include <Poco/File.h>
+#include <Poco/Path.h>
+
+#include "catch/catch.h"
+#include "catalogue.h"
+#include "gitcache.h"
+#include "utils.h"
+#include "drunner_paths.h"
+#include "testutils.h"
+
+using namespace testutils;
+
+TEST_CASE("Test that the registry catalogue indexes and caches registries", "[catalogue.h]") {
+   scratchroot root("drunner_test_catalogue_root");
+   Poco::Path dir = freshdir("drunner_test_catalogue");
+   Poco::File(drunnerPaths::getPath_GitCache()).createDirectories();
+
+   const std::string git = "git -c user.name=test -c user.email=test@test ";
+   std::vector<registrydefinition> defs;
+   for (std::string name : { "one", "two" })
+   {
+      REQUIRE(0 == sh(dir.toString(), "git init --quiet --bare " + name + ".git && git init --quiet " + name));
+      REQUIRE(0 == sh(dir.toString() + name, "printf '# comment\\nHelloWorld https://x/" + name + ".git \"" + name + " hello\"\\nother https://x/o.git desc\\n' > registry && git add registry && " +
+         git + "commit --quiet -m one && git push --quiet ../" + name + ".git HEAD:refs/heads/master"));
+      defs.push_back(registrydefinition(name, "file://" + dir.toString() + name + ".git"));
+   }
+
+   {
+      sourcecopy::catalogue cat;
+      REQUIRE(cat.refresh(defs) == kRSuccess);
+      REQUIRE(cat.getAll().size() == 2);
+
+      sourcecopy::registryitem item;
+      REQUIRE(cat.find("TWO", "helloworld", item).success());
+      REQUIRE(item.url == "https://x/two.git");
+      REQUIRE(item.description == "\"two hello\"");
+      REQUIRE(cat.find("one", "missing", item).error());
+   }
+
+   SECTION("The index is reused while the registries are unchanged")
+   {
+      sourcecopy::catalogue cat;
+      sourcecopy::registryitem item;
+      REQUIRE(cat.find("one", "other", item).success()); // straight from the index file.
+      REQUIRE(cat.refresh(defs) == kRNoChange);
+   }
+
+   SECTION("A registry is reparsed when its commit changes")
+   {
+      REQUIRE(0 == sh(dir.toString() + "one", "echo 'added https://x/a.git new' >> registry && " + git + "commit --quiet -am two && git push --quiet ../one.git HEAD:refs/heads/master"));
+      {  // the remote is only asked again once the TTL is up.
+         gitrefs refs;
+         refs.find(defs[0].mURL, "master")->checked = 0;
+         refs.save();
+      }
+
+      sourcecopy::catalogue cat;
+      REQUIRE(cat.refresh(defs) == kRSuccess);
+      sourcecopy::registryitem item;
+      REQUIRE(cat.find("one", "added", item).success());
+   }
+
+   rmdir(dir);
+}
@@ -0,0 +1,100 @@
+#include <Poco/File.h>
+#include <Poco/Path.h>
+
+#include "catch/catch.h"
+#include "gitcache.h"
+#include "utils.h"
+#include "drunner_paths.h"
+#include "testutils.h"
+
+using namespace testutils;
+
+TEST_CASE("Test that gitcache fetches tags shallowly and caches them", "[gitcache.h]") {
+   scratchroot root("drunner_test_gitcache_root");
+   Poco::Path dir = freshdir("drunner_test_gitcache");
+   Poco::File(drunnerPaths::getPath_GitCache()).createDirectories();
+
+   const std::string git = "git -c user.name=test -c user.email=test@test ";
+   REQUIRE(0 == sh(dir.toString(), "git init --quiet --bare remote.git && git init --quiet work"));
+   std::string work = dir.toString() + "work";
+   // two commits, so the shallow fetches cut history off at a parent.
+   REQUIRE(0 == sh(work, "echo zero > a.txt && git add a.txt && " + git + "commit --quiet -m zero && " +
+      "echo one > a.txt && " + git + "commit --quiet -am one && " +
+      git + "tag -a v1 -m v1 && git push --quiet ../remote.git HEAD:refs/heads/master v1"));
+
+   std::string url = "file://" + dir.toString() + "remote.git";
+
+   SECTION("Tags are fetched shallowly and trusted until the TTL expires")
+   {
+      gitcache gc(url, "v1");
+      rmdir(gc.getCachePath());
+
+      Poco::Path p;
+      REQUIRE(gc.get(p, true).success());
+      REQUIRE(read(Poco::Path(p, "a.txt")) == "one\n");
+      // objects live in the shared store, fetched shallowly.
+      REQUIRE(utils::fileexists(Poco::Path(p.toString() + ".git/objects/info/alternates")));
+      REQUIRE(utils::fileexists(Poco::Path(drunnerPaths::getPath_GitCache().toString() + "shared.git/shallow")));
+      // and git in the checkout knows where history stops.
+      REQUIRE(0 == sh(p.toString(), "git rev-list --count HEAD && git gc --quiet --prune=now"));
+
+      // within the TTL the remote isn't needed at all.
+      REQUIRE(0 == sh(dir.toString(), "mv remote.git gone.git"));
+      REQUIRE(gc.get(p, true).success());
+      REQUIRE(read(Poco::Path(p, "a.txt")) == "one\n");
+      REQUIRE(0 == sh(dir.toString(), "mv gone.git remote.git"));
+
+      rmdir(gc.getCachePath());
+   }
+
+   SECTION("Branches are updated when the remote moves")
+   {
+      gitcache gc(url, "master");
+      rmdir(gc.getCachePath());
+      gc.setTTL(0);
+
+      Poco::Path p;
+      REQUIRE(gc.get(p, true).success());
+      REQUIRE(read(Poco::Path(p, "a.txt")) == "one\n");
+
+      REQUIRE(0 == sh(work, "echo two > a.txt && " + git + "commit --quiet -am two && git push --quiet ../remote.git HEAD:refs/heads/master"));
+
+      // without forceUpdate the cached checkout is used as is.
+      REQUIRE(gc.get(p, false).success());
+      REQUIRE(read(Poco::Path(p, "a.txt")) == "one\n");
+
+      REQUIRE(gc.get(p, true).success());
+      REQUIRE(read(Poco::Path(p, "a.txt")) == "two\n");
+
+      rmdir(gc.getCachePath());
+   }
+
+   SECTION("Clean expires unused entries")
+   {
+      gitcache gc(url, "v1");
+      rmdir(gc.getCachePath());
+
+      Poco::Path p;
+      REQUIRE(gc.get(p, true).success());
+
+      REQUIRE(gitcache::clean(1).success());
+      REQUIRE(utils::fileexists(p));
+
+      {
+         gitrefs refs;
+         REQUIRE(refs.find(url, "v1") != NULL);
+         refs.find(url, "v1")->used = 0;
+         refs.save();
+      }
+      REQUIRE(gitcache::clean(1).success());
+      REQUIRE(!utils::fileexists(p));
+      REQUIRE(gitrefs().find(url, "v1") == NULL);
+
+      // and it comes back from the remote.
+      REQUIRE(gc.get(p, true).success());
+      REQUIRE(read(Poco::Path(p, "a.txt")) == "one\n");
+      rmdir(gc.getCachePath());
+   }
+
+   rmdir(dir);
+}
@@ -0,0 +1,170 @@
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+
+#include <Poco/File.h>
+#include <Poco/Path.h>
+#include <Poco/DirectoryIterator.h>
+
+#include "catch/catch.h"
+#include "globallogger.h"
+#include "drunner_paths.h"
+#include "testutils.h"
+
+using namespace testutils;
+
+TEST_CASE("Test that the log file keeps each thread's messages in order", "[globallogger.h]") {
+   scratchroot root("drunner_test_globallogger_root");
+   const int nthreads = 4, nmsgs = 25;
+   std::string tag = "ordertest" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + "-";
+
+   std::vector<std::thread> threads;
+   for (int t = 0; t < nthreads; ++t)
+      threads.push_back(std::thread([&, t]() {
+         for (int i = 0; i < nmsgs; ++i)
+            logmsg(kLINFO, tag + std::to_string(t) + "-" + std::to_string(i));
+      }));
+   for (auto & t : threads)
+      t.join();
+   logflush();
+
+   std::ifstream is(drunnerPaths::getPath_Logs().setFileName("log.txt").toString());
+   std::vector<int> next(nthreads, 0);
+   std::string line;
+   while (std::getline(is, line))
+   {
+      size_t pos = line.find(tag);
+      if (pos == std::string::npos)
+         continue;
+      int t, i;
+      char dash;
+      std::istringstream iss(line.substr(pos + tag.length()));
+      iss >> t >> dash >> i;
+      REQUIRE(t >= 0);
+      REQUIRE(t < nthreads);
+      REQUIRE(i == next[t]);
+      ++next[t];
+   }
+   for (int t = 0; t < nthreads; ++t)
+      REQUIRE(next[t] == nmsgs);
+}
+
+TEST_CASE("Test that the log follows log.txt when another drunner rotates it", "[globallogger.h]") {
+   scratchroot root("drunner_test_globallogger_root");
+   std::string tag = "rotatetest" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+   Poco::Path logfile = drunnerPaths::getPath_Logs().setFileName("log.txt");
+   Poco::Path moved = drunnerPaths::getPath_Logs().setFileName("rotatetest_log.old");
+
+   logmsg(kLINFO, tag + " before");
+   logflush();
+   // as another drunner does when it rotates: our open stream is now the archive.
+   REQUIRE(0 == std::rename(logfile.toString().c_str(), moved.toString().c_str()));
+   logmsg(kLINFO, tag + " after");
+   logflush();
+
+   auto contains = [](const Poco::Path & p, const std::string & text) {
+      std::ifstream is(p.toString());
+      std::stringstream ss;
+      ss << is.rdbuf();
+      return ss.str().find(text) != std::string::npos;
+   };
+   REQUIRE(contains(moved, tag + " before"));
+   REQUIRE(!contains(moved, tag + " after"));
+   REQUIRE(contains(logfile, tag + " after"));
+   Poco::File(moved).remove();
+}
+
+TEST_CASE("Test that lazy log formatting fills in each {}", "[globallogger.h]") {
+   static_assert(logformat::placeholders("a {} b {} c") == 2, "placeholders");
+   static_assert(logformat::placeholders("no braces { }") == 0, "placeholders");
+
+   REQUIRE(logformat::format("plain") == "plain");
+   REQUIRE(logformat::format("{} + {} = {}", 1, 2.5, std::string("3.5")) == "1 + 2.500000 = 3.5");
+   REQUIRE(logformat::format("Copied {} to {}", "a", Poco::Path("/tmp/b")) == "Copied a to /tmp/b");
+   REQUIRE(logformat::format("{}{}", 'x', true) == "x1");
+
+   // arguments aren't evaluated when the level is filtered out.
+   int evaluated = 0;
+   auto arg = [&]() { ++evaluated; return std::string("x"); };
+   if (!logenabled(kLDEBUG))
+   {
+      drunner_log(kLDEBUG, "never {}", arg());
+      drunner_logmsg(kLDEBUG, "never " + arg());
+      REQUIRE(evaluated == 0);
+   }
+   REQUIRE(logenabled(kLERROR));
+}
+
+static void _copytree(const Poco::Path & src, const Poco::Path & dest, bool lazy)
+{
+   Poco::File(dest).createDirectories();
+   for (Poco::DirectoryIterator it(src), end; it != end; ++it)
+   {
+      Poco::Path d(dest, it.name());
+      if (it->isDirectory())
+         _copytree(Poco::Path(it.path()).makeDirectory(), d.makeDirectory(), lazy);
+      else
+      {
+         it->copyTo(d.toString());
+         if (lazy)
+            drunner_log(kLDEBUG, "Copied {} to {}", it.path(), d);
+         else
+            logmsg(kLDEBUG, "Copied " + it.path().toString() + " to " + d.toString());
+      }
+   }
+}
+
+TEST_CASE("Benchmark debug logging in a tree copy at INFO level", "[globallogger.h][.][benchmark]") {
+   REQUIRE(!logenabled(kLDEBUG));
+
+   Poco::Path root(Poco::Path::temp());
+   root.pushDirectory("drunner_bench_logging");
+   if (Poco::File(root).exists())
+      Poco::File(root).remove(true);
+   Poco::Path src(root);
+   src.pushDirectory("src");
+   for (int d = 0; d < 20; ++d)
+   {
+      Poco::Path sub(src);
+      sub.pushDirectory("directory_number_" + std::to_string(d));
+      Poco::File(sub).createDirectories();
+      for (int f = 0; f < 100; ++f)
+         std::ofstream(Poco::Path(sub, "file_number_" + std::to_string(f) + ".txt").toString()) << f;
+   }
+
+   const int reps = 5;
+   double t[2] = { 0,0 };
+   for (int r = 0; r < reps; ++r)
+      for (int lazy = 0; lazy < 2; ++lazy)
+      {
+         Poco::Path dest(root);
+         dest.pushDirectory("dest" + std::to_string(lazy));
+         auto start = std::chrono::steady_clock::now();
+         _copytree(src, dest, lazy == 1);
+         t[lazy] += elapsedms(start);
+         Poco::File(dest).remove(true);
+      }
+
+   // the messages alone, without the disk.
+   const int n = 200000;
+   Poco::Path a("/home/drunner/services/example/directory_number_1/file_number_1.txt");
+   Poco::Path b("/home/drunner/.drunner10/temp/example/directory_number_1/file_number_1.txt");
+   double m[2];
+   auto start = std::chrono::steady_clock::now();
+   for (int i = 0; i < n; ++i)
+      logmsg(kLDEBUG, "Copied " + a.toString() + " to " + b.toString());
+   m[0] = elapsedms(start);
+   start = std::chrono::steady_clock::now();
+   for (int i = 0; i < n; ++i)
+      drunner_log(kLDEBUG, "Copied {} to {}", a, b);
+   m[1] = elapsedms(start);
+
+   Poco::File(root).remove(true);
+
+   logmsg(kLINFO, "debug logging at INFO level (copy of 2000 files, " + std::to_string(reps) + " runs):");
+   logmsg(kLINFO, "  eager logmsg (old): " + std::to_string(t[0] / reps) + " ms per copy, " + std::to_string(m[0] * 1000000 / n) + " ns per message");
+   logmsg(kLINFO, "  drunner_log (new) : " + std::to_string(t[1] / reps) + " ms per copy, " + std::to_string(m[1] * 1000000 / n) + " ns per message");
+}
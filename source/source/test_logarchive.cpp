@@ -0,0 +1,205 @@
+#include <fstream>
+#include <sstream>
+#include <chrono>
+
+#include <Poco/File.h>
+#include <Poco/Path.h>
+
+#include "catch/catch.h"
+#include "logarchive.h"
+#include "globallogger.h"
+#include "testutils.h"
+
+using namespace testutils;
+
+// append a block of lines to the log as the logger does, indexed.
+static void _logblock(const Poco::Path & log, time_t when, eLogLevel level, const std::string & service, const std::string & msg, int lines = 1)
+{
+   static const char * names[] = { "DEBUG","INFO ","WARN ","ERROR" };
+   char stamp[32];
+   struct tm tm;
+   localtime_r(&when, &tm);
+   strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M", &tm);
+
+   std::string text;
+   for (int i = 0; i < lines; ++i)
+      text += std::string("|") + names[level] + "|" + stamp + "| " + msg + "\n";
+
+   std::ofstream os(log.toString(), std::ios_base::app | std::ios_base::binary);
+   os.seekp(0, std::ios_base::end);
+   logarchive::block b;
+   b.first = b.last = when;
+   b.levels = (1 << level);
+   b.service = service;
+   b.offset = (uint64_t)os.tellp();
+   b.length = text.length();
+   os << text;
+   logarchive::appendindex(log, b);
+}
+
+static std::string _show(const Poco::Path & dir, const logarchive::query & q)
+{
+   std::ostringstream oss;
+   REQUIRE(!logarchive::show(dir, q, oss).error());
+   return oss.str();
+}
+
+TEST_CASE("Test that logs are indexed, compressed and queried", "[logarchive.h]") {
+   Poco::Path dir = freshdir("drunner_test_logarchive");
+   Poco::Path archive = Poco::Path(dir).setFileName("2016_10_19__10_00_00_log.txt");
+   Poco::Path current = Poco::Path(dir).setFileName("log.txt");
+   time_t now = time(NULL);
+
+   _logblock(archive, now - 7200, kLINFO, "", "old info");
+   _logblock(archive, now - 7200, kLWARN, "web", "old web warning");
+   for (int i = 0; i < 200; ++i) // enough for a few gzip members.
+      _logblock(archive, now - 7000, kLINFO, "db", "filler " + std::to_string(i), 50);
+   _logblock(current, now, kLDEBUG, "web", "new web debug");
+   _logblock(current, now, kLERROR, "db", "new db error");
+
+   SECTION("Index lines round trip")
+   {
+      logarchive::block b, c;
+      b.first = 1; b.last = 2; b.levels = 6; b.offset = 100; b.length = 50; b.zoffset = 7; b.zlength = 9; b.service = "my service";
+      REQUIRE(logarchive::block::parse(b.line(), c));
+      REQUIRE(c.line() == b.line());
+      REQUIRE(c.haslevel(kLWARN));
+      REQUIRE(!logarchive::block::parse("garbage", c));
+   }
+
+   SECTION("Queries filter by level, service and time, compressed or not")
+   {
+      for (int compressed = 0; compressed < 2; ++compressed)
+      {
+         if (compressed)
+         {
+            std::string before = read(archive);
+            REQUIRE(logarchive::compress(archive).success());
+            REQUIRE(!Poco::File(archive).exists());
+            Poco::Path gz = Poco::Path(dir).setFileName(archive.getFileName() + ".gz");
+            REQUIRE(logarchive::readindex(gz).size() == 202);
+            REQUIRE(logarchive::readindex(gz).back().zoffset > 0);
+            REQUIRE(read(gz).length() < before.length() / 5);
+         }
+
+         logarchive::query q;
+         std::string all = _show(dir, q);
+         REQUIRE(all.find("old info") < all.find("filler 199"));
+         REQUIRE(all.find("filler 199") < all.find("new db error"));
+
+         q.level = kLWARN;
+         std::string warn = _show(dir, q);
+         REQUIRE(warn.find("old web warning") != std::string::npos);
+         REQUIRE(warn.find("new db error") != std::string::npos);
+         REQUIRE(warn.find("filler") == std::string::npos);
+         REQUIRE(warn.find("debug") == std::string::npos);
+
+         q.level = kLDEBUG;
+         q.service = "WEB";
+         std::string web = _show(dir, q);
+         REQUIRE(web.find("old web warning") != std::string::npos);
+         REQUIRE(web.find("new web debug") != std::string::npos);
+         REQUIRE(web.find("db") == std::string::npos);
+
+         q.service = "";
+         REQUIRE(logarchive::parsesince("30m", q.since));
+         std::string recent = _show(dir, q);
+         REQUIRE(recent.find("old") == std::string::npos);
+         REQUIRE(recent.find("new web debug") != std::string::npos);
+      }
+   }
+
+   SECTION("Tidy compresses archives and enforces the limits")
+   {
+      Poco::Path older = Poco::Path(dir).setFileName("2016_10_18__10_00_00_log.txt");
+      _logblock(older, now - 90000, kLINFO, "", "older");
+      logarchive::tidy(dir, 0, 0);
+      REQUIRE(Poco::File(Poco::Path(dir).setFileName(older.getFileName() + ".gz")).exists());
+      REQUIRE(Poco::File(Poco::Path(dir).setFileName(archive.getFileName() + ".gz")).exists());
+      REQUIRE(!Poco::File(archive).exists());
+
+      logarchive::tidy(dir, 1, 0); // only the current log survives.
+      REQUIRE(!Poco::File(Poco::Path(dir).setFileName(older.getFileName() + ".gz")).exists());
+      REQUIRE(!Poco::File(Poco::Path(dir).setFileName(archive.getFileName() + ".gz")).exists());
+      REQUIRE(Poco::File(current).exists());
+   }
+
+   SECTION("since parses dates and ages")
+   {
+      time_t t;
+      REQUIRE(logarchive::parsesince("2h", t));
+      REQUIRE(std::abs((long)(time(NULL) - 7200 - t)) < 5);
+      REQUIRE(logarchive::parsesince("2016-10-19", t));
+      REQUIRE(logarchive::parsesince("2016-10-19 14:30", t));
+      REQUIRE(!logarchive::parsesince("2h30", t));
+      REQUIRE(!logarchive::parsesince("yesterday", t));
+   }
+
+   Poco::File(dir).remove(true);
+}
+
+static std::string _msgfor(int i)
+{
+   return "GET /api/v1/items/" + std::to_string(i * 104729 % 1000003) + " 200 " + std::to_string(i * 37 % 1000) +
+      "ms from 10.0." + std::to_string(i % 256) + ".12 agent curl/7.47.0";
+}
+
+TEST_CASE("Benchmark drunner logs on a large log", "[logarchive.h][.][benchmark]") {
+   Poco::Path dir = freshdir("drunner_bench_logarchive");
+   time_t now = time(NULL);
+
+   // ~100 MB over 40 archives and the current log, a few warnings from one service.
+   for (int a = 0; a <= 40; ++a)
+   {
+      char name[64];
+      snprintf(name, sizeof(name), "2016_10_%02d__10_00_00_log.txt", a % 28 + 1);
+      Poco::Path log = Poco::Path(dir).setFileName(a == 40 ? std::string("log.txt") : std::to_string(1000 + a) + name);
+      for (int b = 0; b < 200; ++b)
+         _logblock(log, now - (40 - a) * 3600, kLINFO, "svc" + std::to_string(b % 10),
+            _msgfor(a * 200 + b), 150);
+      _logblock(log, now - (40 - a) * 3600, kLWARN, "needle", "warning " + std::to_string(a));
+   }
+   Poco::Path archived = Poco::Path(dir).setFileName("10002016_10_01__10_00_00_log.txt");
+   size_t rawsize = read(archived).length();
+
+   logarchive::query q;
+   q.level = kLWARN;
+   q.service = "needle";
+   q.since = now - 10 * 3600 - 60;
+   auto t = std::chrono::steady_clock::now();
+   std::string found = _show(dir, q);
+   double tindexed = elapsedms(t);
+   REQUIRE(found.find("warning 40") != std::string::npos);
+   REQUIRE(found.find("warning 10") == std::string::npos);
+
+   t = std::chrono::steady_clock::now();
+   logarchive::tidy(dir, 0, 0);
+   double tcompress = elapsedms(t);
+   size_t gzsize = read(Poco::Path(dir).setFileName(archived.getFileName() + ".gz")).length();
+
+   t = std::chrono::steady_clock::now();
+   std::string foundz = _show(dir, q);
+   double tindexedz = elapsedms(t);
+   REQUIRE(foundz == found);
+
+   // without the indexes every line has to be read, and the service can't be told.
+   Poco::File(dir).remove(true);
+   dir = freshdir("drunner_bench_logarchive");
+   Poco::Path log = Poco::Path(dir).setFileName("log.txt");
+   for (int a = 0; a <= 40; ++a)
+      _logblock(log, now - (40 - a) * 3600, kLINFO, "", _msgfor(a), 150 * 200);
+   Poco::File(logarchive::indexpath(log)).remove();
+   size_t scanned = read(log).length();
+   q.service = "";
+   t = std::chrono::steady_clock::now();
+   _show(dir, q);
+   double tscan = elapsedms(t);
+   Poco::File(dir).remove(true);
+
+   logmsg(kLINFO, "drunner logs benchmark (" + std::to_string(scanned / 1048576) + " MB of log):");
+   logmsg(kLINFO, "  --since 10h --level warn, scanning  : " + std::to_string(tscan) + " ms");
+   logmsg(kLINFO, "  --since 10h --level warn --service : " + std::to_string(tindexed) + " ms");
+   logmsg(kLINFO, "  the same, archives compressed      : " + std::to_string(tindexedz) + " ms");
+   logmsg(kLINFO, "  compressing 40 archives            : " + std::to_string(tcompress) + " ms, " +
+      std::to_string(rawsize / 1024) + " KB to " + std::to_string(gzsize / 1024) + " KB each");
+}
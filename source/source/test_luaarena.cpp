@@ -0,0 +1,83 @@
+#include <string>
+
+#include "catch/catch.h"
+#include "service_lua_arena.h"
+
+static lua_State * newarenastate(servicelua::luaarena & a)
+{
+   lua_State * L = lua_newstate(servicelua::luaarena::alloc, &a);
+   luaL_openlibs(L);
+   return L;
+}
+
+TEST_CASE("Test the lua arena allocator", "[service_lua_arena.h]") {
+
+   SECTION("Run a script and collect statistics")
+   {
+      servicelua::luaarena a;
+      lua_State * L = newarenastate(a);
+      a.trackgc(L);
+
+      std::string script = R"EOF(
+         local t = {}
+         for i = 1, 10000 do t[i] = "item" .. i end
+         t = nil
+         collectgarbage()
+         collectgarbage()
+         s = string.rep("x", 100000)
+      )EOF";
+      REQUIRE(luaL_dostring(L, script.c_str()) == 0);
+
+      REQUIRE(a.getNumAllocs() > 10000);
+      REQUIRE(a.getPeak() > 100000);
+      REQUIRE(a.getInUse() <= a.getPeak());
+      REQUIRE(a.getGCCycles() >= 2);
+      REQUIRE(!a.limitHit());
+
+      lua_close(L);
+      REQUIRE(a.getInUse() == 0);
+   }
+
+   SECTION("Hard limit stops a runaway script")
+   {
+      servicelua::luaarena a(2 * 1024 * 1024);
+      lua_State * L = newarenastate(a);
+
+      std::string script = R"EOF(
+         local t = {}
+         for i = 1, 10000000 do t[i] = "item" .. i end
+      )EOF";
+      REQUIRE(luaL_loadstring(L, script.c_str()) == LUA_OK);
+      REQUIRE(lua_pcall(L, 0, 0, 0) == LUA_ERRMEM);
+      REQUIRE(a.limitHit());
+      REQUIRE(a.getPeak() <= a.getLimit());
+
+      // the state is still usable once the garbage is gone.
+      lua_settop(L, 0);
+      REQUIRE(luaL_dostring(L, "x = 1 + 1") == 0);
+
+      lua_close(L);
+      REQUIRE(a.getInUse() == 0);
+   }
+
+   SECTION("A lazy limit is only asked for once it could matter")
+   {
+      int asked = 0;
+      servicelua::luaarena a([&asked]() { ++asked; return (size_t)(2 * 1024 * 1024); });
+      lua_State * L = newarenastate(a);
+      REQUIRE(luaL_dostring(L, "x = 1 + 1") == 0);
+      REQUIRE(asked == 0);
+      REQUIRE(a.getLimit() == 0);
+
+      std::string script = R"EOF(
+         local t = {}
+         for i = 1, 10000000 do t[i] = "item" .. i end
+      )EOF";
+      REQUIRE(luaL_loadstring(L, script.c_str()) == LUA_OK);
+      REQUIRE(lua_pcall(L, 0, 0, 0) == LUA_ERRMEM);
+      REQUIRE(asked == 1);
+      REQUIRE(a.limitHit());
+
+      lua_close(L);
+   }
+}
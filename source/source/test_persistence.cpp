@@ -0,0 +1,141 @@
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include <Poco/File.h>
+#include <Poco/Path.h>
+#include <Poco/DirectoryIterator.h>
+
+#include "catch/catch.h"
+#include "persistence.h"
+#include "variables.h"
+
+static std::string _contents(Poco::Path p)
+{
+   std::ifstream is(p.toString());
+   std::ostringstream oss;
+   oss << is.rdbuf();
+   return oss.str();
+}
+
+TEST_CASE("Test that persistence writes atomically and only when needed", "[persistence.h]") {
+   Poco::Path dir(Poco::Path::temp());
+   dir.pushDirectory("drunner_test_persistence");
+   Poco::File(dir).createDirectories();
+
+   Poco::Path f(dir);
+   f.setFileName("settings.json");
+
+   SECTION("Immediate writes skip identical contents")
+   {
+      REQUIRE(persistence::writefile(f, "one").success());
+      REQUIRE(_contents(f) == "one");
+      REQUIRE(persistence::writefile(f, "one").noChange());
+      REQUIRE(persistence::writefile(f, "two").success());
+      REQUIRE(_contents(f) == "two");
+
+      // no temporary files left behind.
+      int n = 0;
+      for (Poco::DirectoryIterator it(dir), end; it != end; ++it)
+         ++n;
+      REQUIRE(n == 1);
+   }
+
+   SECTION("Saves are coalesced until flushed")
+   {
+      persistence::save(f, "first");
+      persistence::save(f, "second");
+      REQUIRE(persistence::exists(f));
+      REQUIRE(!Poco::File(f).exists());
+
+      std::string s;
+      REQUIRE(persistence::load(f, s).success());
+      REQUIRE(s == "second");
+
+      REQUIRE(persistence::flush().success());
+      REQUIRE(_contents(f) == "second");
+      REQUIRE(persistence::flush().noChange());
+
+      persistence::save(f, "second");
+      REQUIRE(persistence::flush().noChange());
+   }
+
+   SECTION("Flushing one file leaves the others queued")
+   {
+      Poco::Path g(dir);
+      g.setFileName("other.json");
+      persistence::save(f, "mine");
+      persistence::save(g, "other");
+      REQUIRE(persistence::flush(f).success());
+      REQUIRE(_contents(f) == "mine");
+      REQUIRE(!Poco::File(g).exists());
+      REQUIRE(persistence::flush(f).noChange());
+      REQUIRE(persistence::flush().success());
+      REQUIRE(_contents(g) == "other");
+   }
+
+   SECTION("JSON round trip")
+   {
+      keyVals a, b;
+      a.setVal("Fish", "trout");
+      a.setVal("COLOUR", "blue");
+      REQUIRE(persistence::savejson(f, a).success());
+      REQUIRE(persistence::loadjson(f, b).success());
+      REQUIRE(b.getVal("fish") == "trout");
+      REQUIRE(b.getVal("colour") == "blue");
+      REQUIRE(persistence::flush().success());
+
+      std::string s;
+      Poco::Path missing(dir);
+      missing.setFileName("missing.json");
+      REQUIRE(persistence::load(missing, s).noChange());
+   }
+
+   SECTION("Pending writes to deleted directories are discarded, to missing ones are errors")
+   {
+      Poco::Path gone(dir);
+      gone.pushDirectory("gone");
+      gone.setFileName("x.json");
+      persistence::save(gone, "x");
+      persistence::discard(Poco::Path(gone).setFileName(""));
+      REQUIRE(persistence::flush().noChange());
+      REQUIRE(!persistence::exists(gone));
+
+      persistence::save(gone, "x");
+      REQUIRE(persistence::flush().error());
+      REQUIRE(!persistence::exists(gone));
+   }
+
+   SECTION("Files changed by someone else are written again")
+   {
+      REQUIRE(persistence::writefile(f, "ours").success());
+      {
+         std::ofstream os(f.toString(), std::ios::trunc);
+         os << "theirs";
+      }
+      REQUIRE(persistence::writefile(f, "ours").success());
+      REQUIRE(_contents(f) == "ours");
+   }
+
+   SECTION("File locks exclude each other")
+   {
+      std::atomic<int> stage(0);
+      std::thread t;
+      {
+         persistence::filelock lock(f);
+         t = std::thread([&]() {
+            persistence::filelock lock2(f);
+            stage = (stage == 1) ? 2 : -1; // must only get here once the first lock is gone.
+         });
+         std::this_thread::sleep_for(std::chrono::milliseconds(100));
+         REQUIRE(stage == 0);
+         stage = 1;
+      }
+      t.join();
+      REQUIRE(stage == 2);
+   }
+
+   Poco::File(dir).remove(true);
+}
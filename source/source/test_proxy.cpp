@@ -0,0 +1,150 @@
+#include <sstream>
+#include <chrono>
+#include <thread>
+
+#include <Poco/String.h>
+#include <cereal/archives/json.hpp>
+
+#include "catch/catch.h"
+#include "proxy.h"
+#include "caddy.h"
+#include "nginx.h"
+#include "utils.h"
+#include "utils_docker.h"
+#include "globallogger.h"
+#include "globalcontext.h"
+#include "exceptions.h"
+
+TEST_CASE("Test that proxy settings validate and load", "[proxy.h]") {
+   proxydatum pd("svc", "svc.example.com", "drunner-svc", "80", "", "fake", true);
+
+   SECTION("Options are validated")
+   {
+      REQUIRE(pd.valid().success());
+
+      pd.options.balance = "leastconn";
+      pd.options.compression = 9;
+      pd.options.upstreams = { "drunner-svc-2" };
+      REQUIRE(pd.valid().success());
+      REQUIRE(pd.containers().size() == 2);
+
+      pd.options.balance = "random";
+      REQUIRE(pd.valid().error());
+      pd.options.balance = "";
+      pd.options.compression = 10;
+      REQUIRE(pd.valid().error());
+      pd.options.compression = -1;
+      pd.options.upstreams.push_back("");
+      REQUIRE(pd.valid().error());
+   }
+
+   SECTION("Domains must be hostnames")
+   {
+      pd.domain = "svc.example.com; rm -rf /";
+      REQUIRE(pd.valid().error());
+      pd.domain = "$(id).example.com";
+      REQUIRE(pd.valid().error());
+      pd.domain = "-svc.example.com";
+      REQUIRE(pd.valid().error());
+      pd.domain = "svc-1.Example.com";
+      REQUIRE(pd.valid().success());
+   }
+
+   SECTION("Options take part in equality")
+   {
+      proxydatum b(pd);
+      REQUIRE(pd == b);
+      b.options.keepalive = 32;
+      REQUIRE(!(pd == b));
+   }
+
+   SECTION("Settings round trip and are keyed by service")
+   {
+      proxydata d;
+      pd.options.http2 = false;
+      d.mProxyData[proxydata::key("SVC")] = pd;
+
+      std::ostringstream os;
+      {
+         cereal::JSONOutputArchive archive(os);
+         archive(d);
+      }
+
+      proxydata d2;
+      std::istringstream is(os.str());
+      {
+         cereal::JSONInputArchive archive(is);
+         archive(d2);
+      }
+      REQUIRE(d2.mProxyData.size() == 1);
+      REQUIRE(d2.mProxyData.count("svc") == 1);
+      REQUIRE(d2.mProxyData["svc"] == pd);
+   }
+
+   SECTION("Transactions are for the main thread only")
+   {
+      bool refused = false;
+      std::thread t([&refused]() {
+         try
+         {
+            proxytransaction pt;
+         }
+         catch (const eExit &)
+         {
+            refused = true;
+         }
+      });
+      t.join();
+      REQUIRE(refused);
+   }
+}
+
+// Load test a proxy backend: two upstream containers behind it, hammered with ab from a
+// container on the proxy network. Needs docker and the network access to pull the images.
+// e.g. drunner configure PROXY=nginx && drunner unittest [loadtest]
+TEST_CASE("Load test the configured proxy backend", "[proxy.h][.][loadtest]") {
+   const std::string domain = "loadtest.drunner.local";
+   const std::vector<std::string> upstreams = { "drunner-loadtest-1", "drunner-loadtest-2" };
+
+   if (utils_docker::dockerContainerRunning(caddy::container()) || utils_docker::dockerContainerRunning(nginx::container()))
+   {
+      WARN("A proxy is already running - not load testing over the top of it.");
+      return;
+   }
+
+   std::string op;
+   for (const auto & u : upstreams)
+      REQUIRE(utils::runcommand(CommandLine("docker", { "run","-d","--rm","--name",u,"--network=" + proxy::networkName(),"nginxdemos/hello" }), op) == 0);
+
+   proxyoptions o;
+   o.upstreams = { upstreams[1] };
+   o.keepalive = 32;
+   std::vector<proxydatum> data = { proxydatum("loadtest", domain, upstreams[0], "80", "", "fake", true, o) };
+
+   std::string backend = GlobalContext::getSettings()->getProxy();
+   std::unique_ptr<proxyplugin> plugin;
+   if (Poco::icompare(backend, "nginx") == 0)
+      plugin.reset(new nginx(data));
+   else
+      plugin.reset(new caddy(data));
+   REQUIRE(!plugin->restart().error());
+
+   std::string ip = utils_docker::getIPAddress(plugin->containerName(), proxy::networkName());
+   auto t = std::chrono::steady_clock::now();
+   int rval = utils::runcommand(CommandLine("docker", { "run","--rm","--network=" + proxy::networkName(),
+      "--add-host",domain + ":" + ip,"jordi/ab","-k","-n","20000","-c","64","https://" + domain + "/" }), op);
+   double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+
+   for (const auto & u : upstreams)
+      utils_docker::removeContainer(u);
+   utils_docker::removeContainer(plugin->containerName());
+
+   logmsg(kLINFO, "proxy load test (" + plugin->name() + ", 20000 requests, 64 concurrent, " + std::to_string(secs) + " s):");
+   std::istringstream lines(op);
+   std::string line;
+   while (std::getline(lines, line))
+      if (line.find("Requests per second") == 0 || line.find("Time per request") == 0 ||
+         line.find("Failed requests") == 0 || line.find("Transfer rate") == 0 || line.find("  99%") == 0)
+         logmsg(kLINFO, "  " + line);
+   REQUIRE(rval == 0);
+}
@@ -0,0 +1,87 @@
+#include <chrono>
+
+#include "catch/catch.h"
+#include "search.h"
+#include "globallogger.h"
+#include "testutils.h"
+
+using namespace testutils;
+
+static sourcecopy::registryitem _item(std::string name, std::string desc)
+{
+   sourcecopy::registryitem i;
+   i.nicename = name;
+   i.url = "https://x/" + name + ".git";
+   i.description = desc;
+   return i;
+}
+
+TEST_CASE("Test that search ranks registry entries sensibly", "[search.h]") {
+   std::vector<sourcecopy::catalogueentry> entries(2);
+   entries[0].nicename = "drunner";
+   entries[0].items = { _item("helloworld", "A simple example"), _item("minecraft", "Minecraft server"),
+      _item("rocketchat", "Team chat, like Slack") };
+   entries[1].nicename = "internal";
+   entries[1].items = { _item("hello", "Greeting service"), _item("chatops", "Bots for the world") };
+
+   sourcecopy::searchindex index(entries);
+
+   SECTION("Exact and prefix name matches come first")
+   {
+      auto r = index.search("Hello");
+      REQUIRE(r.size() >= 2);
+      REQUIRE(r[0].item.nicename == "hello");
+      REQUIRE(r[0].registry == "internal");
+      REQUIRE(r[1].item.nicename == "helloworld");
+   }
+
+   SECTION("Names rank above descriptions")
+   {
+      auto r = index.search("chat");
+      REQUIRE(r.size() == 2);
+      REQUIRE(r[0].item.nicename == "chatops");
+      REQUIRE(r[1].item.nicename == "rocketchat");
+   }
+
+   SECTION("Typos still match")
+   {
+      auto r = index.search("minecraf");
+      REQUIRE(r.size() >= 1);
+      REQUIRE(r[0].item.nicename == "minecraft");
+
+      r = index.search("mincraft");
+      REQUIRE(r.size() >= 1);
+      REQUIRE(r[0].item.nicename == "minecraft");
+   }
+
+   SECTION("Nothing matches nonsense")
+   {
+      REQUIRE(index.search("zzqqxx").size() == 0);
+      REQUIRE(index.search("  ").size() == 0);
+   }
+}
+
+TEST_CASE("Benchmark search over a large catalogue", "[search.h][.][benchmark]") {
+   std::vector<sourcecopy::catalogueentry> entries(10);
+   for (size_t r = 0; r < entries.size(); ++r)
+   {
+      entries[r].nicename = "registry" + std::to_string(r);
+      for (int i = 0; i < 500; ++i)
+         entries[r].items.push_back(_item("service" + std::to_string(r * 1000 + i), "Does thing number " + std::to_string(i) + " for the team"));
+   }
+
+   auto t = std::chrono::steady_clock::now();
+   sourcecopy::searchindex index(entries);
+   double tbuild = elapsedms(t);
+
+   t = std::chrono::steady_clock::now();
+   size_t n = 0;
+   for (int i = 0; i < 100; ++i)
+      n += index.search("service42" + std::to_string(i % 10)).size();
+   double tsearch = elapsedms(t) / 100;
+
+   logmsg(kLINFO, "search benchmark (5000 dServices):");
+   logmsg(kLINFO, "  build index : " + std::to_string(tbuild) + " ms");
+   logmsg(kLINFO, "  per search  : " + std::to_string(tsearch) + " ms");
+   REQUIRE(n > 0);
+}
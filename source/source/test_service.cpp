@@ -0,0 +1,75 @@
+#include <fstream>
+#include <chrono>
+
+#include <Poco/File.h>
+#include <Poco/Path.h>
+#include <Poco/Process.h>
+
+#include "catch/catch.h"
+#include "service.h"
+#include "plugins.h"
+#include "drunner_paths.h"
+#include "drunner_settings.h"
+#include "globalcontext.h"
+#include "globallogger.h"
+#include "utils.h"
+#include "testutils.h"
+
+using namespace testutils;
+
+// Time to the first Lua instruction of a launch script (drunner servicecmd NAME CMD), which
+// cron jobs and health checks run over and over. Uses a throwaway service with a few settings,
+// in a scratch root so the drunners it runs see nothing else.
+TEST_CASE("Benchmark servicecmd startup", "[service.h][.][benchmark]") {
+   const std::string name = "drunner-startup-benchmark";
+   const int reps = 20;
+
+   scratchroot root("drunner_benchmark_servicecmd_root");
+   Poco::Process::Env env = root.env();
+   Poco::Path dir = drunnerPaths::getPath_dServices().pushDirectory(name);
+   Poco::File(dir).createDirectories();
+   {
+      std::ofstream lua(Poco::Path(dir).setFileName("service.lua").toString());
+      for (int i = 0; i < 10; ++i)
+         lua << "addconfig(\"SETTING" << i << "\",\"default\",\"A setting\")\n";
+      lua << "function noop()\nend\n";
+   }
+
+   // in process, as it was: settings, plugins and the service variables loaded up front.
+   // Both loops start each run with the settings read afresh, as a new process would.
+   double teager = 0;
+   for (int i = 0; i < reps; ++i)
+   {
+      auto t = std::chrono::steady_clock::now();
+      GlobalContext::reloadSettings();
+      plugins p;
+      service svc(name);
+      svc.getServiceVars();
+      REQUIRE(svc.runLuaFunction(CommandLine("noop")).success());
+      teager += elapsedms(t) / reps;
+   }
+
+   // in process, now: nothing is loaded that the command doesn't use - not even the settings,
+   // so the copy the loop above left behind isn't a saving here.
+   double tlazy = 0;
+   for (int i = 0; i < reps; ++i)
+   {
+      auto t = std::chrono::steady_clock::now();
+      service svc(name);
+      REQUIRE(svc.runLuaFunction(CommandLine("noop")).success());
+      tlazy += elapsedms(t) / reps;
+   }
+
+   // the whole launch, process start to exit.
+   std::string op;
+   CommandLine cl(drunnerPaths::getPath_Exe().toString(), { "servicecmd",name,"noop" });
+   auto t = std::chrono::steady_clock::now();
+   for (int i = 0; i < reps; ++i)
+      REQUIRE(utils::runcommand_stream(cl, kOSuppressed, "", env, &op) == 0);
+   double tprocess = elapsedms(t) / reps;
+
+   logmsg(kLINFO, "servicecmd startup benchmark (mean of " + std::to_string(reps) + "):");
+   logmsg(kLINFO, "  to first Lua instruction, loading everything : " + std::to_string(teager) + " ms");
+   logmsg(kLINFO, "  to first Lua instruction, loading on demand  : " + std::to_string(tlazy) + " ms");
+   logmsg(kLINFO, "  drunner servicecmd, process start to exit    : " + std::to_string(tprocess) + " ms");
+}
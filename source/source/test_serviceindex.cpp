@@ -0,0 +1,96 @@
+#include <fstream>
+
+#include <Poco/File.h>
+#include <Poco/Path.h>
+
+#include "catch/catch.h"
+#include "service_index.h"
+#include "service_vars.h"
+#include "service_paths.h"
+#include "persistence.h"
+#include "proxy.h"
+#include "testutils.h"
+
+using namespace testutils;
+
+static void _makeservice(std::string name, std::string imagename)
+{
+   servicePaths sp(name);
+   rmdir(sp.getPathdService());
+   rmdir(sp.getPathHostVolume());
+   Poco::File(sp.getPathdService()).createDirectories();
+   Poco::File(sp.getPathHostVolume()).createDirectories();
+   std::ofstream(sp.getPathServiceLua().toString()) << "addconfig(\"PORT\",\"80\",\"The port\")\n";
+
+   serviceVars sv(name);
+   sv.setImageName(imagename);
+   sv.savevariables();
+   REQUIRE(!persistence::flush().error());
+}
+
+static const serviceinfo * _find(const std::vector<serviceinfo> & v, std::string name)
+{
+   for (const auto & s : v)
+      if (s.servicename == name)
+         return &s;
+   return NULL;
+}
+
+TEST_CASE("Test that the service index follows the installed services", "[service_index.h]") {
+   scratchroot root("drunner_test_serviceindex_root");
+   Poco::File(serviceindex::indexPath().parent()).createDirectories();
+   _makeservice("drunner-test-index-a", "drunner/a");
+   _makeservice("drunner-test-index-b", "drunner/b");
+
+   REQUIRE(serviceindex::update("drunner-test-index-a", [](serviceinfo & e) { e.volumes = { "drunner-test-index-a-data" }; }) == kRSuccess);
+   REQUIRE(serviceindex::update("drunner-test-index-a", [](serviceinfo & e) { e.lastbackup = 1476880000; e.lastbackupsize = 1024; }) == kRSuccess);
+
+   std::vector<serviceinfo> services;
+   REQUIRE(serviceindex::getAll(services).success());
+   const serviceinfo * a = _find(services, "drunner-test-index-a");
+   REQUIRE(a != NULL);
+   REQUIRE(a->imagename == "drunner/a");
+   REQUIRE(a->volumes.size() == 1); // kept by later updates.
+   REQUIRE(a->lastbackup == 1476880000);
+   REQUIRE(a->lastbackupsize == 1024);
+
+   // b was never indexed, it's added from its service variables.
+   const serviceinfo * b = _find(services, "drunner-test-index-b");
+   REQUIRE(b != NULL);
+   REQUIRE(b->imagename == "drunner/b");
+   REQUIRE(b->lastbackup == 0);
+
+   SECTION("Domains follow the proxy configuration")
+   {
+      proxydata pd;
+      pd.mProxyData[proxydata::key("drunner-test-index-b")] = proxydatum("drunner-test-index-b", "b.example.com", "drunner-test-index-b-web", "80", "", "fake", true);
+      REQUIRE(persistence::savejson(proxy::saveFilePath(), pd).success());
+      REQUIRE(!persistence::flush().error());
+
+      REQUIRE(serviceindex::getAll(services).success());
+      b = _find(services, "drunner-test-index-b");
+      REQUIRE(b != NULL);
+      REQUIRE(b->domains.size() == 1);
+      REQUIRE(b->domains[0] == "b.example.com");
+      REQUIRE(b->containers.size() == 1);
+
+      pd.mProxyData.clear();
+      REQUIRE(persistence::savejson(proxy::saveFilePath(), pd).success());
+      REQUIRE(!persistence::flush().error());
+      REQUIRE(serviceindex::getAll(services).success());
+      REQUIRE(_find(services, "drunner-test-index-b")->domains.size() == 0);
+   }
+
+   SECTION("Removed services leave the index")
+   {
+      REQUIRE(serviceindex::remove("drunner-test-index-a") == kRSuccess);
+      REQUIRE(serviceindex::remove("drunner-test-index-a") == kRNoChange);
+
+      rmdir(servicePaths("drunner-test-index-b").getPathdService()); // gone without an uninstall.
+      REQUIRE(serviceindex::getAll(services).success());
+      REQUIRE(_find(services, "drunner-test-index-b") == NULL);
+      a = _find(services, "drunner-test-index-a");
+      REQUIRE(a != NULL); // still installed, so back it comes.
+      REQUIRE(a->volumes.size() == 0);
+   }
+}
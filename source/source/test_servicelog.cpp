@@ -0,0 +1,135 @@
+#include <chrono>
+
+#include "catch/catch.h"
+#include "service_log.h"
+#include "globallogger.h"
+#include "testutils.h"
+
+using namespace testutils;
+
+// the lines written to the sink, headers removed.
+static std::vector<std::string> _lines(const std::string & out)
+{
+   std::vector<std::string> lines;
+   size_t start = 0, nl, h = getheader(kLINFO).length();
+   while ((nl = out.find('\n', start)) != std::string::npos)
+   {
+      lines.push_back(out.substr(start + h, nl - start - h));
+      start = nl + 1;
+   }
+   return lines;
+}
+
+TEST_CASE("Test that the service log strips escapes and emits whole lines", "[service_log.h]") {
+   std::string out;
+   int calls = 0;
+   servicelogger log(kLINFO, [&](const std::string & s) { out += s; ++calls; });
+
+   SECTION("Escapes are stripped, one header per line")
+   {
+      std::string s = "\033[1;32mgreen\033[0m text\nsecond \033[4mline\033[0m\n";
+      log.write(s.data(), s.length());
+      REQUIRE(calls == 1);
+      auto lines = _lines(out);
+      REQUIRE(lines.size() == 2);
+      REQUIRE(lines[0] == "green text");
+      REQUIRE(lines[1] == "second line");
+   }
+
+   SECTION("Escapes and lines split across writes")
+   {
+      std::string s = "par\033[3";
+      log.write(s.data(), s.length());
+      REQUIRE(calls == 0);
+      s = "1mtial\nnext\033";
+      log.write(s.data(), s.length());
+      s = "[0m done";
+      log.write(s.data(), s.length());
+      log.flush();
+      auto lines = _lines(out);
+      REQUIRE(lines.size() == 2);
+      REQUIRE(lines[0] == "partial");
+      REQUIRE(lines[1] == "next done");
+   }
+
+   SECTION("A prompt is shown at once and its line finished without another header")
+   {
+      std::string s = "Password: ";
+      log.write(s.data(), s.length());
+      log.flushpartial();
+      REQUIRE(calls == 1);
+      REQUIRE(out == getheader(kLINFO) + "Password: ");
+      s = "ok\nnext\n";
+      log.write(s.data(), s.length());
+      auto lines = _lines(out);
+      REQUIRE(lines.size() == 2);
+      REQUIRE(lines[0] == "Password: ok");
+      REQUIRE(lines[1] == "next");
+   }
+
+   SECTION("A lone escape is dropped but what follows is kept")
+   {
+      std::string s = "a\033b\n";
+      log.write(s.data(), s.length());
+      REQUIRE(_lines(out)[0] == "ab");
+   }
+
+   SECTION("Block and character filters agree")
+   {
+      std::string s = "x\033[31my\033z\033[\033[0mw\n";
+      escapefilter a, b;
+      std::string block, chars;
+      a.filter(s.data(), s.length(), block);
+      for (char c : s)
+         if (b.valid(c))
+            chars += c;
+      REQUIRE(block == chars);
+   }
+}
+
+TEST_CASE("Benchmark service log throughput", "[service_log.h][.][benchmark]") {
+   std::string chunk;
+   for (int i = 0; i < 1000; ++i)
+      chunk += "\033[32m[INFO]\033[0m request " + std::to_string(i) + " served in 12ms from the cache\n";
+   const int reps = 16; // ~1 MB in all.
+   size_t total = chunk.length() * reps;
+
+   // the old pipeline: filter and log one character at a time.
+   size_t bytes = 0;
+   servicelogger::sink oldsink = [&](const std::string & s) { bytes += s.length(); };
+   auto t = std::chrono::steady_clock::now();
+   for (int r = 0; r < reps; ++r)
+   {
+      escapefilter ef;
+      char buf[2] = { 'x',0 };
+      bool initialised = false;
+      for (char c : chunk)
+         if (ef.valid(c))
+         {
+            if (!initialised)
+               oldsink(getheader(kLINFO));
+            initialised = true;
+            buf[0] = c;
+            oldsink(buf);
+            if (c == '\n')
+               initialised = false;
+         }
+   }
+   double told = elapsedms(t);
+
+   size_t newbytes = 0;
+   t = std::chrono::steady_clock::now();
+   {
+      servicelogger log(kLINFO, [&](const std::string & s) { newbytes += s.length(); });
+      for (int r = 0; r < reps; ++r)
+         for (size_t i = 0; i < chunk.length(); i += 65536)
+            log.write(chunk.data() + i, std::min<size_t>(65536, chunk.length() - i));
+   }
+   double tnew = elapsedms(t);
+
+   REQUIRE(newbytes > 0);
+   double mb = total / 1048576.0;
+   logmsg(kLINFO, "service log benchmark (" + std::to_string(total / 1024) + " KB of output):");
+   logmsg(kLINFO, "  per character (old): " + std::to_string(told) + " ms, " + std::to_string(mb * 1000 / told) + " MB/s");
+   logmsg(kLINFO, "  block filter (new) : " + std::to_string(tnew) + " ms, " + std::to_string(mb * 1000 / tnew) + " MB/s");
+}
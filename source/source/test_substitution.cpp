@@ -0,0 +1,128 @@
+#include <chrono>
+#include <string>
+
+#include <Poco/String.h>
+
+#include "catch/catch.h"
+#include "substitution.h"
+#include "variables.h"
+#include "globallogger.h"
+#include "testutils.h"
+
+using namespace testutils;
+
+TEST_CASE("Test that variable substitution works", "[substitution.h]") {
+
+   keyVals kv;
+   kv.setVal("FOO", "foo");
+   kv.setVal("FOOBAR", "foobar");
+   kv.setVal("NAME", "drunner");
+   kv.setVal("EMPTY", "");
+
+   SECTION("Simple tokens")
+   {
+      REQUIRE(kv.substitute("$NAME") == "drunner");
+      REQUIRE(kv.substitute("${NAME}") == "drunner");
+      REQUIRE(kv.substitute("a $NAME b ${NAME} c") == "a drunner b drunner c");
+      REQUIRE(kv.substitute("$NAME-data") == "drunner-data");
+      REQUIRE(kv.substitute("no tokens here") == "no tokens here");
+      REQUIRE(kv.substitute("x${EMPTY}y") == "xy");
+   }
+
+   SECTION("Longest match")
+   {
+      REQUIRE(kv.substitute("$FOOBAR") == "foobar");
+      REQUIRE(kv.substitute("$FOO") == "foo");
+      REQUIRE(kv.substitute("$FOOBA") == "fooBA");
+      REQUIRE(kv.substitute("${FOO}BAR") == "fooBAR");
+   }
+
+   SECTION("Undefined and malformed tokens are left alone")
+   {
+      REQUIRE(kv.substitute("$UNDEFINED") == "$UNDEFINED");
+      REQUIRE(kv.substitute("${UNDEFINED}") == "${UNDEFINED}");
+      REQUIRE(kv.substitute("${FOOBA}") == "${FOOBA}");
+      REQUIRE(kv.substitute("cost: $5 $") == "cost: $5 $");
+      REQUIRE(kv.substitute("${NAME") == "${NAME");
+      REQUIRE(kv.substitute("${}") == "${}");
+      REQUIRE(kv.substitute("$$NAME") == "$drunner");
+   }
+
+   SECTION("Tokens inside something that isn't a braced name are still substituted")
+   {
+      REQUIRE(kv.substitute("${HOME:-$FOO}") == "${HOME:-foo}");
+      REQUIRE(kv.substitute("echo ${ $NAME } ${NAME}") == "echo ${ drunner } drunner");
+      REQUIRE(kv.substitute("${NAME $NAME}") == "${NAME drunner}");
+   }
+
+   SECTION("Values are not rescanned and lookups are case sensitive")
+   {
+      keyVals kv2;
+      kv2.setVal("A", "$B");
+      kv2.setVal("B", "b");
+      REQUIRE(kv2.substitute("$A $B") == "$B b");
+      REQUIRE(kv2.substitute("$a") == "$a");
+   }
+
+   SECTION("Unbraced names may contain - and .")
+   {
+      keyVals kv3;
+      kv3.setVal("my-key", "v1");
+      kv3.setVal("a.b", "v2");
+      kv3.setVal("NAME", "drunner");
+      REQUIRE(kv3.substitute("$my-key $a.b") == "v1 v2");
+      REQUIRE(kv3.substitute("Hello $NAME.") == "Hello drunner.");
+      REQUIRE(kv3.substitute("$a.c") == "$a.c");
+   }
+
+   SECTION("Compiled templates are cached")
+   {
+      std::string t = "cached $NAME template";
+      REQUIRE(substitution::compile(t).get() == substitution::compile(t).get());
+      REQUIRE(substitution::compile(t)->hasTokens());
+      REQUIRE(!substitution::compile("plain")->hasTokens());
+   }
+}
+
+// -----------------------------------------------------------------------------------------------
+
+TEST_CASE("Benchmark substitution of a large help text", "[substitution.h][.][benchmark]") {
+   const int nvars = 1000;
+   const int nlines = 5000;
+   const int reps = 10;
+
+   keyVals kv;
+   for (int i = 0; i < nvars; ++i)
+      kv.setVal("VARIABLE_" + std::to_string(i), "value" + std::to_string(i));
+
+   std::string help;
+   for (int i = 0; i < nlines; ++i)
+      help += "   " + std::to_string(i) + " - run ${VARIABLE_" + std::to_string(i % nvars) +
+         "} with $VARIABLE_" + std::to_string((i * 7) % nvars) + " and some ordinary text.\n";
+
+   // the old approach: two replace passes over the whole string per variable.
+   auto t = std::chrono::steady_clock::now();
+   std::string old;
+   for (int r = 0; r < reps; ++r)
+   {
+      old = help;
+      for (const auto & x : kv.getAll())
+      {
+         Poco::replaceInPlace(old, "$" + x.first, x.second);
+         Poco::replaceInPlace(old, "${" + x.first + "}", x.second);
+      }
+   }
+   double told = elapsedms(t) / reps;
+
+   t = std::chrono::steady_clock::now();
+   std::string sub;
+   for (int r = 0; r < reps; ++r)
+      sub = kv.substitute(help);
+   double tnew = elapsedms(t) / reps;
+
+   REQUIRE(sub.find("$VARIABLE") == std::string::npos);
+
+   logmsg(kLINFO, "substitute benchmark (" + std::to_string(help.length()) + " bytes, " + std::to_string(nvars) + " variables):");
+   logmsg(kLINFO, "  replace per variable (old): " + std::to_string(told) + " ms");
+   logmsg(kLINFO, "  single pass, cached       : " + std::to_string(tnew) + " ms");
+}
@@ -0,0 +1,158 @@
+#include <chrono>
+#include <fstream>
+
+#include <Poco/File.h>
+#include <Poco/Path.h>
+#include <Poco/Thread.h>
+#include <Poco/DirectoryIterator.h>
+
+#include "catch/catch.h"
+#include "treedelete.h"
+#include "drunner_paths.h"
+#include "globallogger.h"
+#include "utils.h"
+#include "testutils.h"
+
+using namespace testutils;
+
+// width subdirectories of files files each, depth levels down.
+static size_t _maketree(Poco::Path dir, int depth, int width, int files)
+{
+   Poco::File(dir).createDirectories();
+   size_t n = 0;
+   for (int i = 0; i < files; ++i, ++n)
+      std::ofstream(Poco::Path(dir).setFileName("f" + std::to_string(i)).toString()) << i;
+   if (depth > 0)
+      for (int i = 0; i < width; ++i)
+         n += _maketree(Poco::Path(dir).pushDirectory("d" + std::to_string(i)), depth - 1, width, files);
+   return n;
+}
+
+TEST_CASE("Test that treedelete removes whole trees", "[treedelete.h]") {
+   scratchroot root("drunner_test_treedelete_root"); // for the trash.
+   Poco::Path dir = freshdir("drunner_test_treedelete");
+   Poco::Path tree = Poco::Path(dir).pushDirectory("tree");
+   _maketree(tree, 3, 4, 5);
+
+   SECTION("Synchronously")
+   {
+#ifndef _WIN32
+      // read-only files and directories, and links to things that must survive.
+      Poco::Path keep = Poco::Path(dir).pushDirectory("keep");
+      _maketree(keep, 0, 0, 2);
+      REQUIRE(0 == symlink(keep.toString().c_str(), (tree.toString() + "d1/linktodir").c_str()));
+      REQUIRE(0 == symlink(Poco::Path(keep).setFileName("f0").toString().c_str(), (tree.toString() + "linktofile").c_str()));
+      REQUIRE(0 == chmod((tree.toString() + "d2/d0/f1").c_str(), 0400));
+      REQUIRE(0 == chmod((tree.toString() + "d2/d0").c_str(), 0500));
+      REQUIRE(0 == chmod((tree.toString() + "d3").c_str(), 0));
+#endif
+      REQUIRE(treedelete::remove(tree) == kRSuccess);
+      REQUIRE(!Poco::File(tree).exists());
+      REQUIRE(treedelete::remove(tree) == kRNoChange);
+#ifndef _WIN32
+      REQUIRE(Poco::File(Poco::Path(keep).setFileName("f1")).exists());
+#endif
+   }
+
+   SECTION("Through utils::deltree")
+   {
+      REQUIRE(utils::deltree(tree) == kRSuccess);
+      REQUIRE(!Poco::File(tree).exists());
+   }
+
+   SECTION("In the background")
+   {
+      REQUIRE(treedelete::removeasync(tree) == kRSuccess);
+      REQUIRE(!Poco::File(tree).exists()); // gone at once.
+
+      bool empty = false;
+      for (int i = 0; i < 100 && !empty; ++i)
+      {
+         empty = (treedelete::trashcount() == 0);
+         if (!empty)
+            Poco::Thread::sleep(50);
+      }
+      REQUIRE(empty);
+   }
+
+   SECTION("Several trees in the background, by one process")
+   {
+      Poco::Path other = Poco::Path(dir).pushDirectory("other");
+      _maketree(other, 2, 3, 4);
+      REQUIRE(treedelete::removeasync(std::vector<Poco::Path>{ tree, other, Poco::Path(dir).pushDirectory("missing") }) == kRSuccess);
+      REQUIRE(!Poco::File(tree).exists());
+      REQUIRE(!Poco::File(other).exists());
+
+      bool empty = false;
+      for (int i = 0; i < 100 && !empty; ++i)
+      {
+         empty = (treedelete::trashcount() == 0);
+         if (!empty)
+            Poco::Thread::sleep(50);
+      }
+      REQUIRE(empty);
+   }
+
+   Poco::File(dir).remove(true);
+}
+
+// -----------------------------------------------------------------------------------------------
+
+// the old utils::deltree: a Poco::Path, setWriteable, remove and a log line per entry.
+static void _olddeltree(Poco::Path s)
+{
+   Poco::DirectoryIterator end;
+   for (Poco::DirectoryIterator it(s); it != end; ++it)
+      if (it->isFile())
+      {
+         Poco::File f(it->path());
+         f.setWriteable(true);
+         f.remove();
+         drunner_log(kLDEBUG, "Deleted {}", it->path());
+      }
+      else
+      {
+         Poco::Path subdir(it->path());
+         subdir.makeDirectory();
+         _olddeltree(subdir);
+      }
+   Poco::File f(s);
+   f.setWriteable(true);
+   f.remove();
+   drunner_log(kLDEBUG, "Deleted {}", f.path());
+}
+
+// A host volume's worth of small files, as obliterate sees them.
+TEST_CASE("Benchmark deleting a large tree", "[treedelete.h][.][benchmark]") {
+   scratchroot root("drunner_benchmark_treedelete_root");
+   Poco::Path dir = freshdir("drunner_benchmark_treedelete");
+   Poco::Path tree = Poco::Path(dir).pushDirectory("tree");
+
+   auto t = std::chrono::steady_clock::now();
+   size_t files = _maketree(tree, 3, 10, 50);
+   logmsg(kLINFO, "treedelete benchmark (" + std::to_string(files) + " files, built in " + std::to_string(elapsedms(t) / 1000) + " s):");
+
+   t = std::chrono::steady_clock::now();
+   _olddeltree(tree);
+   double told = elapsedms(t);
+
+   _maketree(tree, 3, 10, 50);
+   t = std::chrono::steady_clock::now();
+   REQUIRE(treedelete::remove(tree) == kRSuccess);
+   double tnew = elapsedms(t);
+
+   _maketree(tree, 3, 10, 50);
+   t = std::chrono::steady_clock::now();
+   REQUIRE(treedelete::removeasync(tree) == kRSuccess);
+   double tasync = elapsedms(t);
+   for (int i = 0; i < 600 && treedelete::trashcount() > 0; ++i)
+      Poco::Thread::sleep(50); // before the scratch root goes.
+   double tbackground = elapsedms(t);
+
+   logmsg(kLINFO, "  Poco, one entry at a time (old): " + std::to_string(told) + " ms");
+   logmsg(kLINFO, "  unlinkat, thread pool         : " + std::to_string(tnew) + " ms");
+   logmsg(kLINFO, "  moved to the trash (returns)  : " + std::to_string(tasync) + " ms");
+   logmsg(kLINFO, "  ...and deleted from it after  : " + std::to_string(tbackground) + " ms");
+
+   Poco::File(dir).remove(true);
+}
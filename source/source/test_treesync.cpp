@@ -0,0 +1,139 @@
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include <Poco/File.h>
+#include <Poco/Path.h>
+
+#include "catch/catch.h"
+#include "treesync.h"
+#include "utils.h"
+#include "testutils.h"
+
+using namespace testutils;
+
+static void _write(std::string path, std::string contents)
+{
+   std::ofstream os(path);
+   os << contents;
+}
+
+static bool _has(const std::vector<std::string> & v, std::string s)
+{
+   return std::find(v.begin(), v.end(), s) != v.end();
+}
+
+TEST_CASE("Test that treesync only touches what changed", "[treesync.h]") {
+   Poco::Path root(Poco::Path::temp());
+   root.pushDirectory("drunner_test_treesync");
+   if (Poco::File(root).exists())
+      Poco::File(root).remove(true);
+
+   std::string src = root.toString() + "src/", dest = root.toString() + "dest/";
+   Poco::File(src + "sub/deeper").createDirectories();
+   Poco::File(src + ".git").createDirectories();
+   _write(src + "service.lua", "lua");
+   _write(src + "sub/a.txt", "a");
+   _write(src + "sub/deeper/b.txt", "b");
+   _write(src + ".git/HEAD", "ref");
+
+   treesync::summary s1;
+   REQUIRE(treesync::sync(src, dest, s1) == kRSuccess);
+   REQUIRE(s1.added.size() == 5); // sub/, sub/deeper/ and three files.
+   REQUIRE(read(dest + "sub/deeper/b.txt") == "b");
+   REQUIRE(!utils::fileexists(Poco::Path(dest + ".git/")));
+
+   SECTION("A second sync is a no-op")
+   {
+      treesync::summary s;
+      REQUIRE(treesync::sync(src, dest, s) == kRNoChange);
+      REQUIRE(!s.changed());
+      REQUIRE(s.unchanged == 3);
+   }
+
+   SECTION("Changed, added and removed files are synced")
+   {
+      _write(src + "sub/a.txt", "changed");
+      _write(src + "new.txt", "new");
+      Poco::File(src + "sub/deeper/b.txt").remove();
+      _write(dest + "stale.txt", "stale");
+
+      treesync::summary s;
+      REQUIRE(treesync::sync(src, dest, s) == kRSuccess);
+      REQUIRE(_has(s.modified, "sub/a.txt"));
+      REQUIRE(_has(s.added, "new.txt"));
+      REQUIRE(_has(s.removed, "sub/deeper/b.txt"));
+      REQUIRE(_has(s.removed, "stale.txt"));
+      REQUIRE(read(dest + "sub/a.txt") == "changed");
+      REQUIRE(read(dest + "new.txt") == "new");
+      REQUIRE(!utils::fileexists(Poco::Path(dest + "stale.txt")));
+      REQUIRE(!utils::fileexists(Poco::Path(dest + "sub/deeper/b.txt")));
+   }
+
+   SECTION("A file replaced by a directory is handled")
+   {
+      Poco::File(src + "sub/a.txt").remove();
+      Poco::File(src + "sub/a.txt").createDirectories();
+      _write(src + "sub/a.txt/c.txt", "c");
+
+      treesync::summary s;
+      REQUIRE(treesync::sync(src, dest, s) == kRSuccess);
+      REQUIRE(_has(s.removed, "sub/a.txt"));
+      REQUIRE(read(dest + "sub/a.txt/c.txt") == "c");
+   }
+
+   SECTION("Identical files with a new timestamp aren't copied")
+   {
+      Poco::File(src + "service.lua").remove();
+      _write(src + "service.lua", "lua");
+      Poco::File(src + "service.lua").setLastModified(Poco::Timestamp::fromEpochTime(1000000000));
+
+      treesync::summary s;
+      REQUIRE(treesync::sync(src, dest, s) == kRNoChange);
+      REQUIRE(s.unchanged == 3);
+   }
+
+#ifndef _WIN32
+   SECTION("Symbolic links are kept as links, not followed")
+   {
+      Poco::File(root.toString() + "outside").createDirectories();
+      _write(root.toString() + "outside/big.txt", "outside");
+      REQUIRE(0 == symlink((root.toString() + "outside").c_str(), (src + "linkdir").c_str()));
+      REQUIRE(0 == symlink("nowhere", (src + "dangling").c_str()));
+
+      treesync::summary s;
+      REQUIRE(treesync::sync(src, dest, s) == kRSuccess);
+      REQUIRE(_has(s.added, "linkdir"));
+      REQUIRE(_has(s.added, "dangling"));
+      REQUIRE(Poco::File(dest + "linkdir").isLink());
+      REQUIRE(Poco::File(dest + "dangling").isLink());
+      treesync::summary again;
+      REQUIRE(treesync::sync(src, dest, again) == kRNoChange);
+
+      // retargeted, and then gone: the link goes, what it pointed to stays.
+      Poco::File(src + "dangling").remove();
+      REQUIRE(0 == symlink("elsewhere", (src + "dangling").c_str()));
+      Poco::File(src + "linkdir").remove();
+      treesync::summary s2;
+      REQUIRE(treesync::sync(src, dest, s2) == kRSuccess);
+      REQUIRE(_has(s2.removed, "linkdir"));
+      REQUIRE(_has(s2.added, "dangling"));
+      REQUIRE(!Poco::File(dest + "linkdir").exists());
+      REQUIRE(read(root.toString() + "outside/big.txt") == "outside");
+      char target[64] = {};
+      REQUIRE(readlink((dest + "dangling").c_str(), target, sizeof(target) - 1) > 0);
+      REQUIRE(std::string(target) == "elsewhere");
+   }
+#endif
+
+   SECTION("Synced trees hash the same")
+   {
+      std::string h = treesync::treehash(src);
+      REQUIRE(h.length() > 0);
+      REQUIRE(h == treesync::treehash(dest));
+      _write(dest + "sub/a.txt", "b");
+      REQUIRE(h != treesync::treehash(dest));
+   }
+
+   Poco::File(root).remove(true);
+}
@@ -68,6 +68,15 @@ TEST_CASE("Test that utils helper functions work", "[utils.h]") {
          REQUIRE(vs[i] == vs2[i]);
    }
 
+#ifndef _WIN32
+   SECTION("Test runcommand_input feeds stdin")
+   {
+      std::string input = "line one\nline two\n", out;
+      REQUIRE(utils::runcommand_input(CommandLine("cat", {}), input, out) == 0);
+      REQUIRE(out == input);
+   }
+#endif
+
    //SECTION("Test false functions")
    //{
    //}
@@ -0,0 +1,122 @@
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <Poco/String.h>
+
+#include "catch/catch.h"
+#include "variables.h"
+#include "globallogger.h"
+#include "testutils.h"
+
+using namespace testutils;
+
+TEST_CASE("Test that keyVals and persistvariables work", "[variables.h]") {
+
+   SECTION("Case insensitive lookups")
+   {
+      keyVals kv;
+      kv.setVal("Fish", "trout");
+      REQUIRE(kv.hasKey("fish"));
+      REQUIRE(kv.hasKey("FISH"));
+      REQUIRE(kv.getVal("fIsH") == "trout");
+      REQUIRE(!kv.hasKey("fis"));
+      REQUIRE(kv.getVal("nothere") == "");
+
+      // setting a differently cased key updates the existing one and keeps its casing.
+      kv.setVal("FISH", "salmon");
+      REQUIRE(kv.getAll().size() == 1);
+      REQUIRE(kv.getAll().begin()->first == "Fish");
+      REQUIRE(kv.getVal("fish") == "salmon");
+
+      kv.delKey("fISH");
+      REQUIRE(!kv.hasKey("fish"));
+      REQUIRE(kv.getAll().size() == 0);
+   }
+
+   SECTION("Merging keeps the index consistent")
+   {
+      keyVals a, b;
+      a.setVal("ONE", "1");
+      a.setVal("Two", "2");
+      b.setVal("two", "II");
+      b.setVal("three", "3");
+      keyVals c(a, b);
+      REQUIRE(c.getAll().size() == 3);
+      REQUIRE(c.getVal("two") == "II");
+      REQUIRE(c.getVal("THREE") == "3");
+      REQUIRE(c.getVal("one") == "1");
+   }
+
+   SECTION("Definitions are found by reference")
+   {
+      std::vector<envDef> defs = {
+         envDef("ALPHA", "a", "First", ENV_PERSISTS | ENV_USERSETTABLE),
+         envDef("Beta", "b", "Second", ENV_PERSISTS)
+      };
+      persistvariables pv("test", Poco::Path("test.json"), defs);
+
+      REQUIRE(pv.getVal("alpha") == "a");
+      REQUIRE(pv.getDef("beta") != NULL);
+      REQUIRE(pv.getDef("beta")->name == "Beta");
+      REQUIRE(pv.getDef("BETA") == pv.getDef("beta"));
+      REQUIRE(pv.getDef("gamma") == NULL);
+
+      REQUIRE(pv.setVal("alpha", "x").success());
+      REQUIRE(pv.getAll().find("ALPHA")->second == "x");
+      REQUIRE(pv.setVal("gamma", "x").error());
+   }
+}
+
+// -----------------------------------------------------------------------------------------------
+
+TEST_CASE("Benchmark variable lookups with 10k variables", "[variables.h][.][benchmark]") {
+   const int n = 10000;
+
+   std::vector<envDef> defs;
+   for (int i = 0; i < n; ++i)
+      defs.push_back(envDef("VARIABLE_" + std::to_string(i), std::to_string(i), "Benchmark variable", ENV_PERSISTS | ENV_USERSETTABLE));
+
+   auto t = std::chrono::steady_clock::now();
+   persistvariables pv("bench", Poco::Path("bench.json"), defs);
+   double tcreate = elapsedms(t);
+
+   // what _showconfiginfo and savevariables do: one definition lookup per variable.
+   t = std::chrono::steady_clock::now();
+   int found = 0;
+   for (const auto & x : pv.getAll())
+      if (const envDef * def = pv.getDef(x.first))
+         found += def->persists ? 1 : 0;
+   double tgetdef = elapsedms(t);
+   REQUIRE(found == n);
+
+   t = std::chrono::steady_clock::now();
+   for (int i = 0; i < n; ++i)
+      REQUIRE(pv.getVal("variable_" + std::to_string(i)) == std::to_string(i));
+   double tgetval = elapsedms(t);
+
+   t = std::chrono::steady_clock::now();
+   for (int i = 0; i < n; ++i)
+      pv.setVal("Variable_" + std::to_string(i), "x");
+   double tsetval = elapsedms(t);
+
+   // the old linear, case insensitive scan for comparison.
+   t = std::chrono::steady_clock::now();
+   found = 0;
+   for (const auto & x : pv.getAll())
+      for (const auto & d : defs)
+         if (0 == Poco::icompare(d.name, x.first))
+         {
+            ++found;
+            break;
+         }
+   double tlinear = elapsedms(t);
+   REQUIRE(found == n);
+
+   logmsg(kLINFO, "keyVals benchmark (" + std::to_string(n) + " variables):");
+   logmsg(kLINFO, "  construct with defaults : " + std::to_string(tcreate) + " ms");
+   logmsg(kLINFO, "  getDef for all          : " + std::to_string(tgetdef) + " ms");
+   logmsg(kLINFO, "  getVal for all          : " + std::to_string(tgetval) + " ms");
+   logmsg(kLINFO, "  setVal for all          : " + std::to_string(tsetval) + " ms");
+   logmsg(kLINFO, "  linear scan (old getDef): " + std::to_string(tlinear) + " ms");
+}
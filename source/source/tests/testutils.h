@@ -0,0 +1,95 @@
+#ifndef __TESTUTILS_H
+#define __TESTUTILS_H
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <Poco/File.h>
+#include <Poco/Path.h>
+#include <Poco/Process.h>
+
+#include "utils.h"
+#include "drunner_paths.h"
+#include "globallogger.h"
+#include "persistence.h"
+
+// Helpers shared by the unit tests (test_*.cpp).
+namespace testutils
+{
+   // milliseconds since start, for the benchmarks.
+   inline double elapsedms(std::chrono::steady_clock::time_point start)
+   {
+      return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+   }
+
+   // runs script with bash in dir, returning its exit code.
+   inline int sh(const std::string & dir, const std::string & script)
+   {
+      CommandLine cl("bash", { "-c", "cd '" + dir + "' && " + script });
+      std::string out;
+      return utils::runcommand(cl, out);
+   }
+
+   // the whole of the file at p, empty if it can't be read.
+   inline std::string read(const Poco::Path & p)
+   {
+      std::ifstream is(p.toString(), std::ios_base::binary);
+      std::ostringstream oss;
+      oss << is.rdbuf();
+      return oss.str();
+   }
+
+   // deletes p and everything under it, if it's there.
+   inline void rmdir(const Poco::Path & p)
+   {
+      if (Poco::File(p).exists())
+         Poco::File(p).remove(true);
+   }
+
+   // an empty directory called name in the temp directory.
+   inline Poco::Path freshdir(const std::string & name)
+   {
+      Poco::Path dir(Poco::Path::temp());
+      dir.pushDirectory(name);
+      rmdir(dir);
+      Poco::File(dir).createDirectories();
+      return dir;
+   }
+
+   // For its lifetime drunner's root is an empty directory in temp, so a test doesn't read or
+   // change the real settings, services, caches, logs or trash. Pass env() to drunners it runs.
+   class scratchroot
+   {
+   public:
+      scratchroot(const std::string & name) : mRoot(freshdir(name))
+      {
+         persistence::flush();
+         logflush();
+         drunnerPaths::setRoot(mRoot);
+         Poco::File(drunnerPaths::getPath_Logs()).createDirectories();
+         Poco::File(drunnerPaths::getPath_Settings()).createDirectories();
+         Poco::File(drunnerPaths::getPath_Temp()).createDirectories();
+      }
+
+      ~scratchroot()
+      {
+         persistence::flush();
+         logflush();
+         drunnerPaths::setRoot(Poco::Path());
+         rmdir(mRoot);
+      }
+
+      const Poco::Path & path() const { return mRoot; }
+      Poco::Process::Env env() const { return { { "DRUNNER_ROOT", mRoot.toString() } }; }
+
+   private:
+      scratchroot(const scratchroot &);
+      scratchroot & operator=(const scratchroot &);
+
+      Poco::Path mRoot;
+   };
+}
+
+#endif
@@ -1,11 +1,13 @@
 #define CATCH_CONFIG_RUNNER
 #include "catch/catch.h"
+#include "unittests.h"
 
-int UnitTest()
+int UnitTest(const std::vector<std::string> & args)
 {
-   int argc=0;
-   const char *argv[1];
-   argv[0]="drunner";
-   int result = Catch::Session().run( argc,argv);
+   std::vector<const char *> argv;
+   argv.push_back("drunner");
+   for (const auto & a : args)
+      argv.push_back(a.c_str());
+   int result = Catch::Session().run( (int)argv.size(), &argv[0] );
    return result;
 }
@@ -1,9 +1,11 @@
 #ifndef __UNITTESTS_H
 #define __UNITTESTS_H
 
+#include <string>
+#include <vector>
 
-int UnitTest();
+// args are passed through to Catch, e.g. "[benchmark]" runs the (hidden) benchmarks.
+int UnitTest(const std::vector<std::string> & args);
 
 
 #endif
-
@@ -38,7 +38,7 @@ std::string timez::getelpased()
 
 namespace timeutils
 {
-   static const std::string jformat = "%Y_%m_%d__%H_%M_%S";
+   static const char * const jformat = "%Y_%m_%d__%H_%M_%S"; // no destructor, the logger rotates during exit.
 
    std::string getDateTimeStr()
    {
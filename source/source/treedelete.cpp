@@ -0,0 +1,468 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include <Poco/File.h>
+#include <Poco/DirectoryIterator.h>
+
+#include "treedelete.h"
+#include "drunner_paths.h"
+#include "globallogger.h"
+#include "persistence.h"
+
+namespace treedelete
+{
+   size_t trashcount()
+   {
+      std::vector<std::string> names;
+      try
+      {
+         Poco::File trash(drunnerPaths::getPath_Temp().pushDirectory("trash"));
+         if (trash.exists())
+            trash.list(names);
+      }
+      catch (const Poco::Exception &) {}
+      return names.size();
+   }
+
+#ifdef _WIN32
+   static cResult _remove(const Poco::Path & path)
+   {
+      try
+      {
+         Poco::DirectoryIterator end;
+         for (Poco::DirectoryIterator it(path); it != end; ++it)
+         {
+            Poco::File f(it->path());
+            if (it->isDirectory() && !it->isLink())
+            {
+               cResult r = _remove(Poco::Path(it->path()).makeDirectory());
+               if (r.error())
+                  return r;
+            }
+            else
+            {
+               f.setWriteable(true);
+               f.remove();
+            }
+         }
+         Poco::File(path).remove();
+      }
+      catch (const Poco::Exception & e)
+      {
+         return cError("Couldn't delete " + path.toString() + " - " + e.displayText());
+      }
+      return kRSuccess;
+   }
+
+   cResult remove(Poco::Path path)
+   {
+      persistence::discard(path);
+      if (!Poco::File(path).exists())
+         return kRNoChange;
+      return _remove(path);
+   }
+
+   cResult removeasync(Poco::Path path)
+   {
+      return remove(path);
+   }
+
+   cResult removeasync(const std::vector<Poco::Path> & paths)
+   {
+      cResult rval = kRNoChange;
+      for (const auto & path : paths)
+         rval += remove(path);
+      return rval;
+   }
+
+#else
+
+   // calls f(name, d_type) for each entry but . and .., which f may unlink as it goes.
+   template <class F> static bool _foreach(int fd, F f)
+   {
+#if defined(__linux__) && defined(SYS_getdents64)
+      struct linuxdirent
+      {
+         uint64_t d_ino;
+         int64_t d_off;
+         unsigned short d_reclen;
+         unsigned char d_type;
+         char d_name[1];
+      };
+      thread_local std::vector<char> buf(64 * 1024);
+      while (true)
+      {
+         long n = syscall(SYS_getdents64, fd, buf.data(), buf.size());
+         if (n < 0)
+            return false;
+         if (n == 0)
+            return true;
+         for (long pos = 0; pos < n;)
+         {
+            const linuxdirent * d = (const linuxdirent *)(buf.data() + pos);
+            pos += d->d_reclen;
+            if (d->d_name[0] == '.' && (d->d_name[1] == 0 || (d->d_name[1] == '.' && d->d_name[2] == 0)))
+               continue;
+            f(d->d_name, d->d_type);
+         }
+      }
+#else
+      int dfd = ::dup(fd);
+      DIR * dir = (dfd < 0) ? NULL : ::fdopendir(dfd);
+      if (dir == NULL)
+      {
+         if (dfd >= 0)
+            ::close(dfd);
+         return false;
+      }
+      struct dirent * d;
+      while ((d = ::readdir(dir)) != NULL)
+      {
+         if (d->d_name[0] == '.' && (d->d_name[1] == 0 || (d->d_name[1] == '.' && d->d_name[2] == 0)))
+            continue;
+         f(d->d_name, d->d_type);
+      }
+      ::closedir(dir);
+      return true;
+#endif
+   }
+
+   struct dirnode
+   {
+      dirnode(const std::string & p, dirnode * par) : path(p), parent(par), pending(1) {}
+
+      std::string path;
+      dirnode * parent;
+      std::atomic<size_t> pending; // subdirectories still to go, plus one until it has been read.
+   };
+
+   static std::string _parentof(const std::string & path)
+   {
+      size_t slash = path.rfind('/');
+      return (slash == std::string::npos) ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+   }
+
+   static bool _lacksPermission(int err)
+   {
+      return err == EACCES || err == EPERM;
+   }
+
+   // deletes one tree, the calling thread working alongside the pool.
+   class remover
+   {
+   public:
+      remover() : mActive(0), mFiles(0), mDirs(0), mErrors(0)
+      {
+         mMaxThreads = std::thread::hardware_concurrency();
+         if (mMaxThreads > 8) mMaxThreads = 8;
+         if (mMaxThreads < 1) mMaxThreads = 1;
+      }
+
+      cResult run(const std::string & root)
+      {
+         mQueue.push_back(new dirnode(root, NULL));
+         mActive = 1;
+         _worker();
+         for (auto & t : mThreads)
+            t.join();
+
+         drunner_log(kLDEBUG, "Deleted {} ({} files, {} directories, {} threads)", root, mFiles.load(), mDirs.load(), mThreads.size() + 1);
+         if (mErrors == 0)
+            return kRSuccess;
+         return cError("Couldn't delete " + root + " - " + mError + (mErrors > 1 ? " (and " + std::to_string(mErrors - 1) + " more)" : ""));
+      }
+
+   private:
+      void _worker()
+      {
+         std::unique_lock<std::mutex> lock(mMutex);
+         while (true)
+         {
+            mWake.wait(lock, [this]() { return !mQueue.empty() || mActive == 0; });
+            if (mQueue.empty())
+               return; // all done.
+
+            dirnode * d = mQueue.front();
+            mQueue.pop_front();
+            lock.unlock();
+            _empty(d);
+            _done(d);
+            lock.lock();
+            if (--mActive == 0)
+               mWake.notify_all();
+         }
+      }
+
+      void _push(dirnode * d)
+      {
+         std::lock_guard<std::mutex> lock(mMutex);
+         mQueue.push_back(d);
+         ++mActive;
+         // more threads only once there's more than one directory to go at.
+         if (mQueue.size() > 1 && mThreads.size() + 1 < mMaxThreads)
+            mThreads.push_back(std::thread(&remover::_worker, this));
+         mWake.notify_one();
+      }
+
+      void _fail(const std::string & path, int err)
+      {
+         std::lock_guard<std::mutex> lock(mMutex);
+         if (mErrors++ == 0)
+            mError = path + ": " + strerror(err);
+      }
+
+      int _open(const std::string & path)
+      {
+         int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+         if (fd < 0 && _lacksPermission(errno) && ::chmod(path.c_str(), S_IRWXU) == 0)
+            fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+         return fd;
+      }
+
+      // unlinks the files in d and queues its subdirectories.
+      void _empty(dirnode * d)
+      {
+         int fd = _open(d->path);
+         if (fd < 0)
+         {
+            if (errno != ENOENT) // gone already, e.g. another drunner emptying the trash.
+               _fail(d->path, errno);
+            return;
+         }
+
+         bool fixed = false; // the directory's permissions.
+         bool ok = _foreach(fd, [&](const char * name, unsigned char type) {
+            if (type == DT_UNKNOWN)
+            {
+               struct stat st;
+               if (::fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode))
+                  type = DT_DIR;
+            }
+            if (type != DT_DIR)
+            {
+               int rval = ::unlinkat(fd, name, 0);
+               if (rval != 0 && _lacksPermission(errno) && !fixed)
+               {
+                  fixed = true;
+                  ::fchmod(fd, S_IRWXU);
+                  rval = ::unlinkat(fd, name, 0);
+               }
+               if (rval == 0)
+               {
+                  ++mFiles;
+                  return;
+               }
+               int err = errno;
+               if (err == ENOENT)
+                  return;
+               if (err != EISDIR)
+               {
+                  _fail(d->path + "/" + name, err);
+                  return;
+               }
+            }
+            ++d->pending;
+            _push(new dirnode(d->path + "/" + name, d));
+         });
+         int err = errno;
+         if (!ok)
+            _fail(d->path, err);
+         ::close(fd);
+      }
+
+      // d has been read or a subdirectory removed: remove d, and so on up, once nothing's left.
+      void _done(dirnode * d)
+      {
+         while (d != NULL && --d->pending == 0)
+         {
+            int rval = ::rmdir(d->path.c_str());
+            if (rval != 0 && _lacksPermission(errno))
+            {
+               ::chmod(_parentof(d->path).c_str(), S_IRWXU);
+               rval = ::rmdir(d->path.c_str());
+            }
+            int err = errno;
+            if (rval == 0)
+               ++mDirs;
+            else if (err != ENOENT)
+               _fail(d->path, err);
+
+            dirnode * parent = d->parent;
+            delete d;
+            d = parent;
+         }
+      }
+
+      std::mutex mMutex;
+      std::condition_variable mWake;
+      std::deque<dirnode *> mQueue;
+      size_t mActive; // directories queued or being read.
+      std::vector<std::thread> mThreads;
+      size_t mMaxThreads;
+
+      std::atomic<uint64_t> mFiles, mDirs;
+      std::string mError; // the first.
+      size_t mErrors;
+   };
+
+   static std::string _rootof(const Poco::Path & path)
+   {
+      std::string root = path.toString();
+      while (root.length() > 1 && root[root.length() - 1] == '/')
+         root.erase(root.length() - 1);
+      return root;
+   }
+
+   static cResult _remove(const std::string & root)
+   {
+      if (root.length() == 0 || root == "/")
+         return cError("Refusing to delete " + root);
+
+      struct stat st;
+      if (::lstat(root.c_str(), &st) != 0)
+         return (errno == ENOENT) ? cResult(kRNoChange) : cError("Couldn't delete " + root + " - " + strerror(errno));
+      if (!S_ISDIR(st.st_mode))
+         return (::unlink(root.c_str()) == 0) ? cResult(kRSuccess) : cError("Couldn't delete " + root + " - " + strerror(errno));
+
+      remover r;
+      return r.run(root);
+   }
+
+   cResult remove(Poco::Path path)
+   {
+      persistence::discard(path);
+      return _remove(_rootof(path));
+   }
+
+   // one emptier at a time: another waits, then takes whatever's been added since.
+   static void _emptytrash(const std::string & trash)
+   {
+      persistence::filelock lock(Poco::Path(trash));
+      int fd = ::open(trash.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if (fd < 0)
+         return;
+      std::vector<std::string> names;
+      _foreach(fd, [&names](const char * name, unsigned char) { names.push_back(name); });
+      ::close(fd);
+
+      for (const auto & name : names)
+      {
+         cResult r = _remove(trash + "/" + name);
+         if (r.error())
+            logmsg(kLWARN, "Couldn't empty drunner's trash: " + r.what());
+      }
+   }
+
+   // empties the trash in a grandchild, which init adopts, so there's no one to wait for it.
+   static void _emptyinbackground(const std::string & trash)
+   {
+      // nothing may be mid-way through on another thread as we fork.
+      logstop();
+      fflush(NULL);
+
+      pid_t pid = ::fork();
+      if (pid < 0)
+      {
+         _emptytrash(trash);
+         return;
+      }
+      if (pid > 0)
+      {
+         ::waitpid(pid, NULL, 0);
+         return;
+      }
+
+      if (::fork() != 0)
+         ::_exit(0);
+
+      // detach from the terminal and from anything waiting on our output (or holding our locks).
+      // The log files are opened again if there's anything to log.
+      logreopen();
+      ::setsid();
+      int null = ::open("/dev/null", O_RDWR);
+      for (int i = 0; i < 3; ++i)
+         ::dup2(null, i);
+      long maxfd = ::sysconf(_SC_OPEN_MAX);
+      if (maxfd < 0 || maxfd > 65536)
+         maxfd = 65536;
+      for (int i = 3; i < maxfd; ++i)
+         ::close(i);
+      ::setpriority(PRIO_PROCESS, 0, 10);
+
+      _emptytrash(trash);
+      logflush();
+      ::_exit(0);
+   }
+
+   cResult removeasync(Poco::Path path)
+   {
+      return removeasync(std::vector<Poco::Path>{ path });
+   }
+
+   cResult removeasync(const std::vector<Poco::Path> & paths)
+   {
+      static std::atomic<unsigned int> sCount(0);
+      std::string trash = _rootof(drunnerPaths::getPath_Temp().pushDirectory("trash"));
+      try
+      {
+         Poco::File(trash).createDirectories();
+      }
+      catch (const Poco::Exception &) {}
+
+      cResult rval = kRNoChange;
+      bool moved = false;
+      for (const auto & path : paths)
+      {
+         persistence::discard(path);
+         std::string root = _rootof(path);
+         struct stat st;
+         if (::lstat(root.c_str(), &st) != 0)
+         {
+            if (errno != ENOENT)
+               rval += cError("Couldn't delete " + root + " - " + strerror(errno));
+            continue;
+         }
+
+         size_t slash = root.rfind('/');
+         std::string dest = trash + "/" + root.substr(slash == std::string::npos ? 0 : slash + 1) + "." +
+            std::to_string(::getpid()) + "." + std::to_string(sCount++);
+         if (::rename(root.c_str(), dest.c_str()) != 0)
+         {
+            drunner_log(kLDEBUG, "Couldn't move {} to the trash ({}), deleting it now.", root, strerror(errno));
+            rval += remove(path);
+            continue;
+         }
+         drunner_log(kLDEBUG, "Moved {} to the trash.", root);
+         moved = true;
+         rval += kRSuccess;
+      }
+
+      if (moved)
+         _emptyinbackground(trash);
+      return rval;
+   }
+
+#endif
+} // namespace
@@ -0,0 +1,35 @@
+#ifndef __TREEDELETE_H
+#define __TREEDELETE_H
+
+#include <vector>
+
+#include <Poco/Path.h>
+
+#include "cresult.h"
+
+// Deletes directory trees, quickly.
+//
+// Each directory is read a batch at a time (getdents64 on Linux) and its entries unlinked
+// relative to the open directory, with no per-entry path building, stat or logging.
+// Subdirectories are shared out to a pool of threads, and a directory is removed by the
+// thread that finishes its last subdirectory. Permissions are only changed when a delete
+// fails for want of them. Symbolic links are removed, never followed.
+namespace treedelete
+{
+   // delete the tree at path, path included. kRNoChange if there's nothing there.
+   cResult remove(Poco::Path path);
+
+   // move the tree at path into drunner's trash and delete it there in a detached background
+   // process, so this returns at once. Anything an earlier one left in the trash goes too.
+   // Falls back to remove() if the tree can't be moved (e.g. it's on another filesystem).
+   // The background process logs anything it can't delete.
+   cResult removeasync(Poco::Path path);
+
+   // as removeasync, for several trees: all are moved, then one process deletes them.
+   cResult removeasync(const std::vector<Poco::Path> & paths);
+
+   // how many trees are in the trash - still being deleted, or left by a delete that failed.
+   size_t trashcount();
+}
+
+#endif
@@ -0,0 +1,449 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <fstream>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include <Poco/File.h>
+#include <Poco/DirectoryIterator.h>
+#include <Poco/String.h>
+#include <Poco/DigestStream.h>
+#include <Poco/MD5Engine.h>
+
+#include "treesync.h"
+#include "utils.h"
+#include "globallogger.h"
+#include "treedelete.h"
+
+namespace treesync
+{
+   struct entry
+   {
+      bool dir;
+      bool link; // a symbolic link, kept as a link (to target) and never followed.
+      uint64_t size;
+      std::time_t mtime;
+      std::string target;
+
+      bool sametype(const entry & o) const { return dir == o.dir && link == o.link && target == o.target; }
+   };
+   typedef std::map<std::string, entry> tEntries; // relative path -> entry, parents sort before children.
+
+   enum eFileResult { kUnchanged, kAdded, kModified, kFailed };
+
+   struct job
+   {
+      std::string rel;
+      const entry * src;
+      const entry * dest; // NULL if not in dest.
+      eFileResult result;
+   };
+
+   static bool _readlink(const std::string & path, std::string & target)
+   {
+#ifdef _WIN32
+      return false;
+#else
+      std::vector<char> buf(256);
+      while (true)
+      {
+         ssize_t n = ::readlink(path.c_str(), buf.data(), buf.size());
+         if (n < 0)
+            return false;
+         if ((size_t)n < buf.size())
+         {
+            target.assign(buf.data(), (size_t)n);
+            return true;
+         }
+         buf.resize(buf.size() * 2);
+      }
+#endif
+   }
+
+   static cResult _makelink(const std::string & target, const std::string & path)
+   {
+#ifdef _WIN32
+      return cError("Can't create symbolic link " + path);
+#else
+      if (::symlink(target.c_str(), path.c_str()) != 0)
+         return cError("Couldn't create symbolic link " + path + ": " + strerror(errno));
+      return kRSuccess;
+#endif
+   }
+
+   static void _walk(Poco::Path root, std::string rel, const std::string & skipDir, tEntries & entries)
+   {
+      Poco::Path dir(root.toString() + rel);
+      dir.makeDirectory();
+
+      Poco::DirectoryIterator end;
+      for (Poco::DirectoryIterator it(dir); it != end; ++it)
+      {
+         std::string name = it.name();
+         std::string r = rel + name;
+         entry e;
+         e.link = false;
+         if (it->isLink())
+         { // checked first, as isDirectory and getSize follow links (and throw on dangling ones).
+            e.dir = false;
+            e.size = 0;
+            e.mtime = 0;
+            if (!_readlink(it->path(), e.target))
+            {
+               drunner_log(kLDEBUG, "Skipping symbolic link {}, it can't be read.", it->path());
+               continue;
+            }
+            e.link = true;
+            entries[r] = e;
+            continue;
+         }
+
+         e.dir = it->isDirectory();
+         if (e.dir)
+         {
+            if (Poco::icompare(name, skipDir) == 0)
+               continue;
+            e.size = 0;
+            e.mtime = 0;
+            entries[r] = e;
+            _walk(root, r + "/", skipDir, entries);
+         }
+         else
+         {
+            e.size = (uint64_t)it->getSize();
+            e.mtime = it->getLastModified().epochTime();
+            entries[r] = e;
+         }
+      }
+   }
+
+   static bool _samecontents(const std::string & a, const std::string & b)
+   {
+      std::ifstream fa(a, std::ios::binary), fb(b, std::ios::binary);
+      if (!fa.is_open() || !fb.is_open())
+         return false;
+
+      const size_t kBuf = 64 * 1024;
+      std::vector<char> ba(kBuf), bb(kBuf);
+      while (fa && fb)
+      {
+         fa.read(ba.data(), kBuf);
+         fb.read(bb.data(), kBuf);
+         if (fa.gcount() != fb.gcount() || memcmp(ba.data(), bb.data(), (size_t)fa.gcount()) != 0)
+            return false;
+      }
+      return fa.eof() && fb.eof();
+   }
+
+#ifdef _WIN32
+   static bool _copyfile(const std::string & from, const std::string & to, std::string & err)
+   {
+      try
+      {
+         std::string tmp = to + ".~sync";
+         Poco::File(from).copyTo(tmp);
+         Poco::File(tmp).setLastModified(Poco::File(from).getLastModified());
+         Poco::File(tmp).renameTo(to);
+      }
+      catch (const Poco::Exception & e)
+      {
+         err = "Couldn't copy " + from + ": " + e.displayText();
+         return false;
+      }
+      return true;
+   }
+
+   static void _touch(const std::string & from, const std::string & to)
+   {
+      Poco::File(to).setLastModified(Poco::File(from).getLastModified());
+   }
+#else
+   static bool _copydata(int in, int out, off_t size)
+   {
+#if defined(__linux__) && defined(SYS_copy_file_range)
+      // in kernel copy (reflinks on filesystems that support them). Not available everywhere.
+      off_t done = 0;
+      while (done < size)
+      {
+         ssize_t n = syscall(SYS_copy_file_range, in, NULL, out, NULL, (size_t)(size - done), 0);
+         if (n <= 0)
+            break;
+         done += n;
+      }
+      if (done == size)
+         return true;
+      if (done > 0)
+         return false; // partial copy, don't mix methods.
+#endif
+      char buf[64 * 1024];
+      ssize_t n;
+      while ((n = read(in, buf, sizeof(buf))) > 0)
+         for (ssize_t w = 0; w < n;)
+         {
+            ssize_t k = write(out, buf + w, (size_t)(n - w));
+            if (k < 0 && errno == EINTR)
+               continue;
+            if (k <= 0)
+               return false;
+            w += k;
+         }
+      return n == 0;
+   }
+
+   static bool _copyfile(const std::string & from, const std::string & to, std::string & err)
+   {
+      int in = open(from.c_str(), O_RDONLY);
+      if (in < 0)
+      {
+         err = "Couldn't open " + from + ": " + strerror(errno);
+         return false;
+      }
+      struct stat st;
+      fstat(in, &st);
+
+      std::string tmp = to + ".~sync";
+      int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 07777);
+      if (out < 0)
+      {
+         err = "Couldn't create " + tmp + ": " + strerror(errno);
+         close(in);
+         return false;
+      }
+
+      bool ok = _copydata(in, out, st.st_size);
+      ok = ok && (fchmod(out, st.st_mode & 07777) == 0);
+
+      struct timeval tv[2];
+      tv[0].tv_sec = st.st_atime; tv[0].tv_usec = 0;
+      tv[1].tv_sec = st.st_mtime; tv[1].tv_usec = 0;
+      ok = ok && (futimes(out, tv) == 0);
+
+      ok = (close(out) == 0) && ok;
+      close(in);
+
+      if (ok && rename(tmp.c_str(), to.c_str()) == 0)
+         return true;
+
+      err = "Couldn't copy " + from + " to " + to + ": " + strerror(errno);
+      unlink(tmp.c_str());
+      return false;
+   }
+
+   static void _touch(const std::string & from, const std::string & to)
+   {
+      struct stat st;
+      if (stat(from.c_str(), &st) != 0)
+         return;
+      struct timeval tv[2];
+      tv[0].tv_sec = st.st_atime; tv[0].tv_usec = 0;
+      tv[1].tv_sec = st.st_mtime; tv[1].tv_usec = 0;
+      utimes(to.c_str(), tv);
+   }
+#endif
+
+   static void _syncfile(const std::string & src, const std::string & dest, job & j, std::string & err)
+   {
+      if (j.dest != NULL && j.dest->size == j.src->size)
+      {
+         if (j.dest->mtime == j.src->mtime)
+         {
+            j.result = kUnchanged;
+            return;
+         }
+         if (_samecontents(src + j.rel, dest + j.rel))
+         { // e.g. a fresh git checkout. Fix the time so next time is quick.
+            _touch(src + j.rel, dest + j.rel);
+            j.result = kUnchanged;
+            return;
+         }
+      }
+
+      if (!_copyfile(src + j.rel, dest + j.rel, err))
+         j.result = kFailed;
+      else
+         j.result = (j.dest == NULL) ? kAdded : kModified;
+   }
+
+   // -------------------------------------------------------------------------------
+
+   std::string summary::describe() const
+   {
+      return std::to_string(added.size()) + " added, " + std::to_string(modified.size()) + " changed, " +
+         std::to_string(removed.size()) + " removed, " + std::to_string(unchanged) + " unchanged";
+   }
+
+   cResult sync(Poco::Path src, Poco::Path dest, summary & s, std::string skipDir)
+   {
+      src.makeDirectory();
+      dest.makeDirectory();
+      if (!utils::fileexists(src))
+         return cError("Source directory does not exist: " + src.toString());
+
+      tEntries srcents, destents;
+      try
+      {
+         _walk(src, "", skipDir, srcents);
+         if (utils::fileexists(dest))
+            _walk(dest, "", skipDir, destents);
+         else
+            Poco::File(dest).createDirectories();
+      }
+      catch (const Poco::Exception & e)
+      {
+         return cError("Couldn't read directory tree: " + e.displayText());
+      }
+
+      const std::string srcroot = src.toString(), destroot = dest.toString();
+
+      // remove what isn't in the source (or has changed between file and directory), children first.
+      std::vector<std::string> stale;
+      for (auto it = destents.rbegin(); it != destents.rend(); ++it)
+      {
+         auto sit = srcents.find(it->first);
+         if (sit == srcents.end() || !sit->second.sametype(it->second))
+            stale.push_back(it->first);
+      }
+      for (const auto & rel : stale)
+      {
+         cResult r = treedelete::remove(Poco::Path(destroot + rel)); // doesn't follow links.
+         if (r.error())
+            return r;
+         destents.erase(rel);
+         s.removed.push_back(rel);
+      }
+
+      // create directories and links, parents first.
+      std::vector<job> jobs;
+      for (const auto & x : srcents)
+      {
+         auto dit = destents.find(x.first);
+         if (x.second.link)
+         {
+            if (dit != destents.end())
+               ++s.unchanged;
+            else
+            {
+               cResult r = _makelink(x.second.target, destroot + x.first);
+               if (!r.success())
+                  return r;
+               s.added.push_back(x.first);
+            }
+            continue;
+         }
+         if (x.second.dir)
+         {
+            if (dit == destents.end())
+            {
+               cResult r = utils::makedirectory(Poco::Path(destroot + x.first).makeDirectory(), S_700);
+               if (!r.success())
+                  return r;
+               s.added.push_back(x.first + "/");
+            }
+            continue;
+         }
+
+         job j;
+         j.rel = x.first;
+         j.src = &x.second;
+         j.dest = (dit == destents.end()) ? NULL : &dit->second;
+         j.result = kFailed;
+         jobs.push_back(j);
+      }
+
+      // then the files, in parallel.
+      std::atomic<size_t> next(0);
+      std::mutex errmutex;
+      std::string errors;
+      auto worker = [&]() {
+         size_t i;
+         while ((i = next++) < jobs.size())
+         {
+            std::string err;
+            _syncfile(srcroot, destroot, jobs[i], err);
+            if (err.length() > 0)
+            {
+               std::lock_guard<std::mutex> lock(errmutex);
+               errors += err + "\n";
+            }
+         }
+      };
+
+      size_t nthreads = std::thread::hardware_concurrency();
+      if (nthreads > 8) nthreads = 8;
+      if (nthreads > jobs.size() / 16 + 1) nthreads = jobs.size() / 16 + 1; // not worth it for small trees.
+      std::vector<std::thread> threads;
+      for (size_t t = 1; t < nthreads; ++t)
+         threads.push_back(std::thread(worker));
+      worker();
+      for (auto & t : threads)
+         t.join();
+
+      for (const auto & j : jobs)
+         switch (j.result)
+         {
+         case kUnchanged: ++s.unchanged; break;
+         case kAdded: s.added.push_back(j.rel); drunner_log(kLDEBUG, "Copied {} to {}", j.rel, destroot); break;
+         case kModified: s.modified.push_back(j.rel); drunner_log(kLDEBUG, "Updated {} in {}", j.rel, destroot); break;
+         default: break;
+         }
+
+      if (errors.length() > 0)
+         return cError(errors);
+
+      drunner_log(kLDEBUG, "Synced {} to {}: {}", srcroot, destroot, s.describe());
+      return s.changed() ? kRSuccess : kRNoChange;
+   }
+
+   std::string treehash(Poco::Path root, std::string skipDir)
+   {
+      root.makeDirectory();
+      tEntries ents;
+      try
+      {
+         _walk(root, "", skipDir, ents);
+      }
+      catch (const Poco::Exception &)
+      {
+         return "";
+      }
+
+      Poco::MD5Engine md5;
+      Poco::DigestOutputStream ostr(md5);
+      for (const auto & x : ents)
+      {
+         ostr << x.first << '\0';
+         if (x.second.link)
+            ostr << "l" << x.second.target << '\0';
+         else if (x.second.dir)
+            ostr << "d" << '\0';
+         else
+         {
+            std::ifstream is(root.toString() + x.first, std::ios::binary);
+            if (!is.is_open())
+               return "";
+            ostr << "f" << x.second.size << '\0';
+            if (x.second.size > 0)
+               ostr << is.rdbuf();
+         }
+      }
+      ostr.flush();
+      return Poco::DigestEngine::digestToHex(md5.digest());
+   }
+
+} // namespace
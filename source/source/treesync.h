@@ -0,0 +1,41 @@
+#ifndef __TREESYNC_H
+#define __TREESYNC_H
+
+#include <string>
+#include <vector>
+
+#include <Poco/Path.h>
+
+#include "cresult.h"
+
+// Makes a destination directory tree match a source tree, touching only what differs.
+//
+// Files are compared by size and modification time, and by content when only the time
+// differs. Changed files are copied (in the kernel where possible) across a pool of
+// threads, to a temporary name which is then renamed into place. Entries that are no
+// longer in the source are removed. Copies keep the source's permissions and mtime so
+// the next sync can skip them cheaply. Symbolic links are recreated as links, never followed.
+namespace treesync
+{
+   class summary
+   {
+   public:
+      summary() : unchanged(0) {}
+
+      bool changed() const { return added.size() + modified.size() + removed.size() > 0; }
+      std::string describe() const;
+
+      std::vector<std::string> added, modified, removed; // paths relative to the tree root.
+      size_t unchanged;
+   };
+
+   // sync src into dest, which is created if needed. Directories named skipDir are ignored on both sides.
+   cResult sync(Poco::Path src, Poco::Path dest, summary & s, std::string skipDir = ".git");
+
+   // MD5 over the relative paths and contents of the tree at root (skipping skipDir), so two trees
+   // that sync() would consider identical hash the same. Empty if the tree can't be read.
+   std::string treehash(Poco::Path root, std::string skipDir = ".git");
+
+} // namespace
+
+#endif
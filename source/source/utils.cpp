@@ -24,13 +24,13 @@
 #include <Poco/Util/SystemConfiguration.h>
 #include <Poco/Net/DNS.h>
 #include <Poco/Net/NetworkInterface.h>
-#include <Poco/DirectoryIterator.h>
-#include <Poco/TeeStream.h>
 
 #include <sys/stat.h>
 #include <stdio.h>
 
 #include "utils.h"
+#include "base64.h"
+#include "treedelete.h"
 #include "exceptions.h"
 #include "service_log.h"
 #include "globallogger.h"
@@ -38,6 +38,7 @@
 #include "enums.h"
 #include "drunner_paths.h"
 #include "dassert.h"
+#include "persistence.h"
 
 namespace utils
 {
@@ -73,10 +74,18 @@ namespace utils
       poco_assert(bfp.isFile());
 
       // log the command, getting the args right is non-trivial in some cases so this is useful.
-      std::string cmd = operation.command;
-      for (const auto & entry : operation.args)
-         cmd += " [" + entry + "]";
-      logmsg(kLDEBUG, "runcommand_stream: " + cmd);
+      if (logenabled(kLDEBUG))
+      {
+         std::string cmd = operation.command;
+         for (const auto & entry : operation.args)
+            cmd += " [" + entry + "]";
+         logmsg(kLDEBUG, "runcommand_stream: " + cmd);
+      }
+
+      // the command may read our settings, so write out any that are pending.
+      cResult pr = persistence::flush();
+      if (pr.error())
+         logmsg(kLWARN, "Couldn't write settings: " + pr.what());
 
       try {
          Poco::Pipe outpipe;
@@ -84,11 +93,10 @@ namespace utils
             initialDirectory.toString(), 0, &outpipe, &outpipe, env);
          Poco::PipeInputStream pis(outpipe);
 
-         Poco::TeeOutputStream tee(oss);
-         if (outputMode==kORaw) // otherwise it's kOSuppressed.
-            tee.addStream(std::cout);
-
-         Poco::StreamCopier::copyStreamUnbuffered(pis, tee);
+         if (outputMode==kORaw) // shown and logged as it arrives, a block at a time.
+            dServiceLog(pis, oss);
+         else // kOSuppressed.
+            Poco::StreamCopier::copyStream(pis, oss);
 
          rval = ph.wait();
       }
@@ -101,15 +109,52 @@ namespace utils
          *out = oss.str();
 
       if (rval != 0)
+         drunner_log(kLDEBUG, "{} returned {}", bfp.getFileName(), rval);
+      return rval;
+   }
+
+
+   int runcommand_input(const CommandLine & operation, const std::string & input, std::string & out)
+   { // input is written before any output is read, so it's for small inputs and quiet commands.
+      int rval = -1;
+      std::ostringstream oss;
+
+      if (logenabled(kLDEBUG))
+      {
+         std::string cmd = operation.command;
+         for (const auto & entry : operation.args)
+            cmd += " [" + entry + "]";
+         drunner_log(kLDEBUG, "runcommand_input: {} < {} bytes", cmd, input.length());
+      }
+
+      cResult pr = persistence::flush();
+      if (pr.error())
+         logmsg(kLWARN, "Couldn't write settings: " + pr.what());
+
+      try {
+         Poco::Pipe inpipe, outpipe;
+         Poco::ProcessHandle ph = Poco::Process::launch(operation.command, operation.args, &inpipe, &outpipe, &outpipe);
+
+         Poco::PipeOutputStream pos(inpipe);
+         pos << input;
+         pos.flush();
+         pos.close(); // EOF for the command.
+
+         Poco::PipeInputStream pis(outpipe);
+         Poco::StreamCopier::copyStream(pis, oss);
+         rval = ph.wait();
+      }
+      catch (Poco::SystemException & se)
       {
-         std::ostringstream rvalmsg;
-         rvalmsg << bfp.getFileName() << " returned " << rval;
-         logmsg(kLDEBUG, rvalmsg.str());
+         fatal(se.displayText());
       }
+
+      out = oss.str();
+      if (rval != 0)
+         drunner_log(kLDEBUG, "{} returned {}", Poco::Path(operation.command).getFileName(), rval);
       return rval;
    }
 
-
    std::string replacestring(std::string subject, const std::string& search,
         const std::string& replace)
    {
@@ -163,7 +208,7 @@ namespace utils
          if (!utils::fileexists(d.parent()))
             return cError("Parent directoy doesn't exist: " + d.parent().toString());
          f.createDirectory();
-         logdbg("Created " + d.toString());
+         drunner_log(kLDEBUG, "Created {}", d);
       }
 
 #ifndef _WIN32
@@ -179,30 +224,7 @@ namespace utils
    cResult deltree(Poco::Path s)
    {
       drunner_assert(s.isDirectory(), "deltree: asked to delete a file: "+s.toString());
-      cResult rval = kRNoChange;
-
-      try
-      {
-         Poco::DirectoryIterator end;
-         for (Poco::DirectoryIterator it(s); it != end; ++it)
-            if (it->isFile())
-               rval += delfile(it->path());
-            else
-            {
-               Poco::Path subdir(it->path());
-               subdir.makeDirectory();
-               rval += deltree(subdir);
-            }
-
-         Poco::File f(s);
-         f.setWriteable(true);
-         f.remove();
-         logmsg(kLDEBUG, "Deleted " + f.path());
-      }
-      catch (const Poco::Exception & e) {
-         return cError("Couldn't delete " + s.toString() + " - " + e.what());
-      }
-      return kRSuccess;
+      return treedelete::remove(s);
    }
 
    void movetree(const std::string &src, const std::string &dst)
@@ -245,7 +267,7 @@ namespace utils
       }
 #endif
 
-      logmsg(kLDEBUG, "Deleted " + fullpath.toString());
+      drunner_log(kLDEBUG, "Deleted {}", fullpath);
       return kRSuccess;
    }
 
@@ -427,64 +449,34 @@ namespace utils
 
    std::string base64encode(std::string s)
    {
-      std::string encoded_data;
-      bn::encode_b64(s.begin(), s.end(), std::back_inserter(encoded_data));
-      return encoded_data;
+      return base64::encode(s, false);
    }
 
    std::string base64encodeWithEquals(std::string s)
    {
-      std::string encoded_data = base64encode(s);
-
-      int n = encoded_data.length() % 4;
-      if (n == 2) encoded_data += "==";
-      if (n == 3) encoded_data += "=";
-      poco_assert(n != 1);
-
-      return encoded_data;
+      return base64::encode(s, true);
    }
 
    void str2vecstr(std::string s, std::vector<std::string>& vecstr)
    {
-      std::string::const_iterator cur = s.begin();
-      std::string::const_iterator beg = s.begin();
-      while (cur < s.end())
+      // each field is base64 encoded, so | only ever separates them.
+      size_t beg = 0, cur;
+      while ((cur = s.find('|', beg)) != std::string::npos)
       {
-         if (*cur == '|')
-         {
-            vecstr.insert(vecstr.end(), std::string(beg, cur));
-            beg = ++cur;
-         }
-         else
-            cur++;
+         vecstr.push_back(base64::decode(s.data() + beg, cur - beg));
+         beg = cur + 1;
       }
-
-      vecstr.insert(vecstr.end(), std::string(beg, cur));
-
-      // base64 decode all the strings.
-      for (unsigned int i = 0; i < vecstr.size(); ++i)
-         vecstr[i] = utils::base64decode(vecstr[i]);
+      vecstr.push_back(base64::decode(s.data() + beg, s.length() - beg));
    }
 
    std::string vecstr2str(std::vector<std::string> vecstr)
    {
       std::string s;
-
-      // base64 encode all the strings.
-      for (unsigned int i = 0; i < vecstr.size(); ++i)
-         vecstr[i] = utils::base64encode(vecstr[i]);
-
-      switch (vecstr.size())
+      for (size_t i = 0; i < vecstr.size(); ++i)
       {
-      case 0:
-         s = ""; break;
-      case 1:
-         s = vecstr[0];
-      default:
-         std::ostringstream os;
-         std::copy(vecstr.begin(), vecstr.end() - 1, std::ostream_iterator<std::string>(os, "|"));
-         os << *vecstr.rbegin();
-         s = os.str();
+         if (i > 0)
+            s += '|';
+         s += base64::encode(vecstr[i], false);
       }
       return s;
    }
@@ -497,9 +489,7 @@ namespace utils
 
    std::string base64decode(std::string s)
    {
-      std::ostringstream os;
-      bn::decode_b64(s.begin(), s.end(), std::ostream_iterator<char>(os, ""));
-      return os.str();
+      return base64::decode(s);
    }
 
 } // namespace utils
@@ -10,7 +10,6 @@
 
 #include "enums.h"
 #include "cresult.h"
-#include "basen.h"
 
 typedef std::vector<std::string> tVecStr;
 
@@ -62,6 +61,7 @@ namespace utils
    
    int runcommand(const CommandLine & operation, std::string &out);
    int runcommand_stream(const CommandLine & operation, edServiceOutput outputMode, Poco::Path initialDirectory, const Poco::Process::Env & env, std::string * out);
+   int runcommand_input(const CommandLine & operation, const std::string & input, std::string & out); // input is fed to stdin.
 
    bool findStringIC(const std::string & strHaystack, const std::string & strNeedle);
    std::string replacestring(std::string subject, const std::string& search, const std::string& replace);
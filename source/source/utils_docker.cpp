@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <iterator>
+#include <sstream>
 
 #include <Poco/String.h>
 #include <Poco/Net/Socket.h>
@@ -7,7 +8,6 @@
 #include <Poco/Net/StreamSocket.h>
 #include <Poco/Thread.h>
 
-#include "basen.h"
 #include "utils.h"
 #include "utils_docker.h"
 #include "globalcontext.h"
@@ -20,10 +20,24 @@ namespace utils_docker
 {
 
    static std::vector<std::string> S_PullList;
+   static dockerrecorder * S_Recorder = NULL;
+
+   dockerrecorder::dockerrecorder() : mPrevious(S_Recorder)
+   {
+      S_Recorder = this;
+   }
+
+   dockerrecorder::~dockerrecorder()
+   {
+      S_Recorder = mPrevious;
+   }
 
 
    cResult createDockerVolume(std::string name)
    {
+      if (S_Recorder != NULL && std::find(S_Recorder->mVolumes.begin(), S_Recorder->mVolumes.end(), name) == S_Recorder->mVolumes.end())
+         S_Recorder->mVolumes.push_back(name);
+
       CommandLine cl("docker", { "volume","create","--name=" + name });
       std::string op;
       int rval = utils::runcommand(cl, op);
@@ -96,6 +110,9 @@ namespace utils_docker
 
    cResult pullImage(const std::string & image)
    {
+      if (S_Recorder != NULL && std::find(S_Recorder->mImages.begin(), S_Recorder->mImages.end(), image) == S_Recorder->mImages.end())
+         S_Recorder->mImages.push_back(image);
+
 //#ifdef _DEBUG
 //      logmsg(kLDEBUG, "DEBUG BUILD - not pulling");
 //      return kRSuccess;
@@ -139,6 +156,16 @@ namespace utils_docker
       return kRSuccess;
    }
 
+   cResult getImageID(const std::string & image, std::string & id)
+   {
+      CommandLine cl("docker", { "image","inspect","--format","{{.Id}}",image });
+      int rval = utils::runcommand(cl, id);
+      Poco::trimInPlace(id);
+      if (rval != 0 || id.length() == 0)
+         return cError("Couldn't inspect image " + image + ": " + id);
+      return kRSuccess;
+   }
+
    cResult runBashScriptInContainer(std::string data, std::string imagename, std::string & op)
    {
       std::string encoded_data = utils::base64encodeWithEquals(data);
@@ -176,6 +203,119 @@ namespace utils_docker
       return (rval != 0 ? false : utils::wordmatch(out, container));
    }
 
+   // -----------------------------------------------------------------------------------------------
+
+   static const std::string sInspectFormat =
+      "{{.Name}}\t{{.State.Status}}\t{{.Config.Image}}\t"
+      "{{range $k, $v := .NetworkSettings.Networks}}{{$k}}={{$v.IPAddress}} {{end}}\t"
+      "{{range $p, $b := .NetworkSettings.Ports}}{{$p}}{{if $b}}->{{(index $b 0).HostPort}}{{end}} {{end}}";
+
+   static std::vector<std::string> splitfields(const std::string & line, char sep)
+   {
+      std::vector<std::string> fields;
+      size_t start = 0, pos;
+      while ((pos = line.find(sep, start)) != std::string::npos)
+      {
+         fields.push_back(line.substr(start, pos - start));
+         start = pos + 1;
+      }
+      fields.push_back(line.substr(start));
+      return fields;
+   }
+
+   cResult getContainers(std::vector<dockercontainer> & containers, const std::string & namefilter)
+   {
+      containers.clear();
+
+      CommandLine cl("docker", { "ps","-a","-q","--no-trunc" });
+      if (namefilter.length() > 0)
+         cl.args.push_back("--filter=name=" + namefilter);
+      std::string ids;
+      if (utils::runcommand(cl, ids) != 0)
+         return cError("Unable to list docker containers: " + ids);
+
+      // inspect them all in one go.
+      cl = CommandLine("docker", { "inspect","--format",sInspectFormat });
+      std::istringstream iss(ids);
+      std::string id;
+      while (iss >> id)
+         cl.args.push_back(id);
+      if (cl.args.size() == 2)
+         return kRSuccess; // no containers.
+
+      // a container removed since docker ps has docker inspect fail with "No such object", but
+      // still print the rest - those are skipped, anything else is an error.
+      std::string out;
+      bool failed = (utils::runcommand(cl, out) != 0);
+
+      std::istringstream lines(out);
+      std::string line;
+      while (std::getline(lines, line))
+      {
+         std::vector<std::string> f = splitfields(line, '\t');
+         if (f.size() != 5)
+         {
+            if (failed && Poco::trim(line).length() > 0 && line.find("No such") == std::string::npos)
+               return cError("Unable to inspect docker containers: " + out);
+            continue;
+         }
+
+         dockercontainer c;
+         c.name = f[0];
+         if (c.name.length() > 0 && c.name[0] == '/')
+            c.name.erase(0, 1);
+         c.state = f[1];
+         c.image = f[2];
+
+         std::istringstream nets(f[3]);
+         std::string net;
+         while (nets >> net)
+         {
+            size_t eq = net.find('=');
+            if (eq != std::string::npos)
+               c.networks[net.substr(0, eq)] = net.substr(eq + 1);
+         }
+
+         std::istringstream ports(f[4]);
+         std::string port;
+         while (ports >> port)
+            c.ports.push_back(port);
+
+         containers.push_back(c);
+      }
+      return kRSuccess;
+   }
+
+   cResult getVolumes(std::vector<dockervolume> & volumes, const std::string & namefilter)
+   {
+      volumes.clear();
+
+      CommandLine cl("docker", { "volume","ls","--format","{{.Name}}\t{{.Driver}}" });
+      if (namefilter.length() > 0)
+         cl.args.push_back("--filter=name=" + namefilter);
+      std::string out;
+      if (utils::runcommand(cl, out) != 0)
+         return cError("Unable to list docker volumes: " + out);
+
+      std::istringstream lines(out);
+      std::string line;
+      while (std::getline(lines, line))
+      {
+         Poco::trimInPlace(line);
+         if (line.length() == 0)
+            continue;
+         std::vector<std::string> f = splitfields(line, '\t');
+         dockervolume v;
+         v.name = f[0];
+         if (f.size() > 1)
+            v.driver = f[1];
+         volumes.push_back(v);
+      }
+      return kRSuccess;
+   }
+
+   // -----------------------------------------------------------------------------------------------
+
    bool dockerContainerWait(const std::string & containername, int port, int timeout)
    {
       // get IP address of container.
@@ -233,6 +373,31 @@ namespace utils_docker
       return "";
    }
 
+   cResult getNetworkAddresses(const std::string & network, std::map<std::string, std::string> & addresses)
+   {
+      addresses.clear();
+
+      CommandLine cl("docker", { "network","inspect","--format",
+         "{{range $id, $c := .Containers}}{{$c.Name}}\t{{$c.IPv4Address}}\n{{end}}", network });
+      std::string out;
+      if (utils::runcommand(cl, out) != 0)
+         return cError("Unable to inspect docker network " + network + ": " + out);
+
+      std::istringstream lines(out);
+      std::string line;
+      while (std::getline(lines, line))
+      {
+         std::vector<std::string> f = splitfields(line, '\t');
+         if (f.size() != 2 || f[0].length() == 0)
+            continue;
+         std::string ip = f[1].substr(0, f[1].find('/')); // drop the /prefix length.
+         Poco::trimInPlace(ip);
+         if (ip.length() > 0)
+            addresses[f[0]] = ip;
+      }
+      return kRSuccess;
+   }
+
    bool dockerContainerRunsAsRoot(std::string container)
    {
       std::string script = R"EOF(
@@ -2,17 +2,44 @@
 #define __UTILS_DOCKER_H
 
 #include <string>
+#include <vector>
+#include <map>
 #include "params.h"
 #include "drunner_settings.h"
 
 namespace utils_docker
 {
+   class dockercontainer
+   {
+   public:
+      std::string name;
+      std::string state;    // created, running, paused, restarting, exited, dead.
+      std::string image;
+      std::map<std::string, std::string> networks; // network name -> IP address.
+      std::vector<std::string> ports; // e.g. 80/tcp->8080, or just 80/tcp if not published.
+
+      bool running() const { return state == "running"; }
+   };
+
+   class dockervolume
+   {
+   public:
+      std::string name;
+      std::string driver;
+   };
+
+   // snapshot of all containers (or those whose name matches the filter) from a single docker inspect.
+   cResult getContainers(std::vector<dockercontainer> & containers, const std::string & namefilter = "");
+   cResult getVolumes(std::vector<dockervolume> & volumes, const std::string & namefilter = "");
+
    bool dockerVolExists(const std::string & vol);
    bool dockerContainerExists(const std::string & container);
    bool dockerContainerRunning(const std::string & container);
    bool dockerContainerWait(const std::string & containername, int port, int timeout);
 
    std::string getIPAddress(const std::string & containername, const std::string & network="");
+   // container name -> IP address for every container attached to the network, from a single docker network inspect.
+   cResult getNetworkAddresses(const std::string & network, std::map<std::string, std::string> & addresses);
 
    cResult createDockerVolume(std::string name);
    cResult deleteDockerVolume(std::string name);
@@ -20,6 +47,25 @@ namespace utils_docker
    cResult stopContainer(std::string name);
    cResult removeContainer(std::string name);
    cResult pullImage(const std::string & image);
+   cResult getImageID(const std::string & image, std::string & id); // the local image's ID (sha256:...).
+
+   // collects the images pullImage is asked for and the volumes createDockerVolume creates
+   // while in scope (e.g. by a service's install).
+   class dockerrecorder
+   {
+   public:
+      dockerrecorder();
+      ~dockerrecorder();
+      const std::vector<std::string> & getImages() const { return mImages; }
+      const std::vector<std::string> & getVolumes() const { return mVolumes; }
+
+   private:
+      friend cResult pullImage(const std::string & image);
+      friend cResult createDockerVolume(std::string name);
+      std::vector<std::string> mImages;
+      std::vector<std::string> mVolumes;
+      dockerrecorder * mPrevious;
+   };
 
    cResult runBashScriptInContainer(std::string data, std::string imagename, std::string & op);
    bool dockerContainerRunsAsRoot(std::string container);
@@ -1,28 +1,59 @@
 #include <Poco/String.h>
 #include <Poco/Environment.h>
-#include <fstream>
-#include <cereal/archives/json.hpp>
 
 #include "variables.h"
 #include "utils.h"
 #include "globallogger.h"
 #include "dassert.h"
-#include "basen.h"
+#include "substitution.h"
+#include "persistence.h"
 
 
 keyVals::keyVals(const keyVals & other1, const keyVals & other2)
 {
    mKeyVals = other1.getAll();
+   mIndex = other1.mIndex;
    for (const auto & x : other2.getAll())
-      mKeyVals[x.first] = x.second;
+      setVal(x.first, x.second);
 }
 
-bool keyVals::hasKey(std::string key) const
+std::string keyVals::foldcase(const std::string & key)
+{
+   std::string f(key);
+   for (auto & c : f)
+      c = (char)tolower((unsigned char)c);
+   return f;
+}
+
+const std::string * keyVals::_find(const std::string & key) const
+{
+   auto it = mIndex.find(foldcase(key));
+   if (it == mIndex.end())
+      return NULL;
+   auto kv = mKeyVals.find(it->second);
+   drunner_assert(kv != mKeyVals.end(), "keyVals index is out of step for " + key);
+   return &kv->second;
+}
+
+const std::string * keyVals::_findexact(const std::string & key) const
+{
+   auto it = mIndex.find(foldcase(key));
+   if (it == mIndex.end() || it->second != key)
+      return NULL;
+   return &mKeyVals.find(it->second)->second;
+}
+
+void keyVals::_reindex()
 {
+   mIndex.clear();
+   mIndex.reserve(mKeyVals.size());
    for (const auto & x : mKeyVals)
-      if (0==Poco::icompare(key, x.first))
-         return true;
-   return false;
+      mIndex.insert(std::make_pair(foldcase(x.first), x.first)); // first (in map order) wins, as the old linear scan did.
+}
+
+bool keyVals::hasKey(std::string key) const
+{
+   return _find(key) != NULL;
 }
 
 bool keyVals::isDefined(std::string key) const
@@ -32,10 +63,8 @@ bool keyVals::isDefined(std::string key) const
 
 std::string keyVals::getVal(std::string key) const
 {
-   for (const auto & x : mKeyVals)
-      if (0==Poco::icompare(key, x.first))
-         return x.second;
-   return "";
+   const std::string * v = _find(key);
+   return v ? *v : "";
 }
 
 bool keyVals::getBool(std::string key) const
@@ -47,24 +76,24 @@ bool keyVals::getBool(std::string key) const
 
 void keyVals::setVal(std::string key, std::string val)
 {
-   mKeyVals[key] = val;
+   // keep the casing of an existing key.
+   auto ins = mIndex.insert(std::make_pair(foldcase(key), key));
+   mKeyVals[ins.first->second] = val;
 }
 
 void keyVals::delKey(std::string key)
 {
-   mKeyVals.erase(key);
+   auto it = mIndex.find(foldcase(key));
+   if (it == mIndex.end())
+      return;
+   mKeyVals.erase(it->second);
+   mIndex.erase(it);
 }
 
 
 std::string keyVals::substitute(std::string s) const
 {
-   std::string os(s);
-   for (auto it = mKeyVals.begin(); it != mKeyVals.end(); ++it)
-   {
-      Poco::replaceInPlace(os, "$" + it->first, it->second);
-      Poco::replaceInPlace(os, "${" + it->first+"}", it->second);
-   }
-   return os;
+   return substitution::substitute(s, [this](const std::string & name) { return _findexact(name); });
 }
 
 
@@ -76,6 +105,10 @@ std::string keyVals::substitute(std::string s) const
 persistvariables::persistvariables(std::string name, Poco::Path path, const std::vector<envDef> config) :
    keyVals(), mName(name), mPath(path), mEnvDefs(config)
 {
+   mEnvDefIndex.reserve(mEnvDefs.size());
+   for (size_t i = 0; i < mEnvDefs.size(); ++i)
+      mEnvDefIndex.insert(std::make_pair(foldcase(mEnvDefs[i].name), i));
+
    // set default values
    for (const auto & x : mEnvDefs)
       setVal(x.name, x.defaultval);
@@ -88,18 +121,9 @@ cResult persistvariables::loadvariables()
 
    // read the settings.
    keyVals storedvars;
-   std::ifstream is(mPath.toString());
-   if (is.bad())
-      return cError("Unable to open " + mPath.toString() + " for reading.");
-   try
-   {
-      cereal::JSONInputArchive archive(is);
-      archive(storedvars);
-   }
-   catch (const cereal::Exception & e)
-   {
-      return cError("Cereal exception on reading settings: " + std::string(e.what()));
-   }
+   cResult r = persistence::loadjson(mPath, storedvars);
+   if (r.error())
+      return r;
 
    // check all items are (1) listed in config, and (2) valid.
    for (auto x : storedvars.getAll())
@@ -110,18 +134,10 @@ cResult persistvariables::loadvariables()
 
 cResult persistvariables::savevariables() const
 {
-   logdbg("Creating " + mPath.toString());
-   std::ofstream os(mPath.toString());
-   if (os.bad() || !os.is_open())
-   {
-      logmsg(kLDEBUG, "Unable to open " + mPath.toString() + " for writing.");
-      return cError("Unable to open " + mPath.toString() + " for writing.");
-   }
-
    // extract out all the variables that are to be persisted.
    keyVals vars;
-   for (auto x : getAll())
-      if (std::unique_ptr<envDef> def = getDef(x.first))
+   for (const auto & x : getAll())
+      if (const envDef * def = getDef(x.first))
       {
          if (def->persists)
             vars.setVal(x.first, x.second);
@@ -129,31 +145,17 @@ cResult persistvariables::savevariables() const
       else
          logmsg(kLWARN, "Defined variable " + x.first + " does not appear in environment definitions. Not persisted.");
 
-   try
-   {
-      cereal::JSONOutputArchive archive(os);
-      archive(vars);
-   }
-   catch (const cereal::Exception & e)
-   {
-      logmsg(kLDEBUG, "Cereal exception on writing settings: " + std::string(e.what()));
-      return cError("Cereal exception on writing settings: " + std::string(e.what()));
-   }
-
-   if (!utils::fileexists(mPath))
-      logmsg(kLWARN, "Failed to create blank settings at " + mPath.toString());
-
-   return kRSuccess;
+   // written once when the command finishes, and only if changed.
+   return persistence::savejson(mPath, vars);
 }
 
 cResult persistvariables::setVal(std::string key, std::string val)
 {
-   for (const auto & x : mEnvDefs)
-      if (Poco::icompare(x.name, key) == 0)
-      {
-         keyVals::setVal(x.name, val);
-         return kRSuccess;
-      }
+   if (const envDef * def = getDef(key))
+   {
+      keyVals::setVal(def->name, val);
+      return kRSuccess;
+   }
 
    return cError("Configuration value '" + key + "' is not recognised.");
 }
@@ -168,7 +170,7 @@ cResult persistvariables::_showconfiginfo() const
 
    int uservars = 0;
    for (const auto & y : getAll())
-      if (std::unique_ptr<envDef> def = getDef(y.first))
+      if (const envDef * def = getDef(y.first))
       {
          if (def->usersettable)
          {
@@ -231,7 +233,7 @@ cResult persistvariables::handleConfigureCommand(CommandLine cl)
             val = kv.substr(epos + 1);
       }
 
-      if (std::unique_ptr<envDef> def = getDef(key))
+      if (const envDef * def = getDef(key))
       {
          if (!def->usersettable)
             return cError("You can't override " + key);
@@ -255,21 +257,23 @@ cResult persistvariables::handleConfigureCommand(CommandLine cl)
 
 void persistvariables::_addConfig(const envDef & c)
 {
-   mEnvDefs.push_back(c);
+   // the first definition of a name wins.
+   if (mEnvDefIndex.insert(std::make_pair(foldcase(c.name), mEnvDefs.size())).second)
+      mEnvDefs.push_back(c);
 
    if (!isDefined(c.name))
       setVal(c.name, c.defaultval);
 }
 
-std::unique_ptr<envDef> persistvariables::getDef(std::string key) const
+const envDef * persistvariables::getDef(std::string key) const
 {
-   for (const auto & x : mEnvDefs)
-      if (Poco::icompare(x.name, key) == 0)
-         return std::unique_ptr<envDef>(new envDef(x));
-   return nullptr;
+   auto it = mEnvDefIndex.find(foldcase(key));
+   if (it == mEnvDefIndex.end())
+      return NULL;
+   return &mEnvDefs[it->second];
 }
 
 bool persistvariables::exists() const
 {
-   return utils::fileexists(mPath);
+   return persistence::exists(mPath);
 }
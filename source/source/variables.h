@@ -5,6 +5,7 @@
 #include <cereal/types/string.hpp>
 #include <cereal/types/vector.hpp>
 #include <cereal/types/map.hpp>
+#include <unordered_map>
 
 #include <Poco/Process.h>
 #include <Poco/Path.h>
@@ -14,6 +15,8 @@
 
 typedef std::map<std::string, std::string> tKeyVals;
 
+// Variables are stored in a map (stable order for serialisation and the environment),
+// with a hash index on the case-folded key so lookups are case insensitive and O(1).
 class keyVals {
 public:
    keyVals() {}
@@ -29,13 +32,20 @@ public:
    std::string substitute(std::string s) const;
    const tKeyVals & getAll() const { return mKeyVals; }
 
+   static std::string foldcase(const std::string & key);
+
 private:
+   const std::string * _find(const std::string & key) const; // the stored value, or NULL.
+   const std::string * _findexact(const std::string & key) const; // as _find, but case sensitive.
+   void _reindex();
+
    tKeyVals mKeyVals;
+   std::unordered_map<std::string, std::string> mIndex; // folded key -> key as stored in mKeyVals.
 
    // --- serialisation --
    friend class cereal::access;
    template <class Archive> void save(Archive &ar, std::uint32_t const version) const { ar(mKeyVals); }
-   template <class Archive> void load(Archive &ar, std::uint32_t const version) { mKeyVals.clear(); ar(mKeyVals); }
+   template <class Archive> void load(Archive &ar, std::uint32_t const version) { mKeyVals.clear(); ar(mKeyVals); _reindex(); }
    // --- serialisation --
 };
 CEREAL_CLASS_VERSION(keyVals, 1);
@@ -89,15 +99,18 @@ public:
 
    const std::vector<envDef> & getEnvDefs() { return mEnvDefs; }
 
+   // the definition for key (case insensitive), or NULL if there isn't one.
+   // Pointer is invalidated by _addConfig.
+   const envDef * getDef(std::string key) const;
+
 protected:
    cResult _showconfiginfo() const;
    void _addConfig(const envDef & c);
 
-   std::unique_ptr<envDef> getDef(std::string key) const;
-
    std::string mName; // name of service (or whatever) to print nice messages.
    Poco::Path mPath;
    std::vector<envDef> mEnvDefs;
+   std::unordered_map<std::string, size_t> mEnvDefIndex; // folded name -> index in mEnvDefs.
 };
 
 #endif
\ No newline at end of file